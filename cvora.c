@@ -77,14 +77,46 @@
 
 #include <asm/io.h>
 #include <asm/uaccess.h>
+#include <asm/atomic.h>
 #include <linux/fs.h>
 #include <linux/interrupt.h>
+#include <linux/spinlock.h>
+#include <linux/mm.h>
+#include <linux/time.h>
+#include <linux/file.h>
+#include <linux/eventfd.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/capability.h>
+#include <linux/err.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+#include <linux/marker.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "vmebus.h"
 #include "cvora.h"
 
 #define TSI148_LCSR_DSTA_DON (1<<25)	/* DMA done */
 
+#define VME_NO_ADDR_INCREMENT 1
+#define DMA_BLOCK_SIZE        4096
+#define SAMPLES_IN_DMA_BLOCK  2048
+#define DMA_MIN_BLOCK_SIZE    32
+
+/* CVORA registers captured by the ISR, offsets in map0 */
+
+#define CVORA_CONTROL		0x0
+#define CVORA_MEMORY_POINTER	0x4
+#define CVORA_MODE		0x8
+#define CVORA_FREQUENCY		0x10
+#define CVORA_MEMORY		0x20
+#define CVORA_MEM_MAX		0x7FFFC
+
 /*
  * ======================================================================
  * Static memory
@@ -173,6 +205,37 @@ MODULE_PARM_DESC(size2, "Second window size in bytes");
 MODULE_PARM_DESC(nmap, "No VME map flags, 1=DMA only");
 MODULE_PARM_DESC(isrc, "Location of interrupt source reg in base_address1");
 
+/* DMA tuning per lun, zero means default */
+
+static long dma_bsize[DRV_MAX_DEVICES];	/* VME and PCI block size in bytes */
+static long dma_backoff[DRV_MAX_DEVICES];	/* VME and PCI backoff code */
+static long dma_am[DRV_MAX_DEVICES];	/* DMA address modifier */
+static long dma_dwd[DRV_MAX_DEVICES];	/* DMA data width in bits */
+static long dma_chunk[DRV_MAX_DEVICES];	/* Max bytes per DMA transfer */
+
+static unsigned int dma_bsize_num;
+static unsigned int dma_backoff_num;
+static unsigned int dma_am_num;
+static unsigned int dma_dwd_num;
+static unsigned int dma_chunk_num;
+
+module_param_array(dma_bsize, long, &dma_bsize_num, 0444);
+module_param_array(dma_backoff, long, &dma_backoff_num, 0444);
+module_param_array(dma_am, long, &dma_am_num, 0444);
+module_param_array(dma_dwd, long, &dma_dwd_num, 0444);
+module_param_array(dma_chunk, long, &dma_chunk_num, 0444);
+
+MODULE_PARM_DESC(dma_bsize, "DMA block size 32..4096 bytes");
+MODULE_PARM_DESC(dma_backoff, "DMA backoff code 0..7");
+MODULE_PARM_DESC(dma_am, "DMA address modifier (BLT, MBLT, 2eVME)");
+MODULE_PARM_DESC(dma_dwd, "DMA data width 16,32,64 bits");
+MODULE_PARM_DESC(dma_chunk, "Max bytes per DMA transfer");
+
+static long pool[DRV_MAX_DEVICES];	/* DMA buffers allocated at install */
+static unsigned int pool_num;
+module_param_array(pool, long, &pool_num, 0444);
+MODULE_PARM_DESC(pool, "Persistent DMA buffers, 0..8 per lun");
+
 static char dname[64] = { 0 };
 
 module_param_string(dname, dname, sizeof(dname), 0);
@@ -188,21 +251,87 @@ struct vmeio_map {
 	unsigned long	data_width;
 	unsigned long	window_size;
 	void		*vaddr;		/* NULL if not mapped */
+	int		attempted;	/* mapping tried, see vmeio_map_window */
 	struct vme_berr_handler
 			*bus_error_handler;	/* NULL if inexistent */
 };
 
+/*
+ * Board registers as read in the ISR, so that a woken reader gets
+ * the values belonging to its interrupt
+ */
+struct vmeio_snapshot {
+	unsigned int	control;
+	unsigned int	memory_pointer;
+	unsigned int	mode;
+	unsigned int	frequency;
+};
+
+/*
+ * An eventfd signalled on each interrupt, and the file that
+ * attached it so that it can be dropped when that file is closed
+ */
+#define MAX_EVENTFDS	8
+
+struct vmeio_eventfd {
+	struct file	*efd;
+	struct file	*owner;
+};
+
+/*
+ * DMA tuning of a lun, see struct vmeio_dma_params_s
+ */
+struct vmeio_dma {
+	int	bsize;		/* block size in bytes */
+	int	backoff;	/* backoff code */
+	int	am;		/* address modifier */
+	int	dwd;		/* data width in bits, 0 window's */
+	int	chunk;		/* max bytes per transfer, 0 unlimited */
+};
+
+/*
+ * Per lun I/O statistics, shown in debugfs, updated under the lock
+ */
+struct vmeio_stats {
+	unsigned long	ioctls[vmeioLAST - vmeioFIRST];	/* by number */
+	unsigned long	pio_count;
+	u64		pio_bytes;
+	unsigned long	dma_count;
+	u64		dma_bytes;
+	u64		dma_ns;		/* time spent in DMA */
+	unsigned long	wakeups;	/* waits ended by an interrupt */
+};
+
 /*
  * vmeio device descriptor:
  *	maps[max_maps]		array of mapped VME windows
+ *	attached		slot in use, see vmeio_attach and vmeio_detach
+ *	users			open files on the slot, mappings included
  *
  *	isrfl			1 if interrupt handler installed
  *	isrc			offset of int source reg in map0
  *	isr_source_address	interrupt source reg address
  *	isr_source_mask		result of the read
+ *	snap			registers captured at interrupt time
+ *	isr_time		time the last interrupt was serviced
+ *	lock			protects mask, snap, icnt and counters
+ *	status			read only page published for mmap
+ *	eventfds		eventfds to signal on interrupt, NULL if free
+ *	consumed		interrupts handed to readers
+ *	lost			interrupts superseded before a reader saw them
+ *	last_read_icnt		icnt seen by the last reader
+ *
+ *	stats			I/O statistics
+ *	dma			DMA tuning
+ *	pool			persistent DMA buffers, pool_count of them
+ *
+ *	sim_*			synthetic interrupt generator state
+ *
+ *	stream_*		live streaming of the sample memory, see
+ *				the streaming section below
  *
  *	queue			interrupt waits
- *	timeout			timeout value for wait queue
+ *	timeout			wait queue timeout in microseconds
  *	icnt			interrupt counter
  *
  *	debug			debug level
@@ -218,19 +347,76 @@ struct vmeio_device {
 	int			vec;
 	int			lvl;
 	unsigned		isrc;
+	int			attached;
+	atomic_t		users;
 	int			isrfl;
 	void			*isr_source_address;
 	int			isr_source_mask;
+	struct vmeio_snapshot	snap;
+	spinlock_t		lock;
 
 	wait_queue_head_t	queue;
 	int			timeout;
 	int			icnt;
 
+	struct timespec		isr_time;
+	int			bus_errors;
+	int			timeouts;
+	struct vmeio_status_page_s *status;
+	struct vmeio_eventfd	eventfds[MAX_EVENTFDS];
+	int			consumed;
+	int			lost;
+	int			last_read_icnt;
+
+	struct vmeio_stats	stats;
+	struct vmeio_dma	dma;
+	char			*pool[VMEIO_POOL_MAX];
+	int			pool_count;
+
+	struct hrtimer		sim_timer;
+	struct vmeio_sim_s	sim;
+	int			sim_running;
+	int			sim_left;
+	int			sim_delivered;
+	char			*sim_image;
+	int			sim_image_size;
+
+	struct hrtimer		stream_timer;
+	struct work_struct	stream_work;
+	struct mutex		stream_mutex;
+	wait_queue_head_t	stream_queue;
+	struct vmeio_stream_s	stream;
+	int			streaming;
+	char			*stream_ring;
+	char			*stream_bounce;
+	unsigned int		stream_head;
+	unsigned int		stream_tail;
+	unsigned int		stream_tail_offset;
+	unsigned int		stream_boundary;
+	int			stream_boundary_pending;
+	unsigned int		stream_wm;
+	int			stream_overruns;
+
 	int			debug;
 };
 
 static struct vmeio_device devices[DRV_MAX_DEVICES];
 
+static enum hrtimer_restart vmeio_sim_tick(struct hrtimer *timer);
+static enum hrtimer_restart vmeio_stream_tick(struct hrtimer *timer);
+static void vmeio_stream_work(struct work_struct *work);
+static void vmeio_stream_stop(struct vmeio_device *dev);
+static int check_dma(struct vmeio_dma *dma);
+static int do_dma(struct vmeio_device *dev, int winum, int offset,
+		  void *buffer, int bsize, enum vme_dma_dir direction,
+		  int kernel);
+static void vmeio_pool_alloc(struct vmeio_device *dev, int count);
+static void vmeio_pool_free(struct vmeio_device *dev);
+static void vmeio_release_eventfds(struct vmeio_device *dev,
+				   struct file *owner);
+static void vmeio_debugfs_init(void);
+static void vmeio_debugfs_exit(void);
+
 struct file_operations vmeio_fops;
 
 /* ================= */
@@ -400,6 +586,71 @@ static void HWr8(char v, void *x)
 	return;
 }
 
+/*
+ * =========================================================
+ * Status page publication
+ * Must be called with dev->lock held
+ * =========================================================
+ */
+
+static void vmeio_publish(struct vmeio_device *dev)
+{
+	struct vmeio_status_page_s *st = dev->status;
+
+	if (!st)
+		return;
+
+	st->seq++;
+	smp_wmb();
+
+	st->logical_unit	= dev->lun;
+	st->interrupt_count	= dev->icnt;
+	st->interrupt_mask	= dev->isr_source_mask;
+	st->isr_sec		= dev->isr_time.tv_sec;
+	st->isr_nsec		= dev->isr_time.tv_nsec;
+	st->control		= dev->snap.control;
+	st->memory_pointer	= dev->snap.memory_pointer;
+	st->mode		= dev->snap.mode;
+	st->frequency		= dev->snap.frequency;
+	st->bus_errors		= dev->bus_errors;
+	st->timeouts		= dev->timeouts;
+
+	smp_wmb();
+	st->seq++;
+}
+
+/* ==================== */
+/* Account a new interrupt, must be called with dev->lock held */
+/* The caller wakes up dev->queue once the lock is released    */
+
+static void vmeio_deliver(struct vmeio_device *dev)
+{
+	int i;
+
+	dev->icnt++;
+	getnstimeofday(&dev->isr_time);
+	vmeio_publish(dev);
+	trace_mark(cvora_irq, "lun %d icnt %d mask 0x%x",
+		   dev->lun, dev->icnt, dev->isr_source_mask);
+
+	for (i = 0; i < MAX_EVENTFDS; i++) {
+		if (dev->eventfds[i].efd)
+			eventfd_signal(dev->eventfds[i].efd, 1);
+	}
+}
+
+/* ==================== */
+
+static void vmeio_count_bus_error(struct vmeio_device *dev)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->bus_errors++;
+	vmeio_publish(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
 /*
  * =========================================================
  * Interrupt service routine
@@ -409,7 +660,13 @@ static void HWr8(char v, void *x)
 static irqreturn_t vmeio_irq(void *arg)
 {
 	struct vmeio_device *dev = arg;
-	long data;
+	struct vmeio_snapshot snap;
+	char *regs = dev->maps[0].vaddr;
+	unsigned long flags;
+	long data = 0;
+	int src_error = 0, berr = 0;
+
+	/* Each read clears isr_bus_error, so collect it after each */
 
 	if (dev->isr_source_address) {
 		unsigned long data_width = dev->maps[0].data_width;
@@ -419,9 +676,35 @@ static irqreturn_t vmeio_irq(void *arg)
 			data = IHRd16(dev->isr_source_address);
 		else
 			data = IHRd8(dev->isr_source_address);
-		dev->isr_source_mask = data;
+		src_error = isr_bus_error;
 	}
-	dev->icnt++;
+	memset(&snap, 0, sizeof(snap));
+	if (regs) {
+		snap.control        = IHRd32(&regs[CVORA_CONTROL]);
+		berr |= isr_bus_error;
+		snap.memory_pointer = IHRd32(&regs[CVORA_MEMORY_POINTER]);
+		berr |= isr_bus_error;
+		snap.mode           = IHRd32(&regs[CVORA_MODE]);
+		berr |= isr_bus_error;
+		snap.frequency      = IHRd32(&regs[CVORA_FREQUENCY]);
+		berr |= isr_bus_error;
+	}
+	if (berr) {
+		snap.control        = VMEIO_REG_INVALID;
+		snap.memory_pointer = VMEIO_REG_INVALID;
+		snap.mode           = VMEIO_REG_INVALID;
+		snap.frequency      = VMEIO_REG_INVALID;
+	}
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (dev->isr_source_address && !src_error)
+		dev->isr_source_mask = data;
+	if (src_error || berr)
+		dev->bus_errors++;
+	dev->snap = snap;
+	vmeio_deliver(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+
 	wake_up(&dev->queue);
 	return IRQ_HANDLED;
 }
@@ -503,6 +786,7 @@ static void vmeio_map_init(struct vmeio_map *map,
 	map->address_modifier	= amd;
 	map->data_width		= dwd;
 	map->vaddr		= NULL;
+	map->attempted		= 0;
 	map->bus_error_handler	= NULL;
 }
 
@@ -512,14 +796,49 @@ static void vmeio_map_register(struct vmeio_map *map)
 				map->data_width, map->window_size);
 	map->bus_error_handler = set_berr_handler(map->base_address,
 			map->window_size, map->address_modifier);
+	map->attempted = 1;
 }
 
 static void vmeio_map_unregister(struct vmeio_map *map)
 {
-	if (map->base_address)
+	if (map->vaddr)
 		return_controller((unsigned long)map->vaddr, map->window_size);
 	if (map->bus_error_handler)
 		vme_unregister_berr_handler(map->bus_error_handler);
+	map->vaddr = NULL;
+	map->bus_error_handler = NULL;
+}
+
+static unsigned long elapsed_us(ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	do_div(ns, NSEC_PER_USEC);
+	return ns;
+}
+
+/*
+ * Windows the ISR does not need are mapped on first use rather than
+ * at install, called with driver_mutex held. A window that failed to
+ * map is not tried again until the next VMEIO_SET_DEVICE.
+ */
+
+static void *vmeio_map_window(struct vmeio_device *dev, int winum)
+{
+	struct vmeio_map *map;
+	ktime_t start;
+
+	if (winum < 0 || winum >= MAX_MAPS)
+		return NULL;
+	map = &dev->maps[winum];
+	if (map->vaddr || map->attempted || dev->nmap)
+		return map->vaddr;
+
+	start = ktime_get();
+	vmeio_map_register(map);
+	printk("%s:Logical unit:%d window %d mapped on first use in %lu us\n",
+	       vmeio_major_name, dev->lun, winum + 1, elapsed_us(start));
+	return map->vaddr;
 }
 
 
@@ -545,6 +864,79 @@ void set_interrrupt_vector(unsigned int vec)
 	
 }
 
+/*
+ * Kernel objects of a slot, set up once for all slots at install
+ * so that waiters on a detached lun never see them reinitialized
+ */
+
+static void vmeio_init_slot(struct vmeio_device *dev)
+{
+	init_waitqueue_head(&dev->queue);
+	spin_lock_init(&dev->lock);
+
+	hrtimer_init(&dev->sim_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->sim_timer.function = vmeio_sim_tick;
+
+	hrtimer_init(&dev->stream_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->stream_timer.function = vmeio_stream_tick;
+	INIT_WORK(&dev->stream_work, vmeio_stream_work);
+	mutex_init(&dev->stream_mutex);
+	init_waitqueue_head(&dev->stream_queue);
+}
+
+static void vmeio_status_alloc(struct vmeio_device *dev)
+{
+	if (dev->status)
+		return;
+	dev->status = (void *)get_zeroed_page(GFP_KERNEL);
+	if (dev->status) {
+		SetPageReserved(virt_to_page(dev->status));
+		vmeio_publish(dev);
+	} else
+		printk("%s:Logical unit:%d no status page\n",
+		       vmeio_major_name, dev->lun);
+}
+
+static void vmeio_status_free(struct vmeio_device *dev)
+{
+	if (!dev->status)
+		return;
+	ClearPageReserved(virt_to_page(dev->status));
+	free_page((unsigned long)dev->status);
+	dev->status = NULL;
+}
+
+/*
+ * Map the registers and register the ISR of a configured lun.
+ * The ISR needs the registers, all else maps on first use.
+ */
+
+static void vmeio_start(struct vmeio_device *dev, int use_isrc)
+{
+	struct vmeio_map *map0 = &dev->maps[0];
+	unsigned int cr;
+
+	if (dev->nmap != 0) {
+		printk("%s:Logical unit:%d is not mapped: DMA only\n",
+		     vmeio_major_name, dev->lun);
+		return;
+	}
+	if (!dev->lvl || !dev->vec)
+		return;
+
+	printk("%s:Mapping:Logical unit:%d\n", vmeio_major_name, dev->lun);
+	vmeio_map_register(map0);
+	if (!map0->vaddr)
+		return;
+	register_isr(dev, dev->vec, dev->lvl);
+	if (use_isrc)
+		register_int_source(dev, map0->vaddr, dev->isrc);
+	/* set cvora interrupt vector */
+	cr = ioread32be(map0->vaddr);
+	cr |= ((dev->vec & 0xff) << 8);
+	iowrite32be(cr, map0->vaddr);
+}
+
 /*
  * =====================================================
  * Install
@@ -553,8 +945,12 @@ void set_interrrupt_vector(unsigned int vec)
 
 int vmeio_install(void)
 {
+	ktime_t start = ktime_get();
 	int i, cc;
 
+	if (strlen(dname))
+		vmeio_major_name = dname;
+
 	if (luns_num <= 0 || luns_num > DRV_MAX_DEVICES) {
 		printk("%s:Fatal:No logical units defined.\n",
 		       vmeio_major_name);
@@ -597,6 +993,17 @@ int vmeio_install(void)
 	set_remaining_null(nmap, nmap_num);
 	set_remaining_null(isrc, isrc_num);
 	set_remaining_null(am2, amd2_num);
+	set_remaining_null(dma_bsize, dma_bsize_num);
+	set_remaining_null(dma_backoff, dma_backoff_num);
+	set_remaining_null(dma_am, dma_am_num);
+	set_remaining_null(dma_dwd, dma_dwd_num);
+	set_remaining_null(dma_chunk, dma_chunk_num);
+	set_remaining_null(pool, pool_num);
+
+	/* Every slot can be attached later, see vmeio_attach */
+
+	for (i = 0; i < DRV_MAX_DEVICES; i++)
+		vmeio_init_slot(&devices[i]);
 
 	/* Build module contexts */
 
@@ -605,8 +1012,6 @@ int vmeio_install(void)
 		struct vmeio_map *map0 = &dev->maps[0];
 		struct vmeio_map *map1 = &dev->maps[1];
 
-		memset(dev, 0, sizeof(*dev));
-
 		dev->lun = lun[i];
 
 		map0->base_address     = base_address1[i];
@@ -628,7 +1033,21 @@ int vmeio_install(void)
 		dev->vec  = vector[i];
 		dev->nmap = nmap[i];
 
-		init_waitqueue_head(&dev->queue);
+		dev->dma.bsize   = dma_bsize[i] ? dma_bsize[i] : DMA_BLOCK_SIZE;
+		dev->dma.backoff = dma_backoff[i];
+		dev->dma.am      = dma_am[i] ? dma_am[i] : VME_A24_USER_BLT;
+		dev->dma.dwd     = dma_dwd[i];
+		dev->dma.chunk   = dma_chunk[i];
+		if (check_dma(&dev->dma) < 0) {
+			printk("%s:Logical unit:%d bad DMA parameters, "
+			       "using defaults\n", vmeio_major_name, dev->lun);
+			memset(&dev->dma, 0, sizeof(dev->dma));
+			dev->dma.bsize = DMA_BLOCK_SIZE;
+			dev->dma.am = VME_A24_USER_BLT;
+		}
+
+		vmeio_pool_alloc(dev, pool[i]);
+		vmeio_status_alloc(dev);
 	}
 
 	/* Register driver */
@@ -636,54 +1055,31 @@ int vmeio_install(void)
 	if (cc < 0) {
 		printk("%s:Fatal:Error from register_chrdev [%d]\n",
 		       vmeio_major_name, cc);
+		for (i = 0; i < luns_num; i++) {
+			vmeio_pool_free(&devices[i]);
+			vmeio_status_free(&devices[i]);
+		}
 		return cc;
 	}
 	if (vmeio_major == 0)
 		vmeio_major = cc;	/* dynamic */
 
+	vmeio_debugfs_init();
+
 	/* Create VME mappings and register ISRs */
 
 	for (i = 0; i < luns_num; i++) {
 		struct vmeio_device *dev = &devices[i];
-		struct vmeio_map *map0 = &dev->maps[0];
-		struct vmeio_map *map1 = &dev->maps[1];
 
 		dev->debug = DEBUG;
-		dev->timeout = msecs_to_jiffies(TIMEOUT);
+		dev->timeout = TIMEOUT * USEC_PER_MSEC;
 		dev->icnt = 0;
 
-		if (strlen(dname))
-			vmeio_major_name = dname;
-
-		if (dev->nmap != 0) {
-			printk("%s:Logical unit:%d is not mapped: DMA only\n",
-			     vmeio_major_name, dev->lun);
-			continue;
-		}
-
-		printk("%s:Mapping:Logical unit:%d\n", vmeio_major_name, dev->lun);
-
-		map0->vaddr = map_window(map0->base_address, map0->address_modifier,
-						map0->data_width, map0->window_size);
-		map0->bus_error_handler = set_berr_handler(map0->base_address,
-					map0->window_size, map0->address_modifier);
-		map1->vaddr = map_window(map1->base_address, map1->address_modifier,
-						map1->data_width, map1->window_size);
-		map1->bus_error_handler = set_berr_handler(map1->base_address,
-					map1->window_size, map1->address_modifier);
-
-		if (dev->lvl && dev->vec) {
-			unsigned int cr;
-
-			register_isr(dev, dev->vec, dev->lvl);
-			if (isrc_num)
-				register_int_source(dev, map0->vaddr, dev->isrc);
-			/* set cvora interrupt vector */
-			cr = ioread32be(map0->vaddr);
-			cr |= ((dev->vec & 0xff) << 8);
-			iowrite32be(cr, map0->vaddr);
-		}
+		vmeio_start(dev, isrc_num);
+		dev->attached = 1;
 	}
+	printk("%s:Installed %d logical units in %lu us\n",
+	       vmeio_major_name, luns_num, elapsed_us(start));
 	return 0;
 }
 
@@ -695,14 +1091,29 @@ void unregister_module(struct vmeio_device *dev) {
 
 	if (dev->vec)
 		vme_intclr(dev->vec, NULL);
-	if (map0->base_address)
-		return_controller((unsigned long)map0->vaddr, map0->window_size);
-	if (map1->base_address)
-		return_controller((unsigned long)map1->vaddr, map1->window_size);
-	if (map0->bus_error_handler)
-		vme_unregister_berr_handler(map0->bus_error_handler);
-	if (map1->bus_error_handler)
-		vme_unregister_berr_handler(map1->bus_error_handler);
+	dev->isrfl = 0;
+	dev->isr_source_address = NULL;
+	vmeio_map_unregister(map0);
+	vmeio_map_unregister(map1);
+}
+
+/*
+ * Undo vmeio_start and stop all activity of a lun. The status page
+ * and the DMA buffers stay, they may still be mapped.
+ */
+
+static void vmeio_stop(struct vmeio_device *dev)
+{
+	/* Streaming and the generator first, they use the windows */
+
+	vmeio_stream_stop(dev);
+	hrtimer_cancel(&dev->sim_timer);
+	dev->sim_running = 0;
+	unregister_module(dev);
+	vfree(dev->sim_image);
+	dev->sim_image = NULL;
+	dev->sim_image_size = 0;
+	vmeio_release_eventfds(dev, NULL);
 }
 
 /*
@@ -715,9 +1126,15 @@ void vmeio_uninstall(void)
 {
 	int i;
 
-	for (i = 0; i < luns_num; i++) {
-		unregister_module(&devices[i]);
+	for (i = 0; i < DRV_MAX_DEVICES; i++) {
+		struct vmeio_device *dev = &devices[i];
+
+		if (dev->attached)
+			vmeio_stop(dev);
+		vmeio_pool_free(dev);
+		vmeio_status_free(dev);
 	}
+	vmeio_debugfs_exit();
 	unregister_chrdev(vmeio_major, vmeio_major_name);
 }
 
@@ -735,6 +1152,7 @@ int vmeio_open(struct inode *inode, struct file *filp)
 	if (!check_minor(num))
 		return -EACCES;
 
+	atomic_inc(&devices[num].users);
 	return 0;
 }
 
@@ -744,6 +1162,32 @@ int vmeio_open(struct inode *inode, struct file *filp)
  * =====================================================
  */
 
+static void vmeio_release_eventfds(struct vmeio_device *dev,
+				   struct file *owner)
+{
+	struct file *efds[MAX_EVENTFDS];
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	for (i = 0; i < MAX_EVENTFDS; i++) {
+		struct vmeio_eventfd *e = &dev->eventfds[i];
+
+		efds[i] = NULL;
+		if (e->efd && (owner == NULL || e->owner == owner)) {
+			efds[i] = e->efd;
+			e->efd = NULL;
+			e->owner = NULL;
+		}
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	for (i = 0; i < MAX_EVENTFDS; i++) {
+		if (efds[i])
+			fput(efds[i]);
+	}
+}
+
 int vmeio_close(struct inode *inode, struct file *filp)
 {
 	long num;
@@ -752,9 +1196,109 @@ int vmeio_close(struct inode *inode, struct file *filp)
 	if (!check_minor(num))
 		return -EACCES;
 
+	vmeio_release_eventfds(&devices[num], filp);
+	atomic_dec(&devices[num].users);
+	return 0;
+}
+
+/*
+ * =====================================================
+ * Wait for the interrupt counter to move away from icnt
+ * The timeout is in microseconds, zero waits forever.
+ * An hrtimer is used so that timeouts are not rounded up
+ * to the next jiffy.
+ * =====================================================
+ */
+
+static int vmeio_wait(struct vmeio_device *dev, int icnt, int timeout)
+{
+	struct hrtimer_sleeper t;
+	unsigned long flags;
+	DEFINE_WAIT(wait);
+	int cc = 0;
+
+	if (timeout) {
+		hrtimer_init(&t.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		hrtimer_init_sleeper(&t, current);
+		hrtimer_start(&t.timer,
+			      ktime_set(timeout / USEC_PER_SEC,
+					(timeout % USEC_PER_SEC) * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	}
+
+	for (;;) {
+		prepare_to_wait(&dev->queue, &wait, TASK_INTERRUPTIBLE);
+		if (icnt != dev->icnt)
+			break;
+		if (!dev->attached) {
+			cc = -ENODEV;
+			break;
+		}
+		if (timeout && !t.task) {
+			cc = -ETIME;
+			break;
+		}
+		if (signal_pending(current)) {
+			cc = -ERESTARTSYS;
+			break;
+		}
+		schedule();
+	}
+	finish_wait(&dev->queue, &wait);
+
+	if (timeout)
+		hrtimer_cancel(&t.timer);
+
+	if (cc == 0) {
+		spin_lock_irqsave(&dev->lock, flags);
+		dev->stats.wakeups++;
+		spin_unlock_irqrestore(&dev->lock, flags);
+		trace_mark(cvora_wakeup, "lun %d icnt %d", dev->lun, icnt);
+	}
+
+	if (dev->debug > 2) {
+		printk("%s:wait_event:returned:%d\n", vmeio_major_name,
+		       cc);
+	}
+
+	if (cc == -ERESTARTSYS) {
+		printk("%s:vmeio_wait:interrupted by signal\n",
+		       vmeio_major_name);
+		return cc;
+	}
+	if (cc == -ETIME) {
+		spin_lock_irqsave(&dev->lock, flags);
+		dev->timeouts++;
+		vmeio_publish(dev);
+		spin_unlock_irqrestore(&dev->lock, flags);
+		return -ETIME;	/* Timer expired */
+	}
+	if (cc < 0)
+		return cc;	/* Error */
 	return 0;
 }
 
+static void vmeio_get_event(struct vmeio_device *dev,
+			    struct vmeio_read_buf_ext_s *rbuf)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (dev->icnt != dev->last_read_icnt) {
+		dev->lost += dev->icnt - dev->last_read_icnt - 1;
+		dev->last_read_icnt = dev->icnt;
+	}
+	dev->consumed++;
+	rbuf->logical_unit = dev->lun;
+	rbuf->interrupt_mask = dev->isr_source_mask;
+	rbuf->interrupt_count = dev->icnt;
+	rbuf->control = dev->snap.control;
+	rbuf->memory_pointer = dev->snap.memory_pointer;
+	rbuf->mode = dev->snap.mode;
+	rbuf->frequency = dev->snap.frequency;
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
 /*
  * =====================================================
  * Read
@@ -768,15 +1312,17 @@ ssize_t vmeio_read(struct file * filp, char *buf, size_t count,
 	long minor;
 	struct inode *inode;
 
-	struct vmeio_read_buf_s rbuf;
+	struct vmeio_read_buf_ext_s rbuf;
 	struct vmeio_device *dev;
-	int icnt;
+	size_t rsize;
 
 	inode = filp->f_dentry->d_inode;
 	minor = MINOR(inode->i_rdev);
 	if (!check_minor(minor))
 		return -EACCES;
 	dev = &devices[minor];
+	if (!dev->attached)
+		return -ENODEV;
 
 	if (dev->debug) {
 		printk("%s:read:count:%d minor:%d\n", vmeio_major_name,
@@ -787,7 +1333,7 @@ ssize_t vmeio_read(struct file * filp, char *buf, size_t count,
 		}
 	}
 
-	if (count < sizeof(rbuf)) {
+	if (count < sizeof(struct vmeio_read_buf_s)) {
 		if (dev->debug) {
 			printk("%s:read:Access error buffer too small\n",
 			       vmeio_major_name);
@@ -795,41 +1341,23 @@ ssize_t vmeio_read(struct file * filp, char *buf, size_t count,
 		return -EACCES;
 	}
 
-	icnt = dev->icnt;
-	if (dev->timeout) {
-		cc = wait_event_interruptible_timeout(dev->queue,
-						      icnt != dev->icnt,
-						      dev->timeout);
-	} else {
-		cc = wait_event_interruptible(dev->queue,
-					      icnt != dev->icnt);
-	}
-
-	if (dev->debug > 2) {
-		printk("%s:wait_event:returned:%d\n", vmeio_major_name,
-		       cc);
-	}
-
-	if (cc == -ERESTARTSYS) {
-		printk("%s:vmeio_read:interrupted by signal\n",
-		       vmeio_major_name);
+	if ((cc = vmeio_wait(dev, dev->icnt, dev->timeout)) < 0)
 		return cc;
-	}
-	if (cc == 0 && dev->timeout)
-		return -ETIME;	/* Timer expired */
-	if (cc < 0)
-		return cc;	/* Error */
+	vmeio_get_event(dev, &rbuf);
+
+	/* Old clients only know about struct vmeio_read_buf_s */
 
-	rbuf.logical_unit = dev->lun;
-	rbuf.interrupt_mask = dev->isr_source_mask;
-	rbuf.interrupt_count = dev->icnt;
+	if (count < sizeof(rbuf))
+		rsize = sizeof(struct vmeio_read_buf_s);
+	else
+		rsize = sizeof(rbuf);
 
-	cc = copy_to_user(buf, &rbuf, sizeof(rbuf));
+	cc = copy_to_user(buf, &rbuf, rsize);
 	if (cc != 0) {
 		printk("%s:Can't copy to user space:cc=%d\n", vmeio_major_name, cc);
 		return -EACCES;
 	}
-	return sizeof(struct vmeio_read_buf_s);
+	return rsize;
 }
 
 /*
@@ -845,6 +1373,7 @@ ssize_t vmeio_write(struct file * filp, const char *buf, size_t count,
 	long minor;
 	struct vmeio_device *dev;
 	struct inode *inode;
+	unsigned long flags;
 	int cc, mask;
 
 	inode = filp->f_dentry->d_inode;
@@ -852,6 +1381,8 @@ ssize_t vmeio_write(struct file * filp, const char *buf, size_t count,
 	if (!check_minor(minor))
 		return -EACCES;
 	dev = &devices[minor];
+	if (!dev->attached)
+		return -ENODEV;
 
 	if (count >= sizeof(int)) {
 		cc = copy_from_user(&mask, buf, sizeof(int));
@@ -867,77 +1398,388 @@ ssize_t vmeio_write(struct file * filp, const char *buf, size_t count,
 		       vmeio_major_name, count, (int) minor, mask);
 	}
 
+	spin_lock_irqsave(&dev->lock, flags);
 	dev->isr_source_mask = mask;
-	dev->icnt++;
+	vmeio_deliver(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
 	wake_up(&dev->queue);
 	return sizeof(int);
 }
 
 /*
  * =====================================================
- * Ioctl
+ * Synthetic interrupt generator
+ * Bursts of sim.burst interrupts sim.spacing us apart,
+ * one burst every sim.period us.
  * =====================================================
  */
 
-#define VME_NO_ADDR_INCREMENT 1
-#define DMA_BLOCK_SIZE        4096
-#define SAMPLES_IN_DMA_BLOCK  2048
-
-/*
- * ====================================================================
- * Debug routines
- */
-
-static char *ioctl_names[vmeioLAST - vmeioFIRST] = {
-	"Unknown IOCTL number",
-	"SET_DEBUG",
-	"GET_DEBUG",
-	"GET_VERSION",
-	"SET_TIMEOUT",
-	"GET_TIMEOUT",
-	"GET_DEVICE",
-	"RAW_READ",
-	"RAW_WRITE",
-	"RAW_READ_DMA",
-	"RAW_WRITE_DMA",
-	"SET_DEVICE"
-};
-
-static void debug_ioctl(int ionr, int iodr, int iosz, void *arg, long num,
-			int dlevel)
+static ktime_t us_to_ktime(int us)
 {
-	int c;
-	int *iargp = arg;
-
-	if (dlevel <= 0)
-		return;
+	if (us < 1)
+		us = 1;
+	return ktime_set(us / USEC_PER_SEC, (us % USEC_PER_SEC) * NSEC_PER_USEC);
+}
 
-	printk("%s:debug_ioctl:ionr:%d", vmeio_major_name, ionr);
-	if (ionr <= vmeioFIRST || ionr >= vmeioLAST) {
-		printk(" BAD:");
+static enum hrtimer_restart vmeio_sim_tick(struct hrtimer *timer)
+{
+	struct vmeio_device *dev =
+		container_of(timer, struct vmeio_device, sim_timer);
+	struct vmeio_sim_s *sim = &dev->sim;
+	enum hrtimer_restart res = HRTIMER_RESTART;
+	unsigned long flags;
+	int gap;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->isr_source_mask = sim->mask;
+	memset(&dev->snap, 0, sizeof(dev->snap));
+	dev->snap.memory_pointer = CVORA_MEMORY + dev->sim_image_size;
+	vmeio_deliver(dev);
+	dev->sim_delivered++;
+
+	if (sim->count && dev->sim_delivered >= sim->count) {
+		dev->sim_running = 0;
+		res = HRTIMER_NORESTART;
+	} else if (--dev->sim_left > 0) {
+		hrtimer_forward(timer, hrtimer_cb_get_time(timer),
+				us_to_ktime(sim->spacing));
 	} else {
-		c = ionr - vmeioFIRST;
-		printk(" %s:", ioctl_names[c]);
+		dev->sim_left = sim->burst;
+		gap = sim->period - (sim->burst - 1) * sim->spacing;
+		hrtimer_forward(timer, hrtimer_cb_get_time(timer),
+				us_to_ktime(gap));
 	}
+	spin_unlock_irqrestore(&dev->lock, flags);
 
-	printk(" iodr:%d:", iodr);
-	if (iodr & _IOC_WRITE)
-		printk("WR:");
-	if (iodr & _IOC_READ)
-		printk("RD:");
-
-	if (arg)
-		c = *iargp;
-	else
-		c = 0;
-	printk(" iosz:%d arg:0x%p[%d] minor:%d\n", iosz, arg, c,
-	       (int) num);
+	wake_up(&dev->queue);
+	return res;
 }
 
-
-static void vmeio_set_debug(struct vmeio_device *dev, int *debug)
+static int vmeio_set_sim(struct vmeio_device *dev, struct vmeio_sim_s *sim)
 {
-	dev->debug = *debug;
+	unsigned long flags;
+
+	hrtimer_cancel(&dev->sim_timer);
+	dev->sim_running = 0;
+
+	if (sim->period == 0)
+		return 0;
+	if (sim->period < 0 || sim->burst < 0 || sim->spacing < 0 ||
+	    sim->count < 0)
+		return -EINVAL;
+	if (sim->burst == 0)
+		sim->burst = 1;
+	if ((sim->burst - 1) * sim->spacing >= sim->period)
+		return -EINVAL;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->sim = *sim;
+	dev->sim_left = sim->burst;
+	dev->sim_delivered = 0;
+	dev->consumed = 0;
+	dev->lost = 0;
+	dev->last_read_icnt = dev->icnt;
+	dev->sim_running = 1;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	hrtimer_start(&dev->sim_timer, us_to_ktime(sim->period),
+		      HRTIMER_MODE_REL);
+	return 0;
+}
+
+static void vmeio_get_sim_stats(struct vmeio_device *dev,
+				struct vmeio_sim_stats_s *stats)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	stats->running = dev->sim_running;
+	stats->delivered = dev->sim_delivered;
+	stats->consumed = dev->consumed;
+	stats->lost = dev->lost;
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+/*
+ * The image is returned, instead of the VME sample memory, by DMA
+ * reads of window 1 as long as it is set, so the last cycle of a
+ * counted run still reads back once the generator stopped. It must
+ * be in the byte order of the module; an empty image clears it.
+ */
+
+static int vmeio_set_sim_image(struct vmeio_device *dev,
+			       struct vmeio_riob_s *riob)
+{
+	char *image = NULL, *old;
+	unsigned long flags;
+
+	if (riob->bsize < 0 || riob->bsize > CVORA_MEM_MAX - CVORA_MEMORY)
+		return -E2BIG;
+
+	if (riob->bsize) {
+		image = vmalloc(riob->bsize);
+		if (!image)
+			return -ENOMEM;
+		if (copy_from_user(image, riob->buffer, riob->bsize)) {
+			vfree(image);
+			return -EACCES;
+		}
+	}
+
+	spin_lock_irqsave(&dev->lock, flags);
+	old = dev->sim_image;
+	dev->sim_image = image;
+	dev->sim_image_size = riob->bsize;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	vfree(old);
+	return 0;
+}
+
+static int sim_dma(struct vmeio_device *dev, struct vmeio_riob_s *riob)
+{
+	int offset;
+
+	if (riob->offset < CVORA_MEMORY || riob->bsize < 0)
+		return -EINVAL;
+	offset = riob->offset - CVORA_MEMORY;
+	if (offset > dev->sim_image_size ||
+	    riob->bsize > dev->sim_image_size - offset)
+		return -EINVAL;
+	if (copy_to_user(riob->buffer, &dev->sim_image[offset], riob->bsize))
+		return -EACCES;
+	return 0;
+}
+
+/*
+ * =====================================================
+ * Persistent DMA buffer pool
+ * =====================================================
+ */
+
+#define POOL_ORDER get_order(VMEIO_POOL_SIZE)
+
+static void pool_reserve(char *buf, int reserve)
+{
+	struct page *page = virt_to_page(buf);
+	struct page *end = page + (1 << POOL_ORDER);
+
+	for (; page < end; page++) {
+		if (reserve)
+			SetPageReserved(page);
+		else
+			ClearPageReserved(page);
+	}
+}
+
+/*
+ * Contiguous buffers are best found early, a pool that can not be
+ * filled is kept as far as it got.
+ */
+
+static void vmeio_pool_alloc(struct vmeio_device *dev, int count)
+{
+	char *buf;
+
+	count = min(count, VMEIO_POOL_MAX);
+	for (dev->pool_count = 0; dev->pool_count < count; dev->pool_count++) {
+		buf = (char *)__get_free_pages(GFP_KERNEL | __GFP_NOWARN,
+					       POOL_ORDER);
+		if (!buf) {
+			printk("%s:Logical unit:%d only %d of %d DMA buffers\n",
+			       vmeio_major_name, dev->lun, dev->pool_count,
+			       count);
+			break;
+		}
+		pool_reserve(buf, 1);
+		dev->pool[dev->pool_count] = buf;
+	}
+}
+
+static void vmeio_pool_free(struct vmeio_device *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->pool_count; i++) {
+		pool_reserve(dev->pool[i], 0);
+		free_pages((unsigned long)dev->pool[i], POOL_ORDER);
+		dev->pool[i] = NULL;
+	}
+	dev->pool_count = 0;
+}
+
+static int vmeio_pool_dma(struct vmeio_device *dev,
+			  struct vmeio_pool_dma_s *pd)
+{
+	int offset;
+
+	if (pd->index < 0 || pd->index >= dev->pool_count ||
+	    pd->winum < 1 || pd->winum > MAX_MAPS)
+		return -EINVAL;
+	if (pd->bsize < 0 || pd->bsize > VMEIO_POOL_SIZE)
+		return -E2BIG;
+
+	if (dev->sim_image && pd->winum == 1) {
+		if (pd->offset < CVORA_MEMORY)
+			return -EINVAL;
+		offset = pd->offset - CVORA_MEMORY;
+		if (offset > dev->sim_image_size ||
+		    pd->bsize > dev->sim_image_size - offset)
+			return -EINVAL;
+		memcpy(dev->pool[pd->index], &dev->sim_image[offset],
+		       pd->bsize);
+		return 0;
+	}
+	return do_dma(dev, pd->winum, pd->offset, dev->pool[pd->index],
+		      pd->bsize, VME_DMA_FROM_DEVICE, 1);
+}
+
+/*
+ * =====================================================
+ * Mmap
+ * The read only status page at offset zero, then the
+ * DMA buffer pool at VMEIO_POOL_OFFSET(i)
+ * =====================================================
+ */
+
+int vmeio_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct vmeio_device *dev;
+	unsigned long size;
+	long minor;
+
+	minor = MINOR(filp->f_dentry->d_inode->i_rdev);
+	if (!check_minor(minor))
+		return -EACCES;
+	dev = &devices[minor];
+
+	size = vma->vm_end - vma->vm_start;
+	if (vma->vm_pgoff) {
+		unsigned long i = (vma->vm_pgoff << PAGE_SHIFT) / VMEIO_POOL_SIZE;
+
+		if ((vma->vm_pgoff << PAGE_SHIFT) % VMEIO_POOL_SIZE || i < 1 ||
+		    i > dev->pool_count || size > VMEIO_POOL_SIZE)
+			return -EINVAL;
+		return remap_pfn_range(vma, vma->vm_start,
+				       virt_to_phys(dev->pool[i - 1]) >> PAGE_SHIFT,
+				       size, vma->vm_page_prot);
+	}
+	if (!dev->status || size != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(dev->status) >> PAGE_SHIFT,
+			       PAGE_SIZE, vma->vm_page_prot);
+}
+
+/*
+ * =====================================================
+ * Ioctl
+ * =====================================================
+ */
+
+/*
+ * ====================================================================
+ * Debug routines
+ */
+
+static char *ioctl_names[vmeioLAST - vmeioFIRST] = {
+	"Unknown IOCTL number",
+	"SET_DEBUG",
+	"GET_DEBUG",
+	"GET_VERSION",
+	"SET_TIMEOUT",
+	"GET_TIMEOUT",
+	"GET_DEVICE",
+	"RAW_READ",
+	"RAW_WRITE",
+	"RAW_READ_DMA",
+	"RAW_WRITE_DMA",
+	"SET_DEVICE",
+	"WAIT",
+	"ADD_EVENTFD",
+	"DEL_EVENTFD",
+	"SET_TIMEOUT_US",
+	"GET_TIMEOUT_US",
+	"SET_SIM",
+	"GET_SIM_STATS",
+	"SET_SIM_IMAGE",
+	"SET_STREAM",
+	"STREAM_READ",
+	"SET_DMA",
+	"GET_DMA",
+	"GET_POOL",
+	"POOL_DMA",
+	"ATTACH",
+	"DETACH"
+};
+
+static char *ioctl_name(int ionr)
+{
+	if (ionr <= vmeioFIRST || ionr >= vmeioLAST)
+		return ioctl_names[0];
+	return ioctl_names[ionr - vmeioFIRST];
+}
+
+static void count_ioctl(struct vmeio_device *dev, int ionr)
+{
+	unsigned long flags;
+
+	if (ionr <= vmeioFIRST || ionr >= vmeioLAST)
+		ionr = vmeioFIRST;
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->stats.ioctls[ionr - vmeioFIRST]++;
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+static void count_pio(struct vmeio_device *dev, int bytes)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->stats.pio_count++;
+	dev->stats.pio_bytes += bytes;
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+static void debug_ioctl(int ionr, int iodr, int iosz, void *arg, long num,
+			int dlevel)
+{
+	int c;
+	int *iargp = arg;
+
+	if (dlevel <= 0)
+		return;
+
+	printk("%s:debug_ioctl:ionr:%d", vmeio_major_name, ionr);
+	if (ionr <= vmeioFIRST || ionr >= vmeioLAST) {
+		printk(" BAD:");
+	} else {
+		c = ionr - vmeioFIRST;
+		printk(" %s:", ioctl_names[c]);
+	}
+
+	printk(" iodr:%d:", iodr);
+	if (iodr & _IOC_WRITE)
+		printk("WR:");
+	if (iodr & _IOC_READ)
+		printk("RD:");
+
+	if (arg)
+		c = *iargp;
+	else
+		c = 0;
+	printk(" iosz:%d arg:0x%p[%d] minor:%d\n", iosz, arg, c,
+	       (int) num);
+}
+
+
+static void vmeio_set_debug(struct vmeio_device *dev, int *debug)
+{
+	dev->debug = *debug;
 }
 
 static void vmeio_get_debug(struct vmeio_device *dev, int *debug)
@@ -950,14 +1792,38 @@ static void vmeio_get_version(int *version)
 	*version = COMPILE_TIME;
 }
 
-static void vmeio_set_timeout(struct vmeio_device *dev, int *timeout)
+static int vmeio_set_timeout(struct vmeio_device *dev, int *timeout)
 {
-	dev->timeout = msecs_to_jiffies(*timeout);
+	if (*timeout < 0)
+		return -EINVAL;
+	if (*timeout > INT_MAX / USEC_PER_MSEC)
+		dev->timeout = INT_MAX;
+	else
+		dev->timeout = *timeout * USEC_PER_MSEC;
+	return 0;
 }
 
 static void vmeio_get_timeout(struct vmeio_device *dev, int *timeout)
 {
-	*timeout = jiffies_to_msecs(dev->timeout);
+	u64 ms = (u64)dev->timeout + USEC_PER_MSEC - 1;
+
+	/* Round up, zero would mean no timeout */
+
+	do_div(ms, USEC_PER_MSEC);
+	*timeout = ms;
+}
+
+static int vmeio_set_timeout_us(struct vmeio_device *dev, int *timeout)
+{
+	if (*timeout < 0)
+		return -EINVAL;
+	dev->timeout = *timeout;
+	return 0;
+}
+
+static void vmeio_get_timeout_us(struct vmeio_device *dev, int *timeout)
+{
+	*timeout = dev->timeout;
 }
 
 static void vmeio_get_device(struct vmeio_device *dev,
@@ -989,24 +1855,283 @@ static void vmeio_set_device(struct vmeio_device *dev,
 	struct vmeio_map *map0 = &dev->maps[0];
 	struct vmeio_map *map1 = &dev->maps[1];
 
+	/* stream_work reads the registers under stream_mutex */
+
+	mutex_lock(&dev->stream_mutex);
 	vmeio_map_unregister(map0);
 	vmeio_map_init(map0, win->vme1, win->win1, win->amd1, win->dwd1);
 	vmeio_map_unregister(map1);
 	vmeio_map_init(map1, win->vme2, win->win2, win->amd2, win->dwd2);
-	if (dev->nmap)		/* DMA only */
-		return;
-	vmeio_map_register(map0);
-	vmeio_map_register(map1);
+	if (!dev->nmap) {	/* not DMA only */
+		vmeio_map_register(map0);
+		vmeio_map_register(map1);
+	}
+	mutex_unlock(&dev->stream_mutex);
 }
 
-static int raw_dma(struct vmeio_device *dev,
-	struct vmeio_riob_s *riob, enum vme_dma_dir direction)
+/*
+ * Runtime attach and detach of logical units, called with
+ * driver_mutex held so no other ioctl, and so no DMA, is in flight.
+ * A lun attached again gets back its slot, and so its minor and DMA
+ * buffer pool; a new one takes the first slot never used, or else
+ * the first free that nobody has open, since files and mappings left
+ * on a detached lun must keep failing rather than act on another
+ * board. A mapping holds its file, so users counts it too. Its DMA
+ * tuning starts from the defaults.
+ */
+
+/*
+ * Window checks of an attach. Data widths are in bytes, as
+ * VMEIO_GET_DEVICE returns them, and a second window is optional.
+ * The source register must lie in the first window when install
+ * was given isrc, see vmeio_attach.
+ */
+
+static int check_width(int dwd)
+{
+	return dwd == 1 || dwd == 2 || dwd == 4 || dwd == 8;
+}
+
+static int check_window(struct vmeio_get_window_s *win)
+{
+	if (win->lun < 0)
+		return -EINVAL;
+	if (win->nmap != 0 && win->nmap != 1)
+		return -EINVAL;
+	if (win->lvl < 0 || win->lvl > 7 || win->vec < 0 || win->vec > 0xff)
+		return -EINVAL;
+	if (win->win1 <= 0 || !check_width(win->dwd1))
+		return -EINVAL;
+	if (win->win2 < 0 || (win->win2 && !check_width(win->dwd2)))
+		return -EINVAL;
+	if (isrc_num && (win->isrc < 0 || win->isrc > win->win1 - win->dwd1))
+		return -EINVAL;
+	return 0;
+}
+
+static struct vmeio_device *vmeio_attach_slot(int lun)
+{
+	int i;
+
+	for (i = 0; i < DRV_MAX_DEVICES; i++)
+		if (devices[i].attached && devices[i].lun == lun)
+			return ERR_PTR(-EBUSY);
+	for (i = 0; i < DRV_MAX_DEVICES; i++)
+		if (devices[i].status && devices[i].lun == lun)
+			return &devices[i];
+	for (i = 0; i < DRV_MAX_DEVICES; i++)
+		if (!devices[i].status)
+			return &devices[i];
+	for (i = 0; i < DRV_MAX_DEVICES; i++)
+		if (!devices[i].attached && !atomic_read(&devices[i].users))
+			return &devices[i];
+	return ERR_PTR(-ENOSPC);
+}
+
+static int vmeio_attach(struct vmeio_get_window_s *win)
+{
+	struct vmeio_device *dev;
+	unsigned long flags;
+	int cc;
+
+	if ((cc = check_window(win)) < 0)
+		return cc;
+	dev = vmeio_attach_slot(win->lun);
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+
+	dev->lun  = win->lun;
+	dev->lvl  = win->lvl;
+	dev->vec  = win->vec;
+	dev->nmap = win->nmap;
+	dev->isrc = win->isrc;
+	vmeio_map_init(&dev->maps[0], win->vme1, win->win1, win->amd1,
+		       win->dwd1);
+	vmeio_map_init(&dev->maps[1], win->vme2, win->win2, win->amd2,
+		       win->dwd2);
+
+	memset(&dev->dma, 0, sizeof(dev->dma));
+	dev->dma.bsize = DMA_BLOCK_SIZE;
+	dev->dma.am = VME_A24_USER_BLT;
+	dev->debug = DEBUG;
+	dev->timeout = TIMEOUT * USEC_PER_MSEC;
+
+	/* As at install, isrc 0 is the first register, not none */
+
+	vmeio_status_alloc(dev);
+	vmeio_start(dev, isrc_num);
+
+	/* icnt carries on, waiters from a previous attach compare it */
+
+	spin_lock_irqsave(&dev->lock, flags);
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	dev->bus_errors = 0;
+	dev->timeouts = 0;
+	dev->consumed = 0;
+	dev->lost = 0;
+	dev->last_read_icnt = dev->icnt;
+	dev->attached = 1;
+	vmeio_publish(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	printk("%s:Logical unit:%d attached at minor %d\n", vmeio_major_name,
+	       dev->lun, (int)(dev - devices));
+	return dev - devices;
+}
+
+static int vmeio_detach(int *lun)
+{
+	struct vmeio_device *dev = NULL;
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < DRV_MAX_DEVICES; i++)
+		if (devices[i].attached && devices[i].lun == *lun)
+			dev = &devices[i];
+	if (!dev)
+		return -ENODEV;
+
+	/* Waiters and pollers see the flag and return -ENODEV */
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->attached = 0;
+	spin_unlock_irqrestore(&dev->lock, flags);
+	wake_up(&dev->queue);
+	wake_up_interruptible(&dev->stream_queue);
+
+	vmeio_stop(dev);
+	printk("%s:Logical unit:%d detached\n", vmeio_major_name, *lun);
+	return 0;
+}
+
+static int vmeio_add_eventfd(struct vmeio_device *dev, struct file *filp,
+			     int *fd)
+{
+	struct file *efd;
+	unsigned long flags;
+	int i;
+
+	efd = eventfd_fget(*fd);
+	if (IS_ERR(efd))
+		return PTR_ERR(efd);
+
+	spin_lock_irqsave(&dev->lock, flags);
+	for (i = 0; i < MAX_EVENTFDS; i++) {
+		if (dev->eventfds[i].efd == efd) {
+			spin_unlock_irqrestore(&dev->lock, flags);
+			fput(efd);
+			return -EBUSY;
+		}
+	}
+	for (i = 0; i < MAX_EVENTFDS; i++) {
+		if (dev->eventfds[i].efd == NULL) {
+			dev->eventfds[i].efd = efd;
+			dev->eventfds[i].owner = filp;
+			spin_unlock_irqrestore(&dev->lock, flags);
+			return 0;
+		}
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+	fput(efd);
+	return -ENOSPC;
+}
+
+static int vmeio_del_eventfd(struct vmeio_device *dev, int *fd)
+{
+	struct file *efd, *found = NULL;
+	unsigned long flags;
+	int i;
+
+	efd = eventfd_fget(*fd);
+	if (IS_ERR(efd))
+		return PTR_ERR(efd);
+
+	spin_lock_irqsave(&dev->lock, flags);
+	for (i = 0; i < MAX_EVENTFDS; i++) {
+		if (dev->eventfds[i].efd == efd) {
+			found = efd;
+			dev->eventfds[i].efd = NULL;
+			dev->eventfds[i].owner = NULL;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	fput(efd);
+	if (!found)
+		return -ENOENT;
+	fput(found);
+	return 0;
+}
+
+/*
+ * DMA parameter checks, the block size must be a power of two
+ * supported by the bridge and chunks a multiple of the block size
+ */
+
+static int check_dma(struct vmeio_dma *dma)
+{
+	if (dma->bsize < DMA_MIN_BLOCK_SIZE || dma->bsize > DMA_BLOCK_SIZE ||
+	    !is_power_of_2(dma->bsize))
+		return -EINVAL;
+	if (dma->backoff < VME_DMA_BACKOFF_0 ||
+	    dma->backoff > VME_DMA_BACKOFF_64)
+		return -EINVAL;
+	if (dma->am <= 0 || dma->am > 0x3F)
+		return -EINVAL;
+	if (dma->dwd != 0 && dma->dwd != 16 && dma->dwd != 32 &&
+	    dma->dwd != 64)
+		return -EINVAL;
+	if (dma->chunk < 0 || dma->chunk % dma->bsize)
+		return -EINVAL;
+	return 0;
+}
+
+static void vmeio_get_dma(struct vmeio_device *dev,
+			  struct vmeio_dma_params_s *params)
+{
+	params->bsize   = dev->dma.bsize;
+	params->backoff = dev->dma.backoff;
+	params->am      = dev->dma.am;
+	params->dwd     = dev->dma.dwd;
+	params->chunk   = dev->dma.chunk;
+}
+
+static int vmeio_set_dma(struct vmeio_device *dev,
+			 struct vmeio_dma_params_s *params)
+{
+	struct vmeio_dma dma;
+	int cc;
+
+	dma.bsize   = params->bsize;
+	dma.backoff = params->backoff;
+	dma.am      = params->am;
+	dma.dwd     = params->dwd;
+	dma.chunk   = params->chunk;
+	if ((cc = check_dma(&dma)) < 0)
+		return cc;
+
+	/* The streaming work may be using the old values */
+
+	mutex_lock(&dev->stream_mutex);
+	dev->dma = dma;
+	mutex_unlock(&dev->stream_mutex);
+	return 0;
+}
+
+/*
+ * One DMA transfer between window winum (1..2) and a buffer,
+ * which is a user space address unless kernel is set
+ */
+
+static int do_dma_xfer(struct vmeio_device *dev, struct vmeio_dma *dma,
+		       int winum, int offset, unsigned long buf, int bsize,
+		       enum vme_dma_dir direction, int kernel)
 {
 	struct vme_dma dma_desc;
-	struct vmeio_map *map = &dev->maps[riob->winum];
-	unsigned int buf = (unsigned int)riob->buffer;
+	struct vmeio_map *map;
 	unsigned int bu, bl;
-	int cc, winum;
+	int cc, dwd, bcode;
 	unsigned int haddr;
 
 #ifdef __64BIT
@@ -1020,24 +2145,30 @@ static int raw_dma(struct vmeio_device *dev,
 
 	dma_desc.dir = direction;
 	dma_desc.novmeinc = 0;
-	dma_desc.length = riob->bsize;
-
-	dma_desc.ctrl.pci_block_size = VME_DMA_BSIZE_4096;
-	dma_desc.ctrl.pci_backoff_time = VME_DMA_BACKOFF_0;
-	dma_desc.ctrl.vme_block_size = VME_DMA_BSIZE_4096;
-	dma_desc.ctrl.vme_backoff_time = VME_DMA_BACKOFF_0;
+	dma_desc.length = bsize;
 
-	winum = riob->winum -1;
-	if (winum < 0) winum = 0;
+	bcode = ilog2(dma->bsize / DMA_MIN_BLOCK_SIZE);	/* VME_DMA_BSIZE_x */
+	dma_desc.ctrl.pci_block_size = bcode;
+	dma_desc.ctrl.pci_backoff_time = dma->backoff;
+	dma_desc.ctrl.vme_block_size = bcode;
+	dma_desc.ctrl.vme_backoff_time = dma->backoff;
 
-	map = &dev->maps[winum];
+	map = &dev->maps[winum - 1];
+	dwd = dma->dwd ? dma->dwd : map->data_width * 8;
 
-	dma_desc.dst.data_width = map->data_width * 8;
-	dma_desc.dst.am = map->address_modifier;
-	dma_desc.src.data_width = map->data_width * 8;
-	dma_desc.src.am = VME_A24_USER_BLT;
+	if (direction == VME_DMA_TO_DEVICE) {
+		dma_desc.dst.data_width = dwd;
+		dma_desc.dst.am = dma->am;
+		dma_desc.src.data_width = dwd;
+		dma_desc.src.am = map->address_modifier;
+	} else {
+		dma_desc.dst.data_width = dwd;
+		dma_desc.dst.am = map->address_modifier;
+		dma_desc.src.data_width = dwd;
+		dma_desc.src.am = dma->am;
+	}
 
-	haddr = (unsigned int) map->base_address + riob->offset;
+	haddr = (unsigned int) map->base_address + offset;
 
 	if (direction == VME_DMA_TO_DEVICE) {
 		dma_desc.src.addrl = bl;
@@ -1051,13 +2182,16 @@ static int raw_dma(struct vmeio_device *dev,
 
 	if (dev->debug > 1) {
 		char *msg = (direction == VME_DMA_FROM_DEVICE) ?
-			"DMA:READ:win:%d src:0x%p amd:0x%x dwd:%d len:%d dst:0x%08x%08x\n" :
-			"DMA:WRIT:win:%d dst:0x%p amd:0x%x dwd:%d len:%d src:0x%08x%08x\n";
-		printk(msg, riob->winum, haddr, map->address_modifier,
-		     map->data_width, riob->bsize, bu, bl);
+			"DMA:READ:win:%d src:0x%x amd:0x%x dwd:%d len:%d dst:0x%08x%08x\n" :
+			"DMA:WRIT:win:%d dst:0x%x amd:0x%x dwd:%d len:%d src:0x%08x%08x\n";
+		printk(msg, winum, haddr, dma->am, dwd, bsize, bu, bl);
 	}
 
-	if ((cc = vme_do_dma(&dma_desc)) < 0)
+	if (kernel)
+		cc = vme_do_dma_kernel(&dma_desc);
+	else
+		cc = vme_do_dma(&dma_desc);
+	if (cc < 0)
 		return cc;
 
 	if (!(dma_desc.status & TSI148_LCSR_DSTA_DON)) {
@@ -1069,6 +2203,52 @@ static int raw_dma(struct vmeio_device *dev,
 	return 0;
 }
 
+/*
+ * DMA, split in transfers of at most dma.chunk bytes
+ */
+
+static int do_dma(struct vmeio_device *dev, int winum, int offset,
+		  void *buffer, int bsize, enum vme_dma_dir direction,
+		  int kernel)
+{
+	struct vmeio_dma *dma = &dev->dma;
+	unsigned long buf = (unsigned long)buffer;
+	int done, len, cc = 0;
+	unsigned long flags;
+	ktime_t start;
+
+	if (winum < 1 || winum > MAX_MAPS)
+		return -EINVAL;
+
+	trace_mark(cvora_dma_start, "lun %d win %d offset 0x%x bytes %d dir %d",
+		   dev->lun, winum, offset, bsize, direction);
+	start = ktime_get();
+
+	for (done = 0; done < bsize; done += len) {
+		len = dma->chunk ? min(bsize - done, dma->chunk) : bsize;
+		cc = do_dma_xfer(dev, dma, winum, offset + done, buf + done,
+				 len, direction, kernel);
+		if (cc < 0)
+			break;
+	}
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->stats.dma_count++;
+	dev->stats.dma_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (cc == 0)
+		dev->stats.dma_bytes += bsize;
+	spin_unlock_irqrestore(&dev->lock, flags);
+	trace_mark(cvora_dma_end, "lun %d bytes %d cc %d", dev->lun, bsize, cc);
+	return cc;
+}
+
+static int raw_dma(struct vmeio_device *dev,
+	struct vmeio_riob_s *riob, enum vme_dma_dir direction)
+{
+	return do_dma(dev, riob->winum, riob->offset, riob->buffer,
+		      riob->bsize, direction, 0);
+}
+
 union vmeio_word {
 	int	width4;
 	short	width2;
@@ -1078,12 +2258,16 @@ union vmeio_word {
 
 static int raw_read(struct vmeio_device *dev, struct vmeio_riob_s *riob)
 {
-	struct vmeio_map *mapx = &dev->maps[riob->winum-1];	
-	int dwidth = mapx->data_width;
+	struct vmeio_map *mapx;
+	int dwidth;
 	int i, j, cc;
 	char *map, *iob;
 	int cnt;
 
+	if (riob->winum < 1 || riob->winum > MAX_MAPS)
+		return -EINVAL;
+	mapx = &dev->maps[riob->winum - 1];
+	dwidth = mapx->data_width;
 	if (dev->nmap)
 		return -ENODEV;
 	if (riob->bsize > vmeioMAX_BUF)
@@ -1091,7 +2275,7 @@ static int raw_read(struct vmeio_device *dev, struct vmeio_riob_s *riob)
 	iob = kmalloc(riob->bsize, GFP_KERNEL);
 	if (!iob)
 		return -ENOMEM;
-	if ((map = mapx->vaddr) == NULL) {
+	if ((map = vmeio_map_window(dev, riob->winum - 1)) == NULL) {
 		kfree(iob);
 		return -ENODEV;
 	}
@@ -1113,6 +2297,7 @@ static int raw_read(struct vmeio_device *dev, struct vmeio_riob_s *riob)
 		else
 			dst->width1 = HRd8( &map[j]);
 		if (GetClrBusErrCnt()) {
+			vmeio_count_bus_error(dev);
 			kfree(iob);
 			return -EIO;
 		}
@@ -1126,12 +2311,16 @@ static int raw_read(struct vmeio_device *dev, struct vmeio_riob_s *riob)
 
 static int raw_write(struct vmeio_device *dev, struct vmeio_riob_s *riob)
 {
-	struct vmeio_map *mapx = &dev->maps[riob->winum-1];	
-	int dwidth = mapx->data_width;
+	struct vmeio_map *mapx;
+	int dwidth;
 	int i, j, cc;
 	char *map, *iob;
 	int cnt;
 
+	if (riob->winum < 1 || riob->winum > MAX_MAPS)
+		return -EINVAL;
+	mapx = &dev->maps[riob->winum - 1];
+	dwidth = mapx->data_width;
 	if (dev->nmap)
 		return -ENODEV;
 	if (riob->bsize > vmeioMAX_BUF)
@@ -1139,7 +2328,7 @@ static int raw_write(struct vmeio_device *dev, struct vmeio_riob_s *riob)
 	iob = kmalloc(riob->bsize, GFP_KERNEL);
 	if (!iob)
 		return -ENOMEM;
-	if ((map = mapx->vaddr) == NULL) {
+	if ((map = vmeio_map_window(dev, riob->winum - 1)) == NULL) {
 		kfree(iob);
 		return -ENODEV;
 	}
@@ -1167,6 +2356,7 @@ static int raw_write(struct vmeio_device *dev, struct vmeio_riob_s *riob)
 		else
 			HWr8( src->width1, &map[j]);
 		if (GetClrBusErrCnt()) {
+			vmeio_count_bus_error(dev);
 			kfree(iob);
 			return -EIO;
 		}
@@ -1175,6 +2365,240 @@ static int raw_write(struct vmeio_device *dev, struct vmeio_riob_s *riob)
 	return 0;
 }
 
+/*
+ * =====================================================
+ * Live streaming of the sample memory
+ *
+ * While streaming, an hrtimer polls the memory pointer
+ * every stream.period us through stream_work, and the
+ * region written since the last watermark (stream_wm)
+ * is DMAed into a ring buffer. Readers get the bytes
+ * with VMEIO_STREAM_READ, and poll reports readable
+ * once stream.threshold bytes are available.
+ *
+ * stream_head/stream_tail count bytes put into and taken
+ * from the ring, whose size is a power of two. When the
+ * memory pointer goes back (rearm) a boundary is set at
+ * stream_head, so that a read never mixes two
+ * acquisitions and stream_tail_offset, the sample memory
+ * offset of the byte at stream_tail, starts again at 0.
+ * =====================================================
+ */
+
+#define STREAM_BOUNCE_SIZE	0x10000
+
+static void stream_put(struct vmeio_device *dev, char *src, int len)
+{
+	unsigned int size = dev->stream.size;
+	unsigned int pos = dev->stream_head & (size - 1);
+	unsigned int n = min_t(unsigned int, len, size - pos);
+
+	memcpy(&dev->stream_ring[pos], src, n);
+	memcpy(dev->stream_ring, &src[n], len - n);
+	dev->stream_head += len;
+}
+
+static void vmeio_stream_work(struct work_struct *work)
+{
+	struct vmeio_device *dev =
+		container_of(work, struct vmeio_device, stream_work);
+	unsigned int memp;
+	char *regs;
+	int len;
+
+	mutex_lock(&dev->stream_mutex);
+	regs = dev->maps[0].vaddr;
+	if (!dev->streaming || !regs)
+		goto out;
+
+	memp = HRd32(&regs[CVORA_MEMORY_POINTER]);
+	if (memp < CVORA_MEMORY || memp > CVORA_MEM_MAX)
+		goto out;
+
+	if (memp < dev->stream_wm) {
+		/* Rearmed, a new acquisition starts */
+		if (dev->stream_head == dev->stream_tail) {
+			dev->stream_tail_offset = 0;
+		} else if (dev->stream_boundary_pending) {
+			dev->stream_overruns++;
+			dev->stream_tail = dev->stream_head;
+			dev->stream_tail_offset = 0;
+			dev->stream_boundary_pending = 0;
+		} else {
+			dev->stream_boundary = dev->stream_head;
+			dev->stream_boundary_pending = 1;
+		}
+		dev->stream_wm = CVORA_MEMORY;
+	}
+
+	while (dev->stream_wm < memp) {
+		len = min_t(int, memp - dev->stream_wm, STREAM_BOUNCE_SIZE);
+		if (len > dev->stream.size -
+			  (dev->stream_head - dev->stream_tail)) {
+			/* Reader too slow, restart from here */
+			dev->stream_overruns++;
+			dev->stream_tail = dev->stream_head;
+			dev->stream_tail_offset = memp - CVORA_MEMORY;
+			dev->stream_boundary_pending = 0;
+			dev->stream_wm = memp;
+			break;
+		}
+		if (do_dma(dev, 1, dev->stream_wm, dev->stream_bounce, len,
+			   VME_DMA_FROM_DEVICE, 1) < 0)
+			break;
+		stream_put(dev, dev->stream_bounce, len);
+		dev->stream_wm += len;
+	}
+	wake_up_interruptible(&dev->stream_queue);
+out:
+	mutex_unlock(&dev->stream_mutex);
+}
+
+static enum hrtimer_restart vmeio_stream_tick(struct hrtimer *timer)
+{
+	struct vmeio_device *dev =
+		container_of(timer, struct vmeio_device, stream_timer);
+
+	schedule_work(&dev->stream_work);
+	hrtimer_forward(timer, hrtimer_cb_get_time(timer),
+			us_to_ktime(dev->stream.period));
+	return HRTIMER_RESTART;
+}
+
+static void vmeio_stream_stop(struct vmeio_device *dev)
+{
+	mutex_lock(&dev->stream_mutex);
+	dev->streaming = 0;
+	mutex_unlock(&dev->stream_mutex);
+
+	hrtimer_cancel(&dev->stream_timer);
+	cancel_work_sync(&dev->stream_work);
+
+	vfree(dev->stream_ring);
+	kfree(dev->stream_bounce);
+	dev->stream_ring = NULL;
+	dev->stream_bounce = NULL;
+	wake_up_interruptible(&dev->stream_queue);
+}
+
+static int vmeio_set_stream(struct vmeio_device *dev,
+			    struct vmeio_stream_s *stream)
+{
+	vmeio_stream_stop(dev);
+
+	if (stream->period == 0)
+		return 0;
+	if (stream->period < 0 || stream->size <= 0 || stream->threshold < 0)
+		return -EINVAL;
+	if (dev->nmap || !vmeio_map_window(dev, 0))
+		return -ENODEV;
+
+	stream->size = roundup_pow_of_two(stream->size);
+	if (stream->size < STREAM_BOUNCE_SIZE)
+		stream->size = STREAM_BOUNCE_SIZE;
+	if (stream->threshold < sizeof(int))
+		stream->threshold = sizeof(int);
+
+	dev->stream_ring = vmalloc(stream->size);
+	dev->stream_bounce = kmalloc(STREAM_BOUNCE_SIZE, GFP_KERNEL);
+	if (!dev->stream_ring || !dev->stream_bounce) {
+		vfree(dev->stream_ring);
+		kfree(dev->stream_bounce);
+		dev->stream_ring = NULL;
+		dev->stream_bounce = NULL;
+		return -ENOMEM;
+	}
+
+	mutex_lock(&dev->stream_mutex);
+	dev->stream = *stream;
+	dev->stream_head = 0;
+	dev->stream_tail = 0;
+	dev->stream_tail_offset = 0;
+	dev->stream_boundary_pending = 0;
+	dev->stream_wm = CVORA_MEMORY;
+	dev->stream_overruns = 0;
+	dev->streaming = 1;
+	mutex_unlock(&dev->stream_mutex);
+
+	hrtimer_start(&dev->stream_timer, us_to_ktime(stream->period),
+		      HRTIMER_MODE_REL);
+	return 0;
+}
+
+static int vmeio_stream_read(struct vmeio_device *dev,
+			     struct vmeio_stream_read_s *sr)
+{
+	unsigned int size, pos, avail, n, m;
+	int cc = 0;
+
+	mutex_lock(&dev->stream_mutex);
+	if (!dev->streaming) {
+		cc = -ENODEV;
+		goto out;
+	}
+
+	if (dev->stream_boundary_pending &&
+	    dev->stream_tail == dev->stream_boundary) {
+		dev->stream_tail_offset = 0;
+		dev->stream_boundary_pending = 0;
+	}
+	if (dev->stream_boundary_pending)
+		avail = dev->stream_boundary - dev->stream_tail;
+	else
+		avail = dev->stream_head - dev->stream_tail;
+
+	n = (sr->bsize < 0) ? 0 : sr->bsize;
+	n = min(n, avail) & ~(sizeof(int) - 1);
+
+	size = dev->stream.size;
+	pos = dev->stream_tail & (size - 1);
+	m = min(n, size - pos);
+	if (copy_to_user(sr->buffer, &dev->stream_ring[pos], m) ||
+	    copy_to_user((char *)sr->buffer + m, dev->stream_ring, n - m)) {
+		cc = -EACCES;
+		goto out;
+	}
+
+	sr->offset = dev->stream_tail_offset;
+	sr->bsize = n;
+	sr->overruns = dev->stream_overruns;
+	dev->stream_tail += n;
+	dev->stream_tail_offset += n;
+out:
+	mutex_unlock(&dev->stream_mutex);
+	return cc;
+}
+
+/*
+ * =====================================================
+ * Poll
+ * Readable when enough streamed bytes are available
+ * =====================================================
+ */
+
+unsigned int vmeio_poll(struct file *filp, poll_table *wait)
+{
+	struct vmeio_device *dev;
+	unsigned int mask = 0;
+	long minor;
+
+	minor = MINOR(filp->f_dentry->d_inode->i_rdev);
+	if (!check_minor(minor))
+		return POLLERR;
+	dev = &devices[minor];
+
+	poll_wait(filp, &dev->stream_queue, wait);
+	if (!dev->attached)
+		return POLLERR | POLLHUP;
+
+	mutex_lock(&dev->stream_mutex);
+	if (dev->streaming &&
+	    dev->stream_head - dev->stream_tail >= dev->stream.threshold)
+		mask |= POLLIN | POLLRDNORM;
+	mutex_unlock(&dev->stream_mutex);
+	return mask;
+}
+
 /*
  * =====================================================
  */
@@ -1208,9 +2632,27 @@ int vmeio_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 		goto out;
 	}
 	debug_ioctl(_IOC_NR(cmd), iodr, iosz, arb, minor, dev->debug);
+	trace_mark(cvora_ioctl_entry, "lun %d ioctl %s",
+		   dev->lun, ioctl_name(_IOC_NR(cmd)));
+	count_ioctl(dev, _IOC_NR(cmd));
 
-	if (!dev) {
-		cc = -EACCES;
+	/* Attach and detach may be issued on any open lun */
+
+	if ((cmd == VMEIO_ATTACH || cmd == VMEIO_DETACH) &&
+	    !capable(CAP_SYS_ADMIN)) {
+		cc = -EPERM;
+		goto out;
+	}
+	if (cmd == VMEIO_ATTACH) {
+		cc = vmeio_attach(arb);
+		goto out;
+	}
+	if (cmd == VMEIO_DETACH) {
+		cc = vmeio_detach(arb);
+		goto out;
+	}
+	if (!dev->attached) {
+		cc = -ENODEV;
 		goto out;
 	}
 
@@ -1229,13 +2671,25 @@ int vmeio_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 		break;
 
 	case VMEIO_SET_TIMEOUT:
-		vmeio_set_timeout(dev, arb);
+		cc = vmeio_set_timeout(dev, arb);
+		if (cc < 0)
+			goto out;
 		break;
 
 	case VMEIO_GET_TIMEOUT:
 		vmeio_get_timeout(dev, arb);
 		break;
 
+	case VMEIO_SET_TIMEOUT_US:
+		cc = vmeio_set_timeout_us(dev, arb);
+		if (cc < 0)
+			goto out;
+		break;
+
+	case VMEIO_GET_TIMEOUT_US:
+		vmeio_get_timeout_us(dev, arb);
+		break;
+
 	case VMEIO_GET_DEVICE:	   /** Get the device described in struct vmeio_get_device_s */
 		vmeio_get_device(dev, arb);
 		break;
@@ -1249,7 +2703,11 @@ int vmeio_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 
 	case VMEIO_RAW_READ_DMA:   /** Raw read VME registers */
 
-		cc = raw_dma(dev, arb, VME_DMA_FROM_DEVICE);
+		if (dev->sim_image &&
+		    ((struct vmeio_riob_s *)arb)->winum <= 1)
+			cc = sim_dma(dev, arb);
+		else
+			cc = raw_dma(dev, arb, VME_DMA_FROM_DEVICE);
 		if (cc < 0)
 			goto out;
 		break;
@@ -1263,15 +2721,84 @@ int vmeio_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 
 	case VMEIO_RAW_READ:	   /** Raw read VME registers */
 
+		trace_mark(cvora_pio_start, "lun %d read bytes %d",
+			   dev->lun, ((struct vmeio_riob_s *)arb)->bsize);
 		cc = raw_read(dev, arb);
+		trace_mark(cvora_pio_end, "lun %d read cc %d", dev->lun, cc);
 		if (cc < 0)
 			goto out;
+		count_pio(dev, ((struct vmeio_riob_s *)arb)->bsize);
 		break;
 
 	case VMEIO_RAW_WRITE:	   /** Raw write VME registers */
+		trace_mark(cvora_pio_start, "lun %d write bytes %d",
+			   dev->lun, ((struct vmeio_riob_s *)arb)->bsize);
 		cc = raw_write(dev, arb);
+		trace_mark(cvora_pio_end, "lun %d write cc %d", dev->lun, cc);
 		if (cc < 0) 
 			goto out;
+		count_pio(dev, ((struct vmeio_riob_s *)arb)->bsize);
+		break;
+
+	case VMEIO_SET_SIM:	   /** Start/stop synthetic interrupts */
+		cc = vmeio_set_sim(dev, arb);
+		if (cc < 0)
+			goto out;
+		break;
+
+	case VMEIO_GET_SIM_STATS:
+		vmeio_get_sim_stats(dev, arb);
+		break;
+
+	case VMEIO_SET_SIM_IMAGE:  /** Sample memory seen while simulating */
+		cc = vmeio_set_sim_image(dev, arb);
+		if (cc < 0)
+			goto out;
+		break;
+
+	case VMEIO_SET_STREAM:	   /** Start/stop live streaming */
+		cc = vmeio_set_stream(dev, arb);
+		if (cc < 0)
+			goto out;
+		break;
+
+	case VMEIO_STREAM_READ:	   /** Get streamed samples */
+		cc = vmeio_stream_read(dev, arb);
+		if (cc < 0)
+			goto out;
+		break;
+
+	case VMEIO_GET_POOL:	   /** Get DMA buffer pool size */
+		((struct vmeio_pool_s *)arb)->count = dev->pool_count;
+		((struct vmeio_pool_s *)arb)->size = VMEIO_POOL_SIZE;
+		break;
+
+	case VMEIO_POOL_DMA:	   /** DMA into a pool buffer */
+		cc = vmeio_pool_dma(dev, arb);
+		if (cc < 0)
+			goto out;
+		break;
+
+	case VMEIO_SET_DMA:	   /** Set DMA tuning */
+		cc = vmeio_set_dma(dev, arb);
+		if (cc < 0)
+			goto out;
+		break;
+
+	case VMEIO_GET_DMA:
+		vmeio_get_dma(dev, arb);
+		break;
+
+	case VMEIO_ADD_EVENTFD:	   /** Signal an eventfd on interrupt */
+		cc = vmeio_add_eventfd(dev, filp, arb);
+		if (cc < 0)
+			goto out;
+		break;
+
+	case VMEIO_DEL_EVENTFD:	   /** Stop signalling an eventfd */
+		cc = vmeio_del_eventfd(dev, arb);
+		if (cc < 0)
+			goto out;
 		break;
 
 	default:
@@ -1285,6 +2812,53 @@ int vmeio_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,
 			goto out;
 	}
 out:	kfree(arb);
+	trace_mark(cvora_ioctl_exit, "lun %d ioctl %s cc %d",
+		   dev->lun, ioctl_name(_IOC_NR(cmd)), cc);
+	return cc;
+}
+
+/*
+ * =====================================================
+ * Wait ioctl
+ * Blocks, so it must not hold the driver mutex
+ * =====================================================
+ */
+
+static int vmeio_wait_ioctl(struct inode *inode, unsigned long arg)
+{
+	struct vmeio_device *dev;
+	struct vmeio_wait_s wbuf;
+	long minor;
+	int cc;
+
+	minor = MINOR(inode->i_rdev);
+	if (!check_minor(minor))
+		return -EACCES;
+	dev = &devices[minor];
+	if (!dev->attached)
+		return -ENODEV;
+
+	if (copy_from_user(&wbuf, (void *)arg, sizeof(wbuf)))
+		return -EACCES;
+	debug_ioctl(vmeioWAIT, _IOC_READ | _IOC_WRITE, sizeof(wbuf), &wbuf,
+		    minor, dev->debug);
+	count_ioctl(dev, vmeioWAIT);
+	trace_mark(cvora_ioctl_entry, "lun %d ioctl %s",
+		   dev->lun, ioctl_name(vmeioWAIT));
+
+	if (wbuf.next)
+		wbuf.interrupt_count = dev->icnt;
+	if (wbuf.timeout < 0)
+		wbuf.timeout = dev->timeout;
+
+	if ((cc = vmeio_wait(dev, wbuf.interrupt_count, wbuf.timeout)) < 0)
+		goto out;
+	vmeio_get_event(dev, &wbuf.event);
+
+	if (copy_to_user((void *)arg, &wbuf, sizeof(wbuf)))
+		cc = -EACCES;
+out:	trace_mark(cvora_ioctl_exit, "lun %d ioctl %s cc %d",
+		   dev->lun, ioctl_name(vmeioWAIT), cc);
 	return cc;
 }
 
@@ -1292,11 +2866,97 @@ out:	kfree(arb);
 
 static DEFINE_MUTEX(driver_mutex);
 
+/*
+ * =====================================================
+ * Per lun statistics in <debugfs>/cvora/stats
+ * =====================================================
+ */
+
+static struct dentry *debugfs_dir;
+static struct dentry *debugfs_stats;
+
+static int vmeio_stats_show(struct seq_file *m, void *v)
+{
+	struct vmeio_device *dev;
+	struct vmeio_stats st;
+	int timeouts, bus_errors, icnt;
+	unsigned long flags;
+	u64 dma_us;
+	int i, j;
+
+	mutex_lock(&driver_mutex);
+	for (i = 0; i < DRV_MAX_DEVICES; i++) {
+		dev = &devices[i];
+		if (!dev->attached)
+			continue;
+
+		spin_lock_irqsave(&dev->lock, flags);
+		st = dev->stats;
+		timeouts = dev->timeouts;
+		bus_errors = dev->bus_errors;
+		icnt = dev->icnt;
+		spin_unlock_irqrestore(&dev->lock, flags);
+
+		dma_us = st.dma_ns;
+		do_div(dma_us, NSEC_PER_USEC);
+
+		seq_printf(m, "lun %d\n", dev->lun);
+		seq_printf(m, "  interrupts %d wakeups %lu timeouts %d "
+			   "bus_errors %d\n", icnt, st.wakeups, timeouts,
+			   bus_errors);
+		seq_printf(m, "  pio %lu bytes %llu\n", st.pio_count,
+			   (unsigned long long)st.pio_bytes);
+		seq_printf(m, "  dma %lu bytes %llu us %llu\n", st.dma_count,
+			   (unsigned long long)st.dma_bytes,
+			   (unsigned long long)dma_us);
+		for (j = 0; j < vmeioLAST - vmeioFIRST; j++)
+			if (st.ioctls[j])
+				seq_printf(m, "  ioctl %s %lu\n",
+					   ioctl_names[j], st.ioctls[j]);
+	}
+	mutex_unlock(&driver_mutex);
+	return 0;
+}
+
+static int vmeio_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vmeio_stats_show, NULL);
+}
+
+static const struct file_operations vmeio_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = vmeio_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void vmeio_debugfs_init(void)
+{
+	debugfs_dir = debugfs_create_dir(vmeio_major_name, NULL);
+	if (IS_ERR(debugfs_dir) || !debugfs_dir) {
+		debugfs_dir = NULL;	/* No debugfs, no statistics */
+		return;
+	}
+	debugfs_stats = debugfs_create_file("stats", 0444, debugfs_dir,
+					    NULL, &vmeio_stats_fops);
+}
+
+static void vmeio_debugfs_exit(void)
+{
+	if (debugfs_stats)
+		debugfs_remove(debugfs_stats);
+	if (debugfs_dir)
+		debugfs_remove(debugfs_dir);
+}
+
 /* ===================================================== */
 
 long vmeio_ioctl64(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int res;
+	if (cmd == VMEIO_WAIT)
+		return vmeio_wait_ioctl(filp->f_dentry->d_inode, arg);
 	mutex_lock(&driver_mutex);
 	res = vmeio_ioctl(filp->f_dentry->d_inode, filp, cmd, arg);
 	mutex_unlock(&driver_mutex);
@@ -1309,6 +2969,8 @@ int vmeio_ioctl32(struct inode *inode, struct file *filp, unsigned int cmd,
 		  unsigned long arg)
 {
 	int res;
+	if (cmd == VMEIO_WAIT)
+		return vmeio_wait_ioctl(inode, arg);
 	mutex_lock(&driver_mutex);
 	res = vmeio_ioctl(inode, filp, cmd, arg);
 	mutex_unlock(&driver_mutex);
@@ -1316,8 +2978,11 @@ int vmeio_ioctl32(struct inode *inode, struct file *filp, unsigned int cmd,
 }
 
 struct file_operations vmeio_fops = {
+	.owner = THIS_MODULE,
 	.read = vmeio_read,
 	.write = vmeio_write,
+	.mmap = vmeio_mmap,
+	.poll = vmeio_poll,
 	.ioctl = vmeio_ioctl32,
 	.compat_ioctl = vmeio_ioctl64,
 	.open = vmeio_open,
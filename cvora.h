@@ -42,6 +42,175 @@ struct vmeio_read_buf_s {
    int interrupt_count; /** Current interrupt counter value */
 };
 
+/**
+ * Extended read buffer
+ * If the read count is large enough the driver returns this one,
+ * with the board registers as they were captured by the ISR. The
+ * first fields are those of struct vmeio_read_buf_s.
+ */
+
+struct vmeio_read_buf_ext_s {
+   int logical_unit;    /** Logical unit number for interrupt */
+   int interrupt_mask;  /** Interrupt enable/source mask */
+   int interrupt_count; /** Current interrupt counter value */
+
+   unsigned int control;        /** Control register at interrupt time */
+   unsigned int memory_pointer; /** Memory pointer at interrupt time */
+   unsigned int mode;           /** Mode register at interrupt time */
+   unsigned int frequency;      /** Clock frequency at interrupt time */
+};
+
+/**
+ * All four registers of an event or of the status page hold this
+ * when a bus error hit any of the reads of the ISR
+ */
+
+#define VMEIO_REG_INVALID 0xFFFFFFFF
+
+/**
+ * Parameter for the wait ioctl
+ * Unlike read, which waits for the next interrupt after the call,
+ * this returns as soon as the interrupt counter differs from the
+ * given value, so no interrupt is lost between two calls.
+ * If next is set it behaves like read and interrupt_count is ignored.
+ */
+
+struct vmeio_wait_s {
+   int interrupt_count;                 /** Wait while counter equals this */
+   int next;                            /** Wait for the next interrupt */
+   int timeout;                         /** Microseconds, 0=none, <0=lun default */
+   struct vmeio_read_buf_ext_s event;   /** Returned event */
+};
+
+/**
+ * Read only status page, mmap one page at offset zero.
+ * The driver bumps seq before and after each update, so seq is odd
+ * while an update is in progress. Readers retry until they see the
+ * same even seq before and after copying the fields.
+ */
+
+struct vmeio_status_page_s {
+   unsigned int seq;            /** Update sequence number */
+
+   int logical_unit;            /** Logical unit number */
+   int interrupt_count;         /** Current interrupt counter value */
+   int interrupt_mask;          /** Last interrupt source mask */
+   unsigned int isr_sec;        /** Last interrupt time seconds */
+   unsigned int isr_nsec;       /** Last interrupt time nanoseconds */
+
+   unsigned int control;        /** Control register at interrupt time */
+   unsigned int memory_pointer; /** Memory pointer at interrupt time */
+   unsigned int mode;           /** Mode register at interrupt time */
+   unsigned int frequency;      /** Clock frequency at interrupt time */
+
+   int bus_errors;              /** Bus errors seen on this lun */
+   int timeouts;                /** Waits that timed out */
+};
+
+/**
+ * Synthetic interrupt generator, for load tests without hardware.
+ * Interrupts come in bursts of burst interrupts, spacing us apart,
+ * one burst every period us. A period of zero stops the generator.
+ */
+
+struct vmeio_sim_s {
+   int period;  /** Microseconds between bursts, 0 stops */
+   int burst;   /** Interrupts per burst, 0 means 1 */
+   int spacing; /** Microseconds between interrupts in a burst */
+   int count;   /** Interrupts to deliver, 0 until stopped */
+   int mask;    /** Interrupt source mask to report */
+};
+
+/**
+ * Generator counters, reset when it is started.
+ * An interrupt is lost when another one arrives before any
+ * reader has seen it.
+ */
+
+struct vmeio_sim_stats_s {
+   int running;   /** Generator still active */
+   int delivered; /** Synthetic interrupts delivered */
+   int consumed;  /** Interrupts returned to readers */
+   int lost;      /** Interrupts no reader has seen */
+};
+
+/**
+ * Live streaming of the sample memory during an acquisition.
+ * The memory pointer is polled every period us and the newly
+ * written region is read by DMA into a ring buffer of size bytes.
+ * poll() reports the device readable once threshold bytes are
+ * available. A period of zero stops streaming.
+ */
+
+struct vmeio_stream_s {
+   int period;    /** Microseconds between memory pointer polls, 0 stops */
+   int size;      /** Ring buffer size in bytes */
+   int threshold; /** Bytes available before poll reports readable */
+};
+
+/*
+ * Parameter for stream read, bsize is updated to the bytes read.
+ * A read never spans two acquisitions, offset restarts at zero.
+ */
+
+#ifdef __64BIT
+struct vmeio_stream_read_s {
+   int offset;   /** Byte offset in sample memory of first byte */
+   int bsize;    /** Max bytes to read, then bytes read */
+   int overruns; /** Times the ring overflowed and was reset */
+   void *buffer; /** Pointer to data area */
+};
+#else
+struct vmeio_stream_read_s {
+   int offset;   /** Byte offset in sample memory of first byte */
+   int bsize;    /** Max bytes to read, then bytes read */
+   int overruns; /** Times the ring overflowed and was reset */
+   void *buffer; /** Pointer to data area */
+   int  compat;  /** Pack out size to at least 64 bits */
+};
+#endif
+
+/**
+ * Persistent DMA buffer pool. Each lun may own up to VMEIO_POOL_MAX
+ * physically contiguous kernel buffers of VMEIO_POOL_SIZE bytes,
+ * allocated at install. Buffer i is mapped by mmap at offset
+ * VMEIO_POOL_OFFSET(i), offset 0 being the status page.
+ */
+
+#define VMEIO_POOL_MAX       8
+#define VMEIO_POOL_SIZE      0x80000
+#define VMEIO_POOL_OFFSET(i) (((i) + 1) * VMEIO_POOL_SIZE)
+
+struct vmeio_pool_s {
+   int count;   /** Buffers in the pool */
+   int size;    /** Bytes per buffer */
+};
+
+/*
+ * Parameter for a DMA from window winum into pool buffer index,
+ * data is left in the byte order of the module.
+ */
+
+struct vmeio_pool_dma_s {
+   int index;   /** Pool buffer */
+   int winum;   /** Window number 1..2 */
+   int offset;  /** Byte offset in window */
+   int bsize;   /** Bytes to transfer */
+};
+
+/**
+ * DMA tuning of a lun. Transfers longer than chunk are split,
+ * chunk must be a multiple of bsize.
+ */
+
+struct vmeio_dma_params_s {
+   int bsize;   /** VME and PCI block size, 32..4096 bytes */
+   int backoff; /** VME and PCI backoff code, 0..7 */
+   int am;      /** Address modifier of DMA transfers (BLT, MBLT, 2eVME) */
+   int dwd;     /** Data width in bits, 0 is the window data width */
+   int chunk;   /** Max bytes per transfer, 0 unlimited */
+};
+
 /**
  * Parameter for get window
  */
@@ -61,7 +230,8 @@ struct vmeio_get_window_s {
    int win1;    /* First window size */
    int win2;    /* Second window size or zero */
    int nmap;    /* No map window flag, 1=DMA only */
-   int isrc;    /* Offset of isrc in vme1 to be read in the isr */
+   int isrc;    /* Offset of isrc in vme1 to be read in the isr, if the
+                   driver was installed with isrc */
 };
 
 /**
@@ -122,6 +292,30 @@ typedef enum {
 
    vmeioSET_DEVICE,    /** Very dangerous IOCTL, not for users */
 
+   vmeioWAIT,          /** Wait for interrupt counter to change */
+
+   vmeioADD_EVENTFD,   /** Signal an eventfd on each interrupt */
+   vmeioDEL_EVENTFD,   /** Detach an eventfd */
+
+   vmeioSET_TIMEOUT_US, /** Timeout in microseconds */
+   vmeioGET_TIMEOUT_US,
+
+   vmeioSET_SIM,       /** Start/stop the synthetic interrupt generator */
+   vmeioGET_SIM_STATS, /** Get generator counters */
+   vmeioSET_SIM_IMAGE, /** Sample memory image served while set */
+
+   vmeioSET_STREAM,    /** Start/stop live streaming */
+   vmeioSTREAM_READ,   /** Get streamed samples */
+
+   vmeioSET_DMA,       /** Set DMA tuning */
+   vmeioGET_DMA,       /** Get DMA tuning */
+
+   vmeioGET_POOL,      /** Get DMA buffer pool size */
+   vmeioPOOL_DMA,      /** DMA into a pool buffer */
+
+   vmeioATTACH,        /** Attach a logical unit at run time */
+   vmeioDETACH,        /** Detach a logical unit */
+
    vmeioLAST           /** For range checking (LAST - FIRST) */
 
 } vmeio_ioctl_function_t;
@@ -150,5 +344,21 @@ typedef enum {
 #define VMEIO_RAW_READ_DMA  VIOWR(vmeioRAW_READ_DMA,  struct vmeio_riob_s)
 #define VMEIO_RAW_WRITE_DMA VIOWR(vmeioRAW_WRITE_DMA, struct vmeio_riob_s)
 #define VMEIO_SET_DEVICE    VIOW(vmeioGET_DEVICE,     struct vmeio_get_window_s)
+#define VMEIO_WAIT          VIOWR(vmeioWAIT,          struct vmeio_wait_s)
+#define VMEIO_ADD_EVENTFD   VIOW(vmeioADD_EVENTFD,    int)
+#define VMEIO_DEL_EVENTFD   VIOW(vmeioDEL_EVENTFD,    int)
+#define VMEIO_SET_TIMEOUT_US VIOW(vmeioSET_TIMEOUT_US, int)
+#define VMEIO_GET_TIMEOUT_US VIOR(vmeioGET_TIMEOUT_US, int)
+#define VMEIO_SET_SIM       VIOW(vmeioSET_SIM,        struct vmeio_sim_s)
+#define VMEIO_GET_SIM_STATS VIOR(vmeioGET_SIM_STATS,  struct vmeio_sim_stats_s)
+#define VMEIO_SET_SIM_IMAGE VIOW(vmeioSET_SIM_IMAGE,  struct vmeio_riob_s)
+#define VMEIO_SET_STREAM    VIOW(vmeioSET_STREAM,     struct vmeio_stream_s)
+#define VMEIO_STREAM_READ   VIOWR(vmeioSTREAM_READ,   struct vmeio_stream_read_s)
+#define VMEIO_SET_DMA       VIOW(vmeioSET_DMA,        struct vmeio_dma_params_s)
+#define VMEIO_GET_DMA       VIOR(vmeioGET_DMA,        struct vmeio_dma_params_s)
+#define VMEIO_GET_POOL      VIOR(vmeioGET_POOL,       struct vmeio_pool_s)
+#define VMEIO_POOL_DMA      VIOW(vmeioPOOL_DMA,       struct vmeio_pool_dma_s)
+#define VMEIO_ATTACH        VIOW(vmeioATTACH,         struct vmeio_get_window_s)
+#define VMEIO_DETACH        VIOW(vmeioDETACH,         int)
 
 #endif
@@ -0,0 +1,578 @@
+/**
+ * Recording reader for cvora, see cvorarec.h for the file format
+ *
+ * Opening a recording maps its index, nothing else. The index is
+ * split per lun, each in time order, so a query is a binary search
+ * followed by a walk over the matching entries. Only the records a
+ * query reaches are mapped, one at a time, so pulling a few minutes
+ * of one board out of a long recording touches just those records.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "libcvora.h"
+#include "cvorarec.h"
+#include "cvoracodec.h"
+
+#define NSEC	1000000000LL
+
+struct lun_list {
+	int32_t		lun;
+	uint32_t	count;
+	uint32_t	*rec;		/* index entries, time order */
+};
+
+struct cvora_archive {
+	int				fd;
+	uint64_t			size;		/* file size */
+	long				pagesz;
+	const struct cvora_rec_index	*index;
+	uint64_t			count;
+	void				*map;		/* index mapping, */
+	size_t				map_len;	/* NULL if scanned */
+	struct cvora_rec_index		*scanned;
+	int				nluns;
+	struct lun_list			*luns;
+};
+
+static int64_t key(int64_t sec, int64_t nsec)
+{
+	return sec * NSEC + nsec;
+}
+
+static int64_t ix_key(const struct cvora_rec_index *ix)
+{
+	return key(ix->isr_sec, ix->isr_nsec);
+}
+
+/* ==================== */
+
+/*
+ * Map the index written at close
+ */
+
+static int map_index(struct cvora_archive *arc, struct cvora_rec_file *fh)
+{
+	uint64_t start, len;
+
+	/* index_count is the file's, so bound it before multiplying */
+
+	if (fh->index_offset < CVORA_REC_ALIGN ||
+	    fh->index_offset > arc->size ||
+	    fh->index_count > (arc->size - fh->index_offset) /
+			      sizeof(struct cvora_rec_index))
+		return -EINVAL;
+	len = fh->index_count * sizeof(struct cvora_rec_index);
+	if (len == 0)
+		return 0;
+	start = fh->index_offset & ~(uint64_t)(arc->pagesz - 1);
+	arc->map_len = fh->index_offset - start + len;
+	arc->map = mmap(NULL, arc->map_len, PROT_READ, MAP_SHARED,
+			arc->fd, start);
+	if (arc->map == MAP_FAILED) {
+		arc->map = NULL;
+		return -errno;
+	}
+	arc->index = (void *)((char *)arc->map + fh->index_offset - start);
+	arc->count = fh->index_count;
+	return 0;
+}
+
+/*
+ * Rebuild the index of a recording that was not closed by reading
+ * the record headers. A truncated last record is left out.
+ */
+
+static int scan_index(struct cvora_archive *arc)
+{
+	struct cvora_rec_header hdr;
+	struct cvora_rec_index *ix;
+	uint64_t offset = CVORA_REC_ALIGN, size = 0;
+	ssize_t n;
+
+	while (offset + sizeof(hdr) <= arc->size) {
+		if ((n = pread(arc->fd, &hdr, sizeof(hdr), offset)) < 0)
+			return -errno;
+		if (n != sizeof(hdr) || hdr.magic != CVORA_REC_HMAGIC ||
+		    hdr.header_size < sizeof(hdr) ||
+		    hdr.record_size < CVORA_REC_ALIGN ||
+		    hdr.record_size % CVORA_REC_ALIGN ||
+		    hdr.record_size < hdr.header_size ||
+		    offset + hdr.record_size > arc->size)
+			break;
+		if (arc->count == size) {
+			size = size ? size * 2 : 1024;
+			ix = realloc(arc->scanned, size * sizeof(*ix));
+			if (!ix)
+				return -ENOMEM;
+			arc->scanned = ix;
+		}
+		ix = &arc->scanned[arc->count++];
+		ix->sequence = hdr.sequence;
+		ix->offset = offset;
+		ix->isr_sec = hdr.isr_sec;
+		ix->isr_nsec = hdr.isr_nsec;
+		ix->lun = hdr.lun;
+		ix->bytes = hdr.bytes;
+		offset += hdr.record_size;
+	}
+	arc->index = arc->scanned;
+	return 0;
+}
+
+struct sort_ent {
+	int64_t		key;
+	uint32_t	rec;
+};
+
+static int cmp_ent(const void *a, const void *b)
+{
+	const struct sort_ent *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return (x->rec > y->rec) - (x->rec < y->rec);
+}
+
+/*
+ * A board's records are appended in interrupt order, so a lun list
+ * taken in file order is normally sorted already. Sort it if not.
+ */
+
+static int sort_lun(struct cvora_archive *arc, struct lun_list *l)
+{
+	struct sort_ent *ent;
+	uint32_t i;
+
+	for (i = 1; i < l->count; i++)
+		if (ix_key(&arc->index[l->rec[i]]) <
+		    ix_key(&arc->index[l->rec[i - 1]]))
+			break;
+	if (i >= l->count)
+		return 0;
+
+	if ((ent = malloc(l->count * sizeof(*ent))) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < l->count; i++) {
+		ent[i].key = ix_key(&arc->index[l->rec[i]]);
+		ent[i].rec = l->rec[i];
+	}
+	qsort(ent, l->count, sizeof(*ent), cmp_ent);
+	for (i = 0; i < l->count; i++)
+		l->rec[i] = ent[i].rec;
+	free(ent);
+	return 0;
+}
+
+static struct lun_list *find_lun(struct cvora_archive *arc, int32_t lun)
+{
+	int i;
+
+	for (i = 0; i < arc->nluns; i++)
+		if (arc->luns[i].lun == lun)
+			return &arc->luns[i];
+	return NULL;
+}
+
+/*
+ * Split the index per lun, counting first so every list is
+ * allocated once
+ */
+
+static int split_luns(struct cvora_archive *arc)
+{
+	struct lun_list *l = NULL;
+	uint64_t i;
+	int cc;
+
+	for (i = 0; i < arc->count; i++) {
+		if (!l || l->lun != arc->index[i].lun)
+			l = find_lun(arc, arc->index[i].lun);
+		if (!l) {
+			l = realloc(arc->luns, (arc->nluns + 1) * sizeof(*l));
+			if (!l)
+				return -ENOMEM;
+			arc->luns = l;
+			l = &arc->luns[arc->nluns++];
+			memset(l, 0, sizeof(*l));
+			l->lun = arc->index[i].lun;
+		}
+		l->count++;
+	}
+	for (i = 0; i < arc->nluns; i++) {
+		l = &arc->luns[i];
+		if ((l->rec = malloc(l->count * sizeof(*l->rec))) == NULL)
+			return -ENOMEM;
+		l->count = 0;
+	}
+	for (i = 0, l = NULL; i < arc->count; i++) {
+		if (!l || l->lun != arc->index[i].lun)
+			l = find_lun(arc, arc->index[i].lun);
+		l->rec[l->count++] = i;
+	}
+	for (i = 0; i < arc->nluns; i++)
+		if ((cc = sort_lun(arc, &arc->luns[i])) != 0)
+			return cc;
+	return 0;
+}
+
+struct cvora_archive *cvora_arc_open(const char *path)
+{
+	struct cvora_archive *arc;
+	struct cvora_rec_file fh;
+	struct stat st;
+	int cc;
+
+	if ((arc = calloc(1, sizeof(*arc))) == NULL)
+		return NULL;
+	arc->pagesz = sysconf(_SC_PAGESIZE);
+	if ((arc->fd = open(path, O_RDONLY)) < 0) {
+		free(arc);
+		return NULL;
+	}
+	if (fstat(arc->fd, &st) != 0) {
+		cc = -errno;
+		goto fail;
+	}
+	arc->size = st.st_size;
+	if (pread(arc->fd, &fh, sizeof(fh), 0) != sizeof(fh) ||
+	    memcmp(fh.magic, CVORA_REC_MAGIC, sizeof(fh.magic)) != 0 ||
+	    fh.version != CVORA_REC_VERSION || fh.align != CVORA_REC_ALIGN) {
+		cc = -EINVAL;
+		goto fail;
+	}
+	if (fh.index_offset)
+		cc = map_index(arc, &fh);
+	else
+		cc = scan_index(arc);
+	if (cc == 0 && arc->count > UINT32_MAX)
+		cc = -EFBIG;
+	if (cc == 0)
+		cc = split_luns(arc);
+	if (cc == 0)
+		return arc;
+fail:
+	cvora_arc_close(arc);
+	errno = -cc;
+	return NULL;
+}
+
+void cvora_arc_close(struct cvora_archive *arc)
+{
+	int i;
+
+	if (!arc)
+		return;
+	for (i = 0; i < arc->nluns; i++)
+		free(arc->luns[i].rec);
+	free(arc->luns);
+	if (arc->map)
+		munmap(arc->map, arc->map_len);
+	free(arc->scanned);
+	close(arc->fd);
+	free(arc);
+}
+
+uint64_t cvora_arc_count(struct cvora_archive *arc)
+{
+	return arc->count;
+}
+
+const struct cvora_rec_index *cvora_arc_index(struct cvora_archive *arc,
+					      uint64_t i)
+{
+	if (i >= arc->count)
+		return NULL;
+	return &arc->index[i];
+}
+
+/* ==================== */
+
+/*
+ * Map one record and hand it to fn. Records start on CVORA_REC_ALIGN
+ * boundaries so the mapping needs no adjustment on 4K page machines.
+ * Returns fn's value, or < 0 if the record is damaged.
+ */
+
+static int visit(struct cvora_archive *arc, const struct cvora_rec_index *ix,
+		 cvora_arc_fn fn, void *arg)
+{
+	struct cvora_rec_header *hdr;
+	uint64_t start, len;
+	void *map;
+	int cc;
+
+	if (ix->offset + sizeof(*hdr) > arc->size)
+		return -EINVAL;
+	start = ix->offset & ~(uint64_t)(arc->pagesz - 1);
+	len = ix->offset - start + sizeof(*hdr) + ix->bytes;
+	if (start + len > arc->size)
+		return -EINVAL;
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, arc->fd, start);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	hdr = (void *)((char *)map + ix->offset - start);
+	if (hdr->magic != CVORA_REC_HMAGIC ||
+	    hdr->header_size < sizeof(*hdr) ||
+	    hdr->bytes != ix->bytes ||
+	    hdr->header_size + hdr->bytes > hdr->record_size ||
+	    ix->offset - start + hdr->header_size + hdr->bytes > len)
+		cc = -EINVAL;
+	else
+		cc = fn(hdr, (char *)hdr + hdr->header_size, arg);
+	munmap(map, len);
+	return cc;
+}
+
+int cvora_arc_visit(struct cvora_archive *arc, uint64_t i,
+		    cvora_arc_fn fn, void *arg)
+{
+	if (i >= arc->count)
+		return -EINVAL;
+	return visit(arc, &arc->index[i], fn, arg);
+}
+
+static int match_seq(const struct cvora_arc_query *q,
+		     const struct cvora_rec_index *ix)
+{
+	return ix->sequence >= q->first_seq &&
+	       (q->last_seq == 0 || ix->sequence <= q->last_seq);
+}
+
+/*
+ * Walk a lun's records from the first at or after from until to
+ */
+
+static int query_lun(struct cvora_archive *arc, struct lun_list *l,
+		     const struct cvora_arc_query *q, int64_t from, int64_t to,
+		     cvora_arc_fn fn, void *arg, int *found)
+{
+	const struct cvora_rec_index *ix;
+	uint32_t lo = 0, hi = l->count, mid;
+	int cc;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ix_key(&arc->index[l->rec[mid]]) < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < l->count; lo++) {
+		ix = &arc->index[l->rec[lo]];
+		if (to && ix_key(ix) >= to)
+			break;
+		if (!match_seq(q, ix))
+			continue;
+		if ((cc = visit(arc, ix, fn, arg)) < 0)
+			return cc;
+		(*found)++;
+		if (cc)
+			return cc;
+	}
+	return 0;
+}
+
+/*
+ * Walk every lun's records in file order from first_seq, which the
+ * index has in increasing order
+ */
+
+static int query_seq(struct cvora_archive *arc,
+		     const struct cvora_arc_query *q,
+		     cvora_arc_fn fn, void *arg, int *found)
+{
+	const struct cvora_rec_index *ix;
+	uint64_t lo = 0, hi = arc->count, mid;
+	int cc;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (arc->index[mid].sequence < q->first_seq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < arc->count; lo++) {
+		ix = &arc->index[lo];
+		if (q->last_seq && ix->sequence > q->last_seq)
+			break;
+		if ((cc = visit(arc, ix, fn, arg)) < 0)
+			return cc;
+		(*found)++;
+		if (cc)
+			return cc;
+	}
+	return 0;
+}
+
+int cvora_arc_query(struct cvora_archive *arc,
+		    const struct cvora_arc_query *q,
+		    cvora_arc_fn fn, void *arg)
+{
+	struct lun_list *l;
+	int64_t from, to;
+	int i, cc = 0, found = 0;
+
+	from = key(q->from_sec, q->from_nsec);
+	to = key(q->to_sec, q->to_nsec);
+
+	if (q->lun >= 0) {
+		if ((l = find_lun(arc, q->lun)) != NULL)
+			cc = query_lun(arc, l, q, from, to, fn, arg, &found);
+	} else if (from == 0 && to == 0) {
+		cc = query_seq(arc, q, fn, arg, &found);
+	} else {
+		for (i = 0; i < arc->nluns && cc == 0; i++)
+			cc = query_lun(arc, &arc->luns[i], q, from, to,
+				       fn, arg, &found);
+	}
+	if (cc < 0)
+		return cc;
+	return found;
+}
+
+/* ==================== */
+
+struct query_job {
+	const char			**paths;
+	int				nfiles;
+	const struct cvora_arc_query	*q;
+	cvora_arc_fn			fn;
+	void				*arg;
+
+	pthread_mutex_t			lock;	/* protects what follows */
+	int				next;	/* next file to query */
+	int				found;
+	int				error;
+	int				stop;	/* fn asked to stop */
+};
+
+static void *query_thread(void *arg)
+{
+	struct query_job *job = arg;
+	struct cvora_archive *arc;
+	int i, cc;
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		if (job->stop || job->next >= job->nfiles) {
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if ((arc = cvora_arc_open(job->paths[i])) == NULL) {
+			cc = -errno;
+		} else {
+			cc = cvora_arc_query(arc, job->q, job->fn, job->arg);
+			cvora_arc_close(arc);
+		}
+
+		pthread_mutex_lock(&job->lock);
+		if (cc >= 0)
+			job->found += cc;
+		else if (!job->error)
+			job->error = cc;
+		pthread_mutex_unlock(&job->lock);
+	}
+	return NULL;
+}
+
+/*
+ * A query stops early when fn returns non zero, which cvora_arc_query
+ * passes back as is. Catch that here to stop the other threads too.
+ */
+
+struct stop_arg {
+	struct query_job	*job;
+	cvora_arc_fn		fn;
+	void			*arg;
+};
+
+static int stop_fn(const struct cvora_rec_header *hdr, const void *samples,
+		   void *arg)
+{
+	struct stop_arg *sa = arg;
+	int cc;
+
+	if (sa->job->stop)
+		return 1;
+	if ((cc = sa->fn(hdr, samples, sa->arg)) != 0) {
+		pthread_mutex_lock(&sa->job->lock);
+		sa->job->stop = 1;
+		pthread_mutex_unlock(&sa->job->lock);
+	}
+	return cc;
+}
+
+int cvora_arc_query_files(const char **paths, int nfiles, int threads,
+			  const struct cvora_arc_query *q,
+			  cvora_arc_fn fn, void *arg)
+{
+	struct query_job job;
+	struct stop_arg sa;
+	pthread_t *tids;
+	int i, n;
+
+	if (nfiles <= 0)
+		return 0;
+	if (threads <= 0 || threads > nfiles)
+		threads = nfiles;
+	if ((tids = malloc(threads * sizeof(*tids))) == NULL)
+		return -ENOMEM;
+
+	memset(&job, 0, sizeof(job));
+	job.paths = paths;
+	job.nfiles = nfiles;
+	job.q = q;
+	job.fn = stop_fn;
+	job.arg = &sa;
+	sa.job = &job;
+	sa.fn = fn;
+	sa.arg = arg;
+	pthread_mutex_init(&job.lock, NULL);
+
+	for (n = 0; n < threads; n++)
+		if (pthread_create(&tids[n], NULL, query_thread, &job) != 0)
+			break;
+	if (n == 0)
+		query_thread(&job);
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_mutex_destroy(&job.lock);
+	free(tids);
+	if (job.error)
+		return job.error;
+	return job.found;
+}
+
+/* ==================== */
+
+int cvora_arc_samples(const struct cvora_rec_header *hdr,
+		      const void *samples, int maxsz, int *actsz,
+		      unsigned int *buf)
+{
+	if (hdr->codec == CVORA_CODEC_DELTA)
+		return cvora_decode_all(samples, hdr->bytes, buf, maxsz, actsz);
+	if (hdr->codec != CVORA_CODEC_NONE)
+		return -EINVAL;
+	*actsz = hdr->bytes;
+	if (*actsz > maxsz)
+		*actsz = maxsz;
+	memcpy(buf, samples, *actsz);
+	return 0;
+}
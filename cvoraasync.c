@@ -0,0 +1,682 @@
+/**
+ * Asynchronous waits and readouts for cvora, see cvoraasync.h
+ *
+ * The driver updates the status page before signalling the eventfds
+ * of a module, so once the eventfd is readable the page holds the
+ * event. Waits remember the interrupt count they were queued at and
+ * complete on the first event with another count, which keeps an
+ * interrupt that came before a wait from completing it.
+ *
+ * Timeouts are kept in a heap of deadlines, the nearest bounding the
+ * epoll wait. Readouts are queued to a helper thread, which signals
+ * their completion on an eventfd of the reactor.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "libcvora.h"
+#include "cvoraasync.h"
+
+#define MAX_EVENTS	64
+#define NSEC		1000000000LL
+
+struct op {
+	struct op		*next;		/* waiters of a module, */
+	struct op		*prev;		/* readout queue, free list */
+	int			fd;
+	int			heap;		/* deadline heap slot or -1 */
+	int64_t			deadline;
+	int			count;		/* interrupt count at queueing */
+	cvora_wait_fn		wait_fn;
+	cvora_read_fn		read_fn;
+	void			*arg;
+
+	/* Readouts */
+	struct cvora_event	ev;
+	int			has_ev;
+	int			chunk;
+	int			maxsz;
+	unsigned int		*buf;
+	int			cc;
+	int			actsz;
+};
+
+struct module {
+	int			fd;		/* -1 once removed */
+	int			efd;
+	const void		*page;
+	struct op		waiters;	/* circular list head */
+	struct module		*next;
+};
+
+struct cvora_reactor {
+	int			epfd;
+	int			cfd;		/* readouts completed */
+	struct module		*modules;
+	struct module		*dead;		/* removed while running */
+	int			running;
+	struct op		**heap;
+	int			nheap;
+	int			heapsz;
+	struct op		*free_ops;
+
+	pthread_t		thread;
+	pthread_mutex_t		lock;		/* protects what follows */
+	pthread_cond_t		queued;		/* readout queued or closing */
+	pthread_cond_t		finished;	/* readout done */
+	struct op		*qhead;
+	struct op		*qtail;
+	struct op		*current;	/* readout under way */
+	struct op		*done;
+	struct op		*done_tail;
+	int			closing;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+/*
+ * The front end glibc has no eventfd wrapper
+ */
+
+static int make_eventfd(void)
+{
+	int efd, cc;
+
+	if ((efd = syscall(__NR_eventfd, 0)) < 0)
+		return -errno;
+	if (fcntl(efd, F_SETFL, O_NONBLOCK) < 0) {
+		cc = -errno;
+		close(efd);
+		return cc;
+	}
+	return efd;
+}
+
+static void event_from_status(struct cvora_event *ev,
+			      const struct cvora_status *st)
+{
+	ev->lun = st->lun;
+	ev->mask = st->mask;
+	ev->count = st->count;
+	ev->control = st->control;
+	ev->memory_pointer = st->memory_pointer;
+	ev->mode = st->mode;
+	ev->frequency = st->frequency;
+}
+
+/* ==================== */
+
+static struct op *op_alloc(struct cvora_reactor *r)
+{
+	struct op *op = r->free_ops;
+
+	if (op)
+		r->free_ops = op->next;
+	else if ((op = malloc(sizeof(*op))) == NULL)
+		return NULL;
+	memset(op, 0, sizeof(*op));
+	op->heap = -1;
+	return op;
+}
+
+static void op_free(struct cvora_reactor *r, struct op *op)
+{
+	op->next = r->free_ops;
+	r->free_ops = op;
+}
+
+static void list_init(struct op *head)
+{
+	head->next = head->prev = head;
+}
+
+static void list_add(struct op *head, struct op *op)
+{
+	op->prev = head->prev;
+	op->next = head;
+	head->prev->next = op;
+	head->prev = op;
+}
+
+static void list_del(struct op *op)
+{
+	op->prev->next = op->next;
+	op->next->prev = op->prev;
+}
+
+/* Move all of from to the empty list to */
+
+static void list_splice(struct op *from, struct op *to)
+{
+	if (from->next == from) {
+		list_init(to);
+		return;
+	}
+	*to = *from;
+	to->next->prev = to;
+	to->prev->next = to;
+	list_init(from);
+}
+
+/* ==================== */
+
+/*
+ * Deadline heap, nearest first
+ */
+
+static void heap_set(struct cvora_reactor *r, int i, struct op *op)
+{
+	r->heap[i] = op;
+	op->heap = i;
+}
+
+static void heap_sift(struct cvora_reactor *r, int i)
+{
+	struct op *op = r->heap[i];
+	int p, c;
+
+	while (i > 0 && r->heap[p = (i - 1) / 2]->deadline > op->deadline) {
+		heap_set(r, i, r->heap[p]);
+		i = p;
+	}
+	while ((c = 2 * i + 1) < r->nheap) {
+		if (c + 1 < r->nheap &&
+		    r->heap[c + 1]->deadline < r->heap[c]->deadline)
+			c++;
+		if (r->heap[c]->deadline >= op->deadline)
+			break;
+		heap_set(r, i, r->heap[c]);
+		i = c;
+	}
+	heap_set(r, i, op);
+}
+
+static int heap_push(struct cvora_reactor *r, struct op *op)
+{
+	struct op **h;
+	int sz;
+
+	if (r->nheap == r->heapsz) {
+		sz = r->heapsz ? 2 * r->heapsz : 64;
+		if ((h = realloc(r->heap, sz * sizeof(*h))) == NULL)
+			return -ENOMEM;
+		r->heap = h;
+		r->heapsz = sz;
+	}
+	heap_set(r, r->nheap++, op);
+	heap_sift(r, op->heap);
+	return 0;
+}
+
+static void heap_remove(struct cvora_reactor *r, struct op *op)
+{
+	int i = op->heap;
+
+	if (i < 0)
+		return;
+	op->heap = -1;
+	if (i == --r->nheap)
+		return;
+	heap_set(r, i, r->heap[r->nheap]);
+	heap_sift(r, i);
+}
+
+/* ==================== */
+
+/*
+ * Readout thread
+ */
+
+static void read_op(struct op *op)
+{
+	if (op->has_ev && op->chunk > 0)
+		op->cc = cvora_read_event_samples_pipelined(op->fd, &op->ev,
+				op->chunk, op->maxsz, &op->actsz, op->buf);
+	else if (op->has_ev)
+		op->cc = cvora_read_event_samples(op->fd, &op->ev,
+				op->maxsz, &op->actsz, op->buf);
+	else if (op->chunk > 0)
+		op->cc = cvora_read_samples_pipelined(op->fd, op->chunk,
+				op->maxsz, &op->actsz, op->buf);
+	else
+		op->cc = cvora_read_samples(op->fd, op->maxsz, &op->actsz,
+					    op->buf);
+	if (op->cc == -1)
+		op->cc = -errno;
+}
+
+static void *reader(void *arg)
+{
+	struct cvora_reactor *r = arg;
+	uint64_t one = 1;
+	struct op *op;
+	ssize_t n;
+
+	pthread_mutex_lock(&r->lock);
+	for (;;) {
+		while (!r->qhead && !r->closing)
+			pthread_cond_wait(&r->queued, &r->lock);
+		if ((op = r->qhead) == NULL)
+			break;
+		if ((r->qhead = op->next) == NULL)
+			r->qtail = NULL;
+		r->current = op;
+		pthread_mutex_unlock(&r->lock);
+
+		read_op(op);
+
+		pthread_mutex_lock(&r->lock);
+		r->current = NULL;
+		op->next = NULL;
+		if (r->done_tail)
+			r->done_tail->next = op;
+		else
+			r->done = op;
+		r->done_tail = op;
+		pthread_cond_broadcast(&r->finished);
+
+		/* Fails only with the counter at its max, still readable */
+
+		n = write(r->cfd, &one, sizeof(one));
+	}
+	pthread_mutex_unlock(&r->lock);
+	(void)n;
+	return NULL;
+}
+
+/* ==================== */
+
+struct cvora_reactor *cvora_reactor_create(void)
+{
+	struct cvora_reactor *r;
+	struct epoll_event ee;
+	int cc;
+
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return NULL;
+	r->epfd = r->cfd = -1;
+	if ((r->epfd = epoll_create(MAX_EVENTS)) < 0)
+		goto out_errno;
+	if ((r->cfd = make_eventfd()) < 0) {
+		errno = -r->cfd;
+		goto out_errno;
+	}
+	memset(&ee, 0, sizeof(ee));
+	ee.events = EPOLLIN;
+	ee.data.ptr = NULL;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->cfd, &ee) < 0)
+		goto out_errno;
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->queued, NULL);
+	pthread_cond_init(&r->finished, NULL);
+	if ((cc = pthread_create(&r->thread, NULL, reader, r)) != 0) {
+		pthread_cond_destroy(&r->finished);
+		pthread_cond_destroy(&r->queued);
+		pthread_mutex_destroy(&r->lock);
+		errno = cc;
+		goto out_errno;
+	}
+	return r;
+
+out_errno:
+	cc = errno;
+	if (r->cfd >= 0)
+		close(r->cfd);
+	if (r->epfd >= 0)
+		close(r->epfd);
+	free(r);
+	errno = cc;
+	return NULL;
+}
+
+void cvora_reactor_destroy(struct cvora_reactor *r)
+{
+	struct op *op;
+
+	while (r->modules)
+		cvora_reactor_remove(r, r->modules->fd);
+
+	pthread_mutex_lock(&r->lock);
+	r->closing = 1;
+	pthread_cond_signal(&r->queued);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+	pthread_cond_destroy(&r->finished);
+	pthread_cond_destroy(&r->queued);
+	pthread_mutex_destroy(&r->lock);
+
+	while ((op = r->free_ops) != NULL) {
+		r->free_ops = op->next;
+		free(op);
+	}
+	free(r->heap);
+	close(r->cfd);
+	close(r->epfd);
+	free(r);
+}
+
+int cvora_reactor_fd(struct cvora_reactor *r)
+{
+	return r->epfd;
+}
+
+static struct module *find_module(struct cvora_reactor *r, int fd)
+{
+	struct module *m;
+
+	for (m = r->modules; m; m = m->next)
+		if (m->fd == fd)
+			return m;
+	return NULL;
+}
+
+int cvora_reactor_add(struct cvora_reactor *r, int fd)
+{
+	struct epoll_event ee;
+	struct module *m;
+	int cc;
+
+	if (find_module(r, fd))
+		return -EEXIST;
+	if ((m = calloc(1, sizeof(*m))) == NULL)
+		return -ENOMEM;
+	m->fd = fd;
+	list_init(&m->waiters);
+	if ((m->efd = make_eventfd()) < 0) {
+		cc = m->efd;
+		goto out_free;
+	}
+	if ((cc = cvora_status_map(fd, &m->page)) < 0)
+		goto out_close;
+	if ((cc = cvora_attach_eventfd(fd, m->efd)) < 0) {
+		cc = cc < -1 ? cc : -errno;
+		goto out_unmap;
+	}
+	memset(&ee, 0, sizeof(ee));
+	ee.events = EPOLLIN;
+	ee.data.ptr = m;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, m->efd, &ee) < 0) {
+		cc = -errno;
+		cvora_detach_eventfd(fd, m->efd);
+		goto out_unmap;
+	}
+	m->next = r->modules;
+	r->modules = m;
+	return 0;
+
+out_unmap:
+	cvora_status_unmap(m->page);
+out_close:
+	close(m->efd);
+out_free:
+	free(m);
+	return cc;
+}
+
+int cvora_reactor_remove(struct cvora_reactor *r, int fd)
+{
+	struct module *m, **mp;
+	struct op list, *op, **qp;
+
+	for (mp = &r->modules; (m = *mp) != NULL; mp = &m->next)
+		if (m->fd == fd)
+			break;
+	if (m == NULL)
+		return -ENOENT;
+	*mp = m->next;
+
+	epoll_ctl(r->epfd, EPOLL_CTL_DEL, m->efd, NULL);
+	cvora_detach_eventfd(fd, m->efd);
+	close(m->efd);
+	cvora_status_unmap(m->page);
+	m->fd = -1;
+
+	list_splice(&m->waiters, &list);
+	while ((op = list.next) != &list) {
+		list_del(op);
+		heap_remove(r, op);
+		op->wait_fn(-ECANCELED, NULL, op->arg);
+		op_free(r, op);
+	}
+
+	/*
+	 * Readouts not started are cancelled, the one under way is
+	 * waited for and completes with the rest of those done
+	 */
+
+	list_init(&list);
+	pthread_mutex_lock(&r->lock);
+	for (qp = &r->qhead, r->qtail = NULL; (op = *qp) != NULL; ) {
+		if (op->fd == fd) {
+			*qp = op->next;
+			op->cc = -ECANCELED;
+			list_add(&list, op);
+		} else {
+			r->qtail = op;
+			qp = &op->next;
+		}
+	}
+	while (r->current && r->current->fd == fd)
+		pthread_cond_wait(&r->finished, &r->lock);
+	for (qp = &r->done, r->done_tail = NULL; (op = *qp) != NULL; ) {
+		if (op->fd == fd) {
+			*qp = op->next;
+			list_add(&list, op);
+		} else {
+			r->done_tail = op;
+			qp = &op->next;
+		}
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	while ((op = list.next) != &list) {
+		list_del(op);
+		op->read_fn(op->cc, op->cc ? 0 : op->actsz, op->arg);
+		op_free(r, op);
+	}
+
+	if (r->running) {
+		m->next = r->dead;	/* may still be in the epoll batch */
+		r->dead = m;
+	} else {
+		free(m);
+	}
+	return 0;
+}
+
+/* ==================== */
+
+int cvora_async_wait(struct cvora_reactor *r, int fd, int timeout,
+		     cvora_wait_fn fn, void *arg)
+{
+	struct cvora_status st;
+	struct module *m;
+	struct op *op;
+
+	if ((m = find_module(r, fd)) == NULL)
+		return -ENOENT;
+	if (timeout < 0)
+		return -EINVAL;
+	if ((op = op_alloc(r)) == NULL)
+		return -ENOMEM;
+	op->fd = fd;
+	op->wait_fn = fn;
+	op->arg = arg;
+	cvora_status_read(m->page, &st);
+	op->count = st.count;
+	if (timeout) {
+		op->deadline = now_ns() + timeout * 1000LL;
+		if (heap_push(r, op) < 0) {
+			op_free(r, op);
+			return -ENOMEM;
+		}
+	}
+	list_add(&m->waiters, op);
+	return 0;
+}
+
+int cvora_async_read(struct cvora_reactor *r, int fd,
+		     const struct cvora_event *ev, int chunk,
+		     int maxsz, unsigned int *buf,
+		     cvora_read_fn fn, void *arg)
+{
+	struct op *op;
+
+	if (find_module(r, fd) == NULL)
+		return -ENOENT;
+	if ((op = op_alloc(r)) == NULL)
+		return -ENOMEM;
+	op->fd = fd;
+	op->read_fn = fn;
+	op->arg = arg;
+	if (ev) {
+		op->ev = *ev;
+		op->has_ev = 1;
+	}
+	op->chunk = chunk;
+	op->maxsz = maxsz;
+	op->buf = buf;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->qtail)
+		r->qtail->next = op;
+	else
+		r->qhead = op;
+	r->qtail = op;
+	pthread_cond_signal(&r->queued);
+	pthread_mutex_unlock(&r->lock);
+	return 0;
+}
+
+/* ==================== */
+
+/*
+ * Complete the waits of a module queued before its last interrupt.
+ * They are taken off the module first, so callbacks queueing new
+ * waits or removing the module do not disturb the walk.
+ */
+
+static int deliver(struct cvora_reactor *r, struct module *m)
+{
+	struct cvora_status st;
+	struct cvora_event ev;
+	struct op list, *op, *next;
+	uint64_t n;
+	int calls = 0;
+
+	if (m->fd < 0)
+		return 0;
+	if (read(m->efd, &n, sizeof(n)) != sizeof(n))
+		return 0;
+	cvora_status_read(m->page, &st);
+	event_from_status(&ev, &st);
+
+	list_init(&list);
+	for (op = m->waiters.next; op != &m->waiters; op = next) {
+		next = op->next;
+		if (op->count == st.count)
+			continue;
+		list_del(op);
+		heap_remove(r, op);
+		list_add(&list, op);
+	}
+	while ((op = list.next) != &list) {
+		list_del(op);
+		op->wait_fn(0, &ev, op->arg);
+		op_free(r, op);
+		calls++;
+	}
+	return calls;
+}
+
+static int complete(struct cvora_reactor *r)
+{
+	struct op *op;
+	uint64_t n;
+	int calls = 0;
+
+	if (read(r->cfd, &n, sizeof(n)) != sizeof(n))
+		return 0;
+	pthread_mutex_lock(&r->lock);
+	op = r->done;
+	r->done = r->done_tail = NULL;
+	pthread_mutex_unlock(&r->lock);
+
+	while (op) {
+		struct op *next = op->next;
+
+		op->read_fn(op->cc, op->cc ? 0 : op->actsz, op->arg);
+		op_free(r, op);
+		op = next;
+		calls++;
+	}
+	return calls;
+}
+
+static int expire(struct cvora_reactor *r)
+{
+	int64_t now = now_ns();
+	struct op *op;
+	int calls = 0;
+
+	while (r->nheap && (op = r->heap[0])->deadline <= now) {
+		heap_remove(r, op);
+		list_del(op);
+		op->wait_fn(-ETIME, NULL, op->arg);
+		op_free(r, op);
+		calls++;
+	}
+	return calls;
+}
+
+int cvora_reactor_run(struct cvora_reactor *r, int timeout)
+{
+	struct epoll_event evs[MAX_EVENTS];
+	struct module *m;
+	int64_t ms;
+	int n, i, calls = 0;
+
+	if (r->nheap) {
+		ms = (r->heap[0]->deadline - now_ns() + 999999) / 1000000;
+		if (ms < 0)
+			ms = 0;
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	if ((n = epoll_wait(r->epfd, evs, MAX_EVENTS, timeout)) < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	r->running = 1;
+	for (i = 0; i < n; i++) {
+		if (evs[i].data.ptr)
+			calls += deliver(r, evs[i].data.ptr);
+		else
+			calls += complete(r);
+	}
+	calls += expire(r);
+	r->running = 0;
+
+	while ((m = r->dead) != NULL) {
+		r->dead = m->next;
+		free(m);
+	}
+	return calls;
+}
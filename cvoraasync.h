@@ -0,0 +1,132 @@
+/**
+ * Asynchronous waits and readouts for cvora
+ *
+ * A reactor multiplexes any number of modules on one epoll file
+ * descriptor, so a single thread serves a full crate. Each module
+ * added gets an eventfd attached, signalled by the driver on every
+ * interrupt, and its status page mapped, so an interrupt costs one
+ * eventfd read and no wait call. Readouts run in turn on a helper
+ * thread, as the driver serializes DMA anyway, and complete back
+ * through the reactor.
+ *
+ * Operations are one shot: the callback is called once, from
+ * cvora_reactor_run, with 0 or the error negated. Every wait pending
+ * on a module completes with the same next interrupt. Callbacks may
+ * queue further operations. The reactor is not thread safe: one
+ * thread adds modules, queues operations and runs it.
+ */
+
+#ifndef _CVORAASYNC_H
+#define _CVORAASYNC_H
+
+#include "libcvora.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @cond */
+struct cvora_reactor;
+/** @endcond */
+
+/**
+ * Wait completion: cc is 0 and ev the interrupt event, or cc is
+ * -ETIME on timeout, -ECANCELED if the module was removed
+ */
+typedef void (*cvora_wait_fn)(int cc, const struct cvora_event *ev,
+			      void *arg);
+
+/**
+ * Readout completion: cc is 0 and actsz the sample bytes read, or cc
+ * is the error negated, -ECANCELED if the module was removed
+ */
+typedef void (*cvora_read_fn)(int cc, int actsz, void *arg);
+
+/**
+ * @brief create a reactor
+ * @return the reactor, or NULL with errno set if error
+ */
+struct cvora_reactor *cvora_reactor_create(void);
+
+/**
+ * @brief destroy a reactor
+ * Removes the modules still added, see cvora_reactor_remove
+ * @param r reactor
+ */
+void cvora_reactor_destroy(struct cvora_reactor *r);
+
+/**
+ * @brief epoll file descriptor of a reactor
+ * Readable when cvora_reactor_run has work, to nest the reactor in
+ * another event loop
+ * @param r reactor
+ * @return file descriptor
+ */
+int cvora_reactor_fd(struct cvora_reactor *r);
+
+/**
+ * @brief add a module to a reactor
+ * Replayed modules deliver cycles only to blocking waits and cannot
+ * be added.
+ * @param r reactor
+ * @param fd file descriptor returned from cvora_init
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_reactor_add(struct cvora_reactor *r, int fd);
+
+/**
+ * @brief remove a module from a reactor
+ * Operations pending on the module complete with -ECANCELED before
+ * this returns, a readout under way once its transfer is over.
+ * @param r reactor
+ * @param fd file descriptor added
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_reactor_remove(struct cvora_reactor *r, int fd);
+
+/**
+ * @brief wait asynchronously for the next interrupt of a module
+ * @param r reactor
+ * @param fd file descriptor added
+ * @param timeout timeout in microseconds, 0 waits forever
+ * @param fn completion callback
+ * @param arg callback argument
+ * @return 0 if queued, < 0 if error
+ */
+int cvora_async_wait(struct cvora_reactor *r, int fd, int timeout,
+		     cvora_wait_fn fn, void *arg);
+
+/**
+ * @brief read the samples of a module asynchronously
+ * buf must stay valid until the callback.
+ * @param r reactor
+ * @param fd file descriptor added
+ * @param ev event whose samples to read, see cvora_read_event_samples,
+ *	  or NULL to read up to the memory pointer
+ * @param chunk > 0 to read pipelined, see cvora_read_samples_pipelined
+ * @param maxsz max byte size to read
+ * @param buf pointer to data area
+ * @param fn completion callback
+ * @param arg callback argument
+ * @return 0 if queued, < 0 if error
+ */
+int cvora_async_read(struct cvora_reactor *r, int fd,
+		     const struct cvora_event *ev, int chunk,
+		     int maxsz, unsigned int *buf,
+		     cvora_read_fn fn, void *arg);
+
+/**
+ * @brief run the callbacks of the operations completed
+ * Blocks until an interrupt, a readout or a timeout is due, or for
+ * timeout at most.
+ * @param r reactor
+ * @param timeout max milliseconds to block, 0 not at all, -1 forever
+ * @return number of callbacks called, or < 0 if error
+ */
+int cvora_reactor_run(struct cvora_reactor *r, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+#endif	/* _CVORAASYNC_H */
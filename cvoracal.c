@@ -0,0 +1,477 @@
+/**
+ * Calibration of cvora samples to physical units, see cvoracal.h
+ *
+ * Samples go through a block of doubles small enough to stay in the
+ * first level cache: one loop decodes a block from the memory layout,
+ * the next converts it into the channel array. Both are plain loops
+ * over the block, inlined with constant layout, signedness and output
+ * type so the compiler vectorizes them, and the samples never take a
+ * full size trip through memory between decoding and conversion.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "libcvora.h"
+#include "cvoracal.h"
+
+#define BLOCK		256		/* samples, even */
+#define MAX_INPUTS	32
+
+#define INLINE		static inline __attribute__((always_inline))
+
+/* sample layouts in a block */
+#define WORD		0		/* whole words */
+#define HIGH		1		/* high half words */
+#define LOW		2		/* low half words */
+#define BOTH		3		/* high then low half of each word */
+
+struct input {
+	int		degree;
+	double		coef[CVORA_CAL_MAX_DEGREE + 1];
+	double		*lut;		/* or NULL */
+};
+
+struct unit {
+	int		lun;
+	struct input	in[MAX_INPUTS];
+};
+
+struct cvora_cal {
+	int		nunits;
+	struct unit	*units;
+};
+
+static const struct input identity = { 1, { 0, 1 }, NULL };
+
+/* ==================== */
+
+static void input_clear(struct input *in)
+{
+	free(in->lut);
+	*in = identity;
+}
+
+/*
+ * Calibration of an input, made if missing and make is set
+ */
+
+static struct input *lookup(struct cvora_cal *cal, int lun, int input,
+			    int make)
+{
+	struct unit *u;
+	int i;
+
+	if (input < 0 || input >= MAX_INPUTS)
+		return NULL;
+	for (i = 0; i < cal->nunits; i++)
+		if (cal->units[i].lun == lun)
+			return &cal->units[i].in[input];
+	if (!make)
+		return NULL;
+	u = realloc(cal->units, (cal->nunits + 1) * sizeof(*u));
+	if (u == NULL)
+		return NULL;
+	cal->units = u;
+	u = &cal->units[cal->nunits++];
+	u->lun = lun;
+	for (i = 0; i < MAX_INPUTS; i++)
+		u->in[i] = identity;
+	return &u->in[input];
+}
+
+/*
+ * Input of channel c: the c-th bit set in the parallel channels mask,
+ * or c
+ */
+
+static int channel_input(int mode, unsigned int chans, int width, int c)
+{
+	int i;
+
+	if (width != 32 || mode == cvora_btrain_counter || chans == 0)
+		return c;
+	for (i = 0; i < MAX_INPUTS; i++)
+		if ((chans & (1U << i)) && c-- == 0)
+			return i;
+	return 0;
+}
+
+static const struct input *channel_cal(struct cvora_cal *cal, int lun,
+				       int mode, unsigned int chans,
+				       int width, int c)
+{
+	const struct input *in;
+
+	in = lookup(cal, lun, channel_input(mode, chans, width, c), 0);
+	return in ? in : &identity;
+}
+
+/* ==================== */
+
+/*
+ * A count as a double, unsigned 32 bit ones through int32 which
+ * vectorizes where uint32 conversions do not
+ */
+
+INLINE double count(uint32_t u, const int sel, const int sgn)
+{
+	if (sel == WORD)
+		return sgn ? (double)(int32_t)u :
+			     (double)(int32_t)(u ^ 0x80000000U) + 2147483648.0;
+	if (sel == HIGH)
+		u >>= 16;
+	return sgn ? (double)(int16_t)u : (double)(u & 0xffff);
+}
+
+INLINE void dec(const uint32_t *w, int stride, int m, const int sel,
+		const int sgn, double *x)
+{
+	int i;
+
+	if (sel == BOTH) {
+		for (i = 0; i < m / 2; i++) {
+			x[2 * i] = count(w[i], HIGH, sgn);
+			x[2 * i + 1] = count(w[i], LOW, sgn);
+		}
+		if (m & 1)
+			x[m - 1] = count(w[i], HIGH, sgn);
+		return;
+	}
+	for (i = 0; i < m; i++)
+		x[i] = count(w[i * stride], sel, sgn);
+}
+
+/*
+ * m samples of layout sel, every stride words from w, into x
+ */
+
+static void decode(const uint32_t *w, int stride, int m, int sel, int sgn,
+		   double *x)
+{
+	switch (sel + 4 * !!sgn) {
+	case WORD:
+		if (stride == 1)
+			dec(w, 1, m, WORD, 0, x);
+		else
+			dec(w, stride, m, WORD, 0, x);
+		break;
+	case HIGH:
+		dec(w, 1, m, HIGH, 0, x);
+		break;
+	case LOW:
+		dec(w, 1, m, LOW, 0, x);
+		break;
+	case BOTH:
+		dec(w, 1, m, BOTH, 0, x);
+		break;
+	case 4 + WORD:
+		if (stride == 1)
+			dec(w, 1, m, WORD, 1, x);
+		else
+			dec(w, stride, m, WORD, 1, x);
+		break;
+	case 4 + HIGH:
+		dec(w, 1, m, HIGH, 1, x);
+		break;
+	case 4 + LOW:
+		dec(w, 1, m, LOW, 1, x);
+		break;
+	case 4 + BOTH:
+		dec(w, 1, m, BOTH, 1, x);
+		break;
+	}
+}
+
+static void decode16(const uint16_t *s, int m, int sgn, double *x)
+{
+	int i;
+
+	if (sgn)
+		for (i = 0; i < m; i++)
+			x[i] = (int16_t)s[i];
+	else
+		for (i = 0; i < m; i++)
+			x[i] = s[i];
+}
+
+INLINE void store(void *out, int i, double y, const int f64)
+{
+	if (f64)
+		((double *)out)[i] = y;
+	else
+		((float *)out)[i] = (float)y;
+}
+
+/*
+ * m counts of x converted to out, polynomials by Horner's rule a
+ * coefficient at a time over the block, x holding 2 * BLOCK
+ */
+
+INLINE void apply(const struct input *in, double *x, int m, int sgn,
+		  void *out, const int f64)
+{
+	const double *c = in->coef;
+	double bias = sgn ? 32768 : 0, *y = x + BLOCK;
+	int i, j;
+
+	if (in->lut) {
+		for (i = 0; i < m; i++)
+			store(out, i, in->lut[(int)(x[i] + bias)], f64);
+	} else if (in->degree == 1) {
+		for (i = 0; i < m; i++)
+			store(out, i, c[1] * x[i] + c[0], f64);
+	} else {
+		for (i = 0; i < m; i++)
+			y[i] = c[in->degree];
+		for (j = in->degree - 1; j >= 0; j--)
+			for (i = 0; i < m; i++)
+				y[i] = y[i] * x[i] + c[j];
+		for (i = 0; i < m; i++)
+			store(out, i, y[i], f64);
+	}
+}
+
+/* ==================== */
+
+INLINE int demux(struct cvora_cal *cal, int lun, int mode,
+		 unsigned int chans, int flags, const unsigned int *buf,
+		 int bytes, void **out, int maxsamples, int *nsamples,
+		 const int f64)
+{
+	const struct input *in;
+	double x[2 * BLOCK];
+	int sgn = flags & CVORA_CAL_SIGNED;
+	int size = f64 ? sizeof(double) : sizeof(float);
+	int width, n, words, c, i, m;
+
+	if (bytes < 0 || maxsamples < 0)
+		return -EINVAL;
+	n = cvora_mode_channels(mode, chans, &width);
+	words = bytes / 4;
+	if (width == 16 && n == 1)
+		*nsamples = 2 * words;
+	else if (width == 16)
+		*nsamples = words;
+	else
+		*nsamples = words / n;
+	if (*nsamples > maxsamples)
+		*nsamples = maxsamples;
+	for (c = 0; c < n; c++)
+		if (width == 32 && channel_cal(cal, lun, mode, chans,
+					       width, c)->lut)
+			return -EINVAL;
+
+	for (c = 0; c < n; c++) {
+		in = channel_cal(cal, lun, mode, chans, width, c);
+		for (i = 0; i < *nsamples; i += m) {
+			m = *nsamples - i < BLOCK ? *nsamples - i : BLOCK;
+			if (width == 16 && n == 1)
+				decode(buf + i / 2, 1, m, BOTH, sgn, x);
+			else if (width == 16)
+				decode(buf + i, 1, m, c ? LOW : HIGH, sgn, x);
+			else
+				decode(buf + i * n + c, n, m, WORD, sgn, x);
+			apply(in, x, m, sgn, (char *)out[c] + i * size, f64);
+		}
+	}
+	return 0;
+}
+
+INLINE int convert(struct cvora_cal *cal, int lun, int mode,
+		   unsigned int chans, int flags, int chan, const void *src,
+		   int n, void *out, const int f64)
+{
+	const struct input *in;
+	double x[2 * BLOCK];
+	int sgn = flags & CVORA_CAL_SIGNED;
+	int size = f64 ? sizeof(double) : sizeof(float);
+	int width, i, m;
+
+	if (chan < 0 || chan >= cvora_mode_channels(mode, chans, &width) ||
+	    n < 0)
+		return -EINVAL;
+	in = channel_cal(cal, lun, mode, chans, width, chan);
+	if (width == 32 && in->lut)
+		return -EINVAL;
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < BLOCK ? n - i : BLOCK;
+		if (width == 16)
+			decode16((const uint16_t *)src + i, m, sgn, x);
+		else
+			decode((const uint32_t *)src + i, 1, m, WORD, sgn, x);
+		apply(in, x, m, sgn, (char *)out + i * size, f64);
+	}
+	return 0;
+}
+
+/* ==================== */
+
+struct cvora_cal *cvora_cal_create(void)
+{
+	return calloc(1, sizeof(struct cvora_cal));
+}
+
+void cvora_cal_destroy(struct cvora_cal *cal)
+{
+	int i, j;
+
+	for (i = 0; i < cal->nunits; i++)
+		for (j = 0; j < MAX_INPUTS; j++)
+			free(cal->units[i].in[j].lut);
+	free(cal->units);
+	free(cal);
+}
+
+int cvora_cal_set_linear(struct cvora_cal *cal, int lun, int input,
+			 double gain, double offset)
+{
+	double coef[2];
+
+	coef[0] = offset;
+	coef[1] = gain;
+	return cvora_cal_set_poly(cal, lun, input, 1, coef);
+}
+
+int cvora_cal_set_poly(struct cvora_cal *cal, int lun, int input,
+		       int degree, const double *coef)
+{
+	struct input *in;
+
+	if (degree < 0 || degree > CVORA_CAL_MAX_DEGREE)
+		return -EINVAL;
+	if ((in = lookup(cal, lun, input, 1)) == NULL)
+		return input < 0 || input >= MAX_INPUTS ? -EINVAL : -ENOMEM;
+	input_clear(in);
+	memset(in->coef, 0, sizeof(in->coef));
+	memcpy(in->coef, coef, (degree + 1) * sizeof(*coef));
+	in->degree = degree < 1 ? 1 : degree;
+	return 0;
+}
+
+int cvora_cal_set_lut(struct cvora_cal *cal, int lun, int input,
+		      const double *lut)
+{
+	struct input *in;
+	double *copy;
+
+	if ((in = lookup(cal, lun, input, 1)) == NULL)
+		return input < 0 || input >= MAX_INPUTS ? -EINVAL : -ENOMEM;
+	if ((copy = malloc(CVORA_CAL_LUT_SIZE * sizeof(*copy))) == NULL)
+		return -ENOMEM;
+	memcpy(copy, lut, CVORA_CAL_LUT_SIZE * sizeof(*copy));
+	input_clear(in);
+	in->lut = copy;
+	return 0;
+}
+
+static int load_lut(struct cvora_cal *cal, int lun, int input,
+		    const char *path)
+{
+	double *lut;
+	FILE *f;
+	int i, cc;
+
+	if ((lut = malloc(CVORA_CAL_LUT_SIZE * sizeof(*lut))) == NULL)
+		return -ENOMEM;
+	if ((f = fopen(path, "r")) == NULL) {
+		cc = -errno;
+		free(lut);
+		return cc;
+	}
+	for (i = 0; i < CVORA_CAL_LUT_SIZE; i++)
+		if (fscanf(f, "%lf", &lut[i]) != 1)
+			break;
+	fclose(f);
+	cc = i < CVORA_CAL_LUT_SIZE ? -EINVAL :
+	     cvora_cal_set_lut(cal, lun, input, lut);
+	free(lut);
+	return cc;
+}
+
+static int load_line(struct cvora_cal *cal, char *line)
+{
+	double coef[CVORA_CAL_MAX_DEGREE + 2];
+	char kind[16], path[256];
+	int lun, input, pos, len, n;
+
+	line[strcspn(line, "#")] = '\0';
+	if (sscanf(line, " %15s", kind) != 1)
+		return 0;		/* blank */
+	if (sscanf(line, "%d %d %15s %n", &lun, &input, kind, &pos) != 3)
+		return -EINVAL;
+	line += pos;
+
+	if (strcmp(kind, "lut") == 0) {
+		if (sscanf(line, "%255s", path) != 1)
+			return -EINVAL;
+		return load_lut(cal, lun, input, path);
+	}
+	for (n = 0; n < CVORA_CAL_MAX_DEGREE + 2; n++, line += len)
+		if (sscanf(line, "%lf%n", &coef[n], &len) != 1)
+			break;
+	if (strcmp(kind, "linear") == 0 && n == 2)
+		return cvora_cal_set_linear(cal, lun, input, coef[0], coef[1]);
+	if (strcmp(kind, "poly") == 0 && n >= 1 &&
+	    n <= CVORA_CAL_MAX_DEGREE + 1)
+		return cvora_cal_set_poly(cal, lun, input, n - 1, coef);
+	return -EINVAL;
+}
+
+struct cvora_cal *cvora_cal_load(const char *path)
+{
+	struct cvora_cal *cal;
+	char line[1024];
+	FILE *f;
+	int cc = 0;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return NULL;
+	if ((cal = cvora_cal_create()) == NULL) {
+		fclose(f);
+		return NULL;
+	}
+	while (cc == 0 && fgets(line, sizeof(line), f))
+		cc = load_line(cal, line);
+	fclose(f);
+	if (cc < 0) {
+		cvora_cal_destroy(cal);
+		errno = -cc;
+		return NULL;
+	}
+	return cal;
+}
+
+int cvora_cal_demux_f32(struct cvora_cal *cal, int lun, int mode,
+			unsigned int chans, int flags,
+			const unsigned int *buf, int bytes,
+			float **out, int maxsamples, int *nsamples)
+{
+	return demux(cal, lun, mode, chans, flags, buf, bytes, (void **)out,
+		     maxsamples, nsamples, 0);
+}
+
+int cvora_cal_demux_f64(struct cvora_cal *cal, int lun, int mode,
+			unsigned int chans, int flags,
+			const unsigned int *buf, int bytes,
+			double **out, int maxsamples, int *nsamples)
+{
+	return demux(cal, lun, mode, chans, flags, buf, bytes, (void **)out,
+		     maxsamples, nsamples, 1);
+}
+
+int cvora_cal_convert_f32(struct cvora_cal *cal, int lun, int mode,
+			  unsigned int chans, int flags, int chan,
+			  const void *in, int n, float *out)
+{
+	return convert(cal, lun, mode, chans, flags, chan, in, n, out, 0);
+}
+
+int cvora_cal_convert_f64(struct cvora_cal *cal, int lun, int mode,
+			  unsigned int chans, int flags, int chan,
+			  const void *in, int n, double *out)
+{
+	return convert(cal, lun, mode, chans, flags, chan, in, n, out, 1);
+}
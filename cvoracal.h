@@ -0,0 +1,165 @@
+/**
+ * Calibration of cvora samples to physical units
+ *
+ * A table holds the calibration of each input of each logical unit:
+ * a gain and offset, a polynomial of the counts, or for 16 bit inputs
+ * a lookup table of the 65536 counts. Inputs not in the table convert
+ * with gain 1 and offset 0.
+ *
+ * Samples are decoded and converted in one pass, straight from the
+ * memory as read, into float or double arrays per channel, following
+ * the layout of the mode as cvora_demux does. Channels demultiplexed
+ * already convert the same way. In the 32 bit parallel modes, channel
+ * c is the input of the c-th bit set in the channels mask, counting
+ * from bit 0; in the other modes, channel c is input c.
+ *
+ * A table file has one line per input, blank lines and lines from a
+ * '#' ignored:
+ *
+ *	lun input linear gain offset
+ *	lun input poly c0 c1 ... cn
+ *	lun input lut path
+ *
+ * poly gives c0 + c1 x + ... + cn x^n of the count x, n up to
+ * CVORA_CAL_MAX_DEGREE. lut names a file of 65536 values, one per line,
+ * for the counts 0 to 65535 unsigned, -32768 to 32767 signed.
+ */
+
+#ifndef _CVORACAL_H
+#define _CVORACAL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** calibration flags */
+#define CVORA_CAL_SIGNED	0x1	/**< samples are two's complement */
+
+/** highest polynomial degree */
+#define CVORA_CAL_MAX_DEGREE	7
+
+/** lookup table entries, one per 16 bit count */
+#define CVORA_CAL_LUT_SIZE	65536
+
+/** @cond */
+struct cvora_cal;
+/** @endcond */
+
+/**
+ * @brief create an empty calibration table
+ * @return the table, or NULL with errno set if error
+ */
+struct cvora_cal *cvora_cal_create(void);
+
+/**
+ * @brief load a calibration table from a file
+ * @param path table file, see above
+ * @return the table, or NULL with errno set if error, EINVAL for a
+ *	   malformed line
+ */
+struct cvora_cal *cvora_cal_load(const char *path);
+
+/**
+ * @brief destroy a calibration table
+ * @param cal table
+ */
+void cvora_cal_destroy(struct cvora_cal *cal);
+
+/**
+ * @brief calibrate an input with a gain and offset
+ * @param cal table
+ * @param lun logical unit number
+ * @param input input, 0 to 31
+ * @param gain units per count
+ * @param offset units at count 0
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_cal_set_linear(struct cvora_cal *cal, int lun, int input,
+			 double gain, double offset);
+
+/**
+ * @brief calibrate an input with a polynomial
+ * @param cal table
+ * @param lun logical unit number
+ * @param input input, 0 to 31
+ * @param degree polynomial degree, up to CVORA_CAL_MAX_DEGREE
+ * @param coef degree + 1 coefficients, constant first
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_cal_set_poly(struct cvora_cal *cal, int lun, int input,
+		       int degree, const double *coef);
+
+/**
+ * @brief calibrate a 16 bit input with a lookup table
+ * Samples of 32 bit modes do not convert through lookup tables.
+ * @param cal table
+ * @param lun logical unit number
+ * @param input input, 0 to 31
+ * @param lut CVORA_CAL_LUT_SIZE values, copied, for the counts from
+ *	  the smallest up
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_cal_set_lut(struct cvora_cal *cal, int lun, int input,
+		      const double *lut);
+
+/**
+ * @brief split samples into one calibrated float array per channel
+ * As cvora_demux, a trailing partial set of channel samples dropped.
+ * @param cal table
+ * @param lun logical unit the samples come from
+ * @param mode the mode the samples were acquired in, enum cvora_mode
+ * @param chans parallel channels mask, for the 32 bit modes
+ * @param flags CVORA_CAL_SIGNED
+ * @param buf samples, as returned by cvora_read_samples
+ * @param bytes sample bytes
+ * @param out cvora_mode_channels arrays of maxsamples floats
+ * @param maxsamples max samples per channel
+ * @param nsamples returns samples per channel
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_cal_demux_f32(struct cvora_cal *cal, int lun, int mode,
+			unsigned int chans, int flags,
+			const unsigned int *buf, int bytes,
+			float **out, int maxsamples, int *nsamples);
+
+/**
+ * @brief split samples into one calibrated double array per channel
+ * See cvora_cal_demux_f32.
+ */
+int cvora_cal_demux_f64(struct cvora_cal *cal, int lun, int mode,
+			unsigned int chans, int flags,
+			const unsigned int *buf, int bytes,
+			double **out, int maxsamples, int *nsamples);
+
+/**
+ * @brief calibrate a channel demultiplexed by cvora_demux to floats
+ * @param cal table
+ * @param lun logical unit the samples come from
+ * @param mode the mode the samples were acquired in, enum cvora_mode
+ * @param chans parallel channels mask, for the 32 bit modes
+ * @param flags CVORA_CAL_SIGNED
+ * @param chan channel, as cvora_demux numbers them
+ * @param in samples, 16 or 32 bit as cvora_mode_channels returns
+ * @param n number of samples
+ * @param out n floats
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_cal_convert_f32(struct cvora_cal *cal, int lun, int mode,
+			  unsigned int chans, int flags, int chan,
+			  const void *in, int n, float *out);
+
+/**
+ * @brief calibrate a channel demultiplexed by cvora_demux to doubles
+ * See cvora_cal_convert_f32.
+ */
+int cvora_cal_convert_f64(struct cvora_cal *cal, int lun, int mode,
+			  unsigned int chans, int flags, int chan,
+			  const void *in, int n, double *out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif	/* _CVORACAL_H */
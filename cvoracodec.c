@@ -0,0 +1,357 @@
+/**
+ * Lossless sample codec for cvora, see cvoracodec.h
+ *
+ * Blocks are packed four values abreast: value i of a block goes to
+ * lane i % 4 of the packed words, so packing and unpacking shift and
+ * mask four words with the same counts each step, the pattern SSE2
+ * and the compiler vectorizer handle, and plain C stays portable to
+ * the front end compilers.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "libcvora.h"
+#include "cvoracodec.h"
+
+#define BLOCK	CVORA_CODEC_BLOCK
+#define ABREAST	4
+
+struct layout {
+	int	width;		/* bits per unit */
+	int	lanes;		/* interleaved channels */
+	int	order;		/* 1 delta, 2 delta of delta */
+};
+
+static void mode_layout(int mode, unsigned int channels, struct layout *l)
+{
+	l->lanes = cvora_mode_channels(mode, channels, &l->width);
+	l->order = mode == cvora_btrain_counter ? 2 : 1;
+}
+
+/*
+ * Units are the samples in memory order, half words high half first
+ * in the 16 bit modes. Lane j holds units j, j + lanes, ... and a
+ * block takes n of them starting at unit u. Blocks of a single 16 bit
+ * lane start on a word, as BLOCK is even.
+ */
+
+static void gather(const uint32_t *buf, const struct layout *l,
+		   int u, int n, uint32_t *v)
+{
+	const uint32_t *w;
+	int i;
+
+	if (l->width == 32) {
+		for (i = 0; i < n; i++)
+			v[i] = buf[u + i * l->lanes];
+	} else if (l->lanes == 1) {
+		w = buf + (u >> 1);
+		for (i = 0; i < n / 2; i++) {
+			v[2 * i] = w[i] >> 16;
+			v[2 * i + 1] = w[i] & 0xffff;
+		}
+	} else {
+		w = buf + (u >> 1);
+		for (i = 0; i < n; i++)
+			v[i] = u & 1 ? w[i] & 0xffff : w[i] >> 16;
+	}
+}
+
+/*
+ * The high half of a word always comes first, from the same lane or
+ * from lane 0 which is done before lane 1. Values of 16 bit lanes are
+ * only right in their low half.
+ */
+
+static void scatter(uint32_t *buf, const struct layout *l,
+		    int u, int n, const uint32_t *v)
+{
+	uint32_t *w;
+	int i;
+
+	if (l->width == 32) {
+		for (i = 0; i < n; i++)
+			buf[u + i * l->lanes] = v[i];
+	} else if (l->lanes == 1) {
+		w = buf + (u >> 1);
+		for (i = 0; i < n / 2; i++)
+			w[i] = v[2 * i] << 16 | (v[2 * i + 1] & 0xffff);
+	} else if (u & 1) {
+		w = buf + (u >> 1);
+		for (i = 0; i < n; i++)
+			w[i] |= v[i] & 0xffff;
+	} else {
+		w = buf + (u >> 1);
+		for (i = 0; i < n; i++)
+			w[i] = v[i] << 16;
+	}
+}
+
+static uint32_t zigzag(uint32_t d, int width)
+{
+	int32_t s = width == 16 ? (int16_t)d : (int32_t)d;
+
+	return ((uint32_t)s << 1) ^ (uint32_t)(s >> 31);
+}
+
+static uint32_t unzigzag(uint32_t z)
+{
+	return (z >> 1) ^ -(z & 1);
+}
+
+static int bits(uint32_t x)
+{
+	int n = 0;
+
+	for (; x; x >>= 1)
+		n++;
+	return n;
+}
+
+/* ==================== */
+
+/*
+ * Pack rows of four values at b bits each, returning the words used
+ */
+
+static int pack(const uint32_t *in, int rows, int b, uint32_t *out)
+{
+	uint32_t acc[ABREAST] = { 0 };
+	uint32_t *start = out;
+	int fill = 0, r, j;
+
+	if (b == 0)
+		return 0;
+	for (r = 0; r < rows; r++, in += ABREAST) {
+		for (j = 0; j < ABREAST; j++)
+			acc[j] |= in[j] << fill;
+		fill += b;
+		if (fill >= 32) {
+			for (j = 0; j < ABREAST; j++)
+				*out++ = acc[j];
+			fill -= 32;
+			for (j = 0; j < ABREAST; j++)
+				acc[j] = fill ? in[j] >> (b - fill) : 0;
+		}
+	}
+	if (fill)
+		for (j = 0; j < ABREAST; j++)
+			*out++ = acc[j];
+	return out - start;
+}
+
+static int packed_words(int rows, int b)
+{
+	return (rows * b + 31) / 32 * ABREAST;
+}
+
+/*
+ * Unpacking is the decoder's inner loop. Inlined into a case per
+ * width, the shifts and the mask become constants.
+ */
+
+static inline __attribute__((always_inline))
+void unpack_width(const uint32_t *in, int rows, const int b, uint32_t *out)
+{
+	const uint32_t mask = b == 32 ? ~0U : (1U << b) - 1;
+	int fill = 0, r, j;
+
+	for (r = 0; r < rows; r++, out += ABREAST) {
+		for (j = 0; j < ABREAST; j++)
+			out[j] = in[j] >> fill;
+		fill += b;
+		if (fill >= 32) {
+			in += ABREAST;
+			fill -= 32;
+			if (fill)
+				for (j = 0; j < ABREAST; j++)
+					out[j] |= in[j] << (b - fill);
+		}
+		for (j = 0; j < ABREAST; j++)
+			out[j] &= mask;
+	}
+}
+
+#define W(b)	case b: if (rows == BLOCK / ABREAST) \
+			unpack_width(in, BLOCK / ABREAST, b, out); \
+		else \
+			unpack_width(in, rows, b, out); \
+		break
+
+static void unpack(const uint32_t *in, int rows, int b, uint32_t *out)
+{
+	switch (b) {
+	case 0:
+		memset(out, 0, rows * ABREAST * sizeof(*out));
+		break;
+	W(1);  W(2);  W(3);  W(4);  W(5);  W(6);  W(7);  W(8);
+	W(9);  W(10); W(11); W(12); W(13); W(14); W(15); W(16);
+	W(17); W(18); W(19); W(20); W(21); W(22); W(23); W(24);
+	W(25); W(26); W(27); W(28); W(29); W(30); W(31); W(32);
+	}
+}
+
+#undef W
+
+/* ==================== */
+
+int cvora_encode(int mode, unsigned int channels,
+		 const unsigned int *buf, int bytes,
+		 void *out, int maxsz, int *actsz)
+{
+	struct cvora_codec_frame *fr = out;
+	uint32_t *o = (uint32_t *)(fr + 1);
+	uint32_t *end = (uint32_t *)((char *)out + (maxsz & ~3));
+	uint32_t tmp[BLOCK], v, prev, prevd, d, or;
+	struct layout l;
+	int units, lane, u, n, i, b, rows;
+
+	if (bytes < 0 || maxsz < (int)sizeof(*fr))
+		return -EINVAL;
+	mode_layout(mode, channels, &l);
+	units = bytes / (l.width / 8);
+	if (l.width == 16)
+		units &= ~1;		/* whole words only */
+
+	for (lane = 0; lane < l.lanes; lane++) {
+		prev = prevd = 0;
+		for (u = lane; u < units; u += n * l.lanes) {
+			n = (units - u + l.lanes - 1) / l.lanes;
+			if (n > BLOCK)
+				n = BLOCK;
+			gather(buf, &l, u, n, tmp);
+			for (i = 0, or = 0; i < n; i++) {
+				v = tmp[i];
+				d = v - prev;
+				prev = v;
+				if (l.order == 2) {
+					v = d;
+					d -= prevd;
+					prevd = v;
+				}
+				tmp[i] = zigzag(d, l.width);
+				or |= tmp[i];
+			}
+			rows = (n + ABREAST - 1) / ABREAST;
+			for (i = n; i < rows * ABREAST; i++)
+				tmp[i] = 0;
+			b = bits(or);
+			if (o + 1 + packed_words(rows, b) > end)
+				return -ENOSPC;
+			*o++ = b;
+			o += pack(tmp, rows, b, o);
+		}
+	}
+
+	/* Bytes past the last whole unit go as they are */
+
+	i = bytes - units * (l.width / 8);
+	if (i) {
+		if (o + 1 > end)
+			return -ENOSPC;
+		*o = 0;
+		memcpy(o++, (const char *)buf + bytes - i, i);
+	}
+
+	fr->magic = CVORA_CODEC_MAGIC;
+	fr->size = (char *)o - (char *)out;
+	fr->bytes = bytes;
+	fr->width = l.width;
+	fr->lanes = l.lanes;
+	fr->order = l.order;
+	fr->reserved = 0;
+	*actsz = fr->size;
+	return 0;
+}
+
+int cvora_decode(const void *in, int insz, int *used,
+		 unsigned int *buf, int maxsz, int *actsz)
+{
+	const struct cvora_codec_frame *fr = in;
+	const uint32_t *p = (const uint32_t *)(fr + 1), *end;
+	uint32_t tmp[BLOCK], prev, prevd;
+	int units, lane, u, n, i, b, rows, ubytes;
+	struct layout l;
+
+	if (insz < (int)sizeof(*fr) || fr->magic != CVORA_CODEC_MAGIC ||
+	    fr->size > insz || fr->size & 3 ||
+	    (fr->width != 16 && fr->width != 32) || fr->lanes == 0 ||
+	    fr->lanes > (fr->width == 16 ? 2 : 32) ||
+	    (fr->order != 1 && fr->order != 2))
+		return -EINVAL;
+	if (fr->bytes > maxsz)
+		return -ENOSPC;
+	end = (const uint32_t *)((const char *)in + fr->size);
+	l.width = fr->width;
+	l.lanes = fr->lanes;
+	l.order = fr->order;
+	ubytes = fr->width / 8;
+	units = fr->bytes / ubytes;
+	if (fr->width == 16)
+		units &= ~1;
+
+	for (lane = 0; lane < fr->lanes; lane++) {
+		prev = prevd = 0;
+		for (u = lane; u < units; u += n * fr->lanes) {
+			n = (units - u + fr->lanes - 1) / fr->lanes;
+			if (n > BLOCK)
+				n = BLOCK;
+			rows = (n + ABREAST - 1) / ABREAST;
+			if (p >= end)
+				return -EINVAL;
+			b = *p++;
+			if (b > fr->width + 1 || b > 32 ||
+			    p + packed_words(rows, b) > end)
+				return -EINVAL;
+			unpack(p, rows, b, tmp);
+			p += packed_words(rows, b);
+
+			if (fr->order == 2) {
+				for (i = 0; i < n; i++) {
+					prevd += unzigzag(tmp[i]);
+					prev += prevd;
+					tmp[i] = prev;
+				}
+			} else {
+				for (i = 0; i < n; i++) {
+					prev += unzigzag(tmp[i]);
+					tmp[i] = prev;
+				}
+			}
+			scatter(buf, &l, u, n, tmp);
+		}
+	}
+
+	i = fr->bytes - units * ubytes;
+	if (i) {
+		if (p >= end)
+			return -EINVAL;
+		memcpy((char *)buf + fr->bytes - i, p++, i);
+	}
+	if (p != end)
+		return -EINVAL;
+	*used = fr->size;
+	*actsz = fr->bytes;
+	return 0;
+}
+
+int cvora_decode_all(const void *in, int insz,
+		     unsigned int *buf, int maxsz, int *actsz)
+{
+	int used, n, cc;
+
+	*actsz = 0;
+	while (insz > 0) {
+		cc = cvora_decode(in, insz, &used, buf, maxsz - *actsz, &n);
+		if (cc != 0)
+			return cc;
+		if (n & 3 && used < insz)
+			return -EINVAL;		/* only the last frame may */
+		in = (const char *)in + used;
+		insz -= used;
+		buf += n / 4;
+		*actsz += n;
+	}
+	return 0;
+}
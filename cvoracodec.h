@@ -0,0 +1,101 @@
+/**
+ * Lossless sample codec for cvora
+ *
+ * The samples of each channel are delta coded, or delta of delta
+ * coded for the B train counters, zigzag mapped so small negative
+ * differences stay small, and bit packed in blocks of 128 values at
+ * the width of the largest value in the block.
+ *
+ * Channels follow the memory layout of the mode: the 16 bit single
+ * input modes are one channel of half words, the two input modes two
+ * channels of half words, and the 32 bit modes one channel per bit in
+ * the parallel channels mask, interleaved word by word.
+ *
+ * Encoded data is a sequence of frames, each holding one call's worth
+ * of samples and decodable on its own, so a stream can be encoded
+ * chunk by chunk and decoded frame by frame.
+ */
+
+#ifndef _CVORACODEC_H
+#define _CVORACODEC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** codec identifier, as in struct cvora_rec_header */
+#define CVORA_CODEC_NONE	0	/**< raw samples */
+#define CVORA_CODEC_DELTA	1	/**< this codec */
+
+/** @cond */
+#define CVORA_CODEC_MAGIC	0x315a5643	/* "CVZ1" */
+#define CVORA_CODEC_BLOCK	128
+/** @endcond */
+
+/**
+ * Largest frame encoding bytes of samples
+ */
+#define CVORA_CODEC_BOUND(bytes) \
+	(sizeof(struct cvora_codec_frame) + (bytes) + \
+	 ((bytes) / 256 + 64) * 32 + 4)
+
+/**
+ * Frame header, followed by the blocks of each channel in turn
+ */
+struct cvora_codec_frame {
+	uint32_t	magic;		/**< CVORA_CODEC_MAGIC */
+	uint32_t	size;		/**< frame bytes, header included */
+	uint32_t	bytes;		/**< sample bytes decoded */
+	uint8_t		width;		/**< bits per sample, 16 or 32 */
+	uint8_t		lanes;		/**< interleaved channels */
+	uint8_t		order;		/**< 1 delta, 2 delta of delta */
+	uint8_t		reserved;
+};
+
+/**
+ * @brief encode samples into one frame
+ * @param mode the mode the samples were acquired in, enum cvora_mode
+ * @param channels parallel channels mask, for the 32 bit modes
+ * @param buf samples, as returned by cvora_read_samples
+ * @param bytes sample bytes
+ * @param out frame, 4 byte aligned
+ * @param maxsz out size, CVORA_CODEC_BOUND(bytes) is always enough
+ * @param actsz frame bytes written
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_encode(int mode, unsigned int channels,
+		 const unsigned int *buf, int bytes,
+		 void *out, int maxsz, int *actsz);
+
+/**
+ * @brief decode one frame
+ * @param in frame, 4 byte aligned
+ * @param insz bytes available at in
+ * @param used frame bytes consumed, in + used is the next frame
+ * @param buf decoded samples
+ * @param maxsz buf size, the frame's bytes are needed
+ * @param actsz sample bytes decoded
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_decode(const void *in, int insz, int *used,
+		 unsigned int *buf, int maxsz, int *actsz);
+
+/**
+ * @brief decode a sequence of frames
+ * @param in frames, 4 byte aligned
+ * @param insz frame bytes
+ * @param buf decoded samples
+ * @param maxsz buf size
+ * @param actsz sample bytes decoded
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_decode_all(const void *in, int insz,
+		     unsigned int *buf, int maxsz, int *actsz);
+
+#ifdef __cplusplus
+}
+#endif
+#endif	/* _CVORACODEC_H */
@@ -0,0 +1,299 @@
+/**
+ * Min/max decimation pyramid for cvora, see cvorapyramid.h
+ *
+ * Level 0 holds the samples and level k the min and max of blocks of
+ * 2^k of them, each entry made from two of the level below. Samples
+ * are stored biased, the sign bit flipped if signed, so every compare
+ * is unsigned whatever the signedness and width.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include "libcvora.h"
+#include "cvorapyramid.h"
+
+#define MAX_LEVELS	32
+#define MAX_CHANS	32
+
+#define BIAS		0x80000000U
+
+struct level {
+	uint32_t	*min;
+	uint32_t	*max;		/* min at level 0 */
+	int		n;		/* entries */
+};
+
+struct cvora_pyramid {
+	int		nchans;
+	int		maxsamples;
+	int		levels;
+	int		flags;
+	struct level	(*lv)[MAX_LEVELS];	/* per channel */
+	uint32_t	*mem;
+};
+
+/* ==================== */
+
+/*
+ * Entries of level k from the new ones of level k - 1, one loop per
+ * level the compiler vectorizes
+ */
+
+static void build(struct level *lv, int levels)
+{
+	const uint32_t *pmn, *pmx;
+	uint32_t *mn, *mx, a, b;
+	int k, i, n;
+
+	for (k = 1; k < levels; k++) {
+		n = lv[k - 1].n >> 1;
+		pmn = lv[k - 1].min;
+		pmx = lv[k - 1].max;
+		mn = lv[k].min;
+		mx = lv[k].max;
+		for (i = lv[k].n; i < n; i++) {
+			a = pmn[2 * i];
+			b = pmn[2 * i + 1];
+			mn[i] = a < b ? a : b;
+			a = pmx[2 * i];
+			b = pmx[2 * i + 1];
+			mx[i] = a > b ? a : b;
+		}
+		lv[k].n = n;
+	}
+}
+
+/*
+ * Half words of each word to hi and lo, which are the same channel in
+ * the single input modes
+ */
+
+static int append16(struct cvora_pyramid *p, const uint32_t *w, int words,
+		    int n)
+{
+	struct level *hi = p->lv[0], *lo = p->lv[n - 1];
+	uint32_t b16 = p->flags & CVORA_PYRAMID_SIGNED ? 0x8000 : 0;
+	uint32_t off = b16 ? BIAS - b16 : 0;
+	uint32_t *oh, *ol;
+	int i, room, step = 3 - n, cc = 0;
+
+	room = (p->maxsamples - hi->n) / step;
+	if (words > room) {
+		words = room;
+		cc = -ENOSPC;
+	}
+	oh = hi->min + hi->n;
+	ol = lo->min + lo->n;
+	if (n == 1) {
+		for (i = 0; i < words; i++) {
+			oh[2 * i] = ((w[i] >> 16) ^ b16) + off;
+			oh[2 * i + 1] = ((w[i] & 0xffff) ^ b16) + off;
+		}
+	} else {
+		for (i = 0; i < words; i++) {
+			oh[i] = ((w[i] >> 16) ^ b16) + off;
+			ol[i] = ((w[i] & 0xffff) ^ b16) + off;
+		}
+	}
+	hi->n += step * words;
+	if (n == 2)
+		lo->n += words;
+	return cc;
+}
+
+/*
+ * Words interleaved across n channels, starting with channel phase
+ */
+
+static int append32(struct cvora_pyramid *p, const uint32_t *w, int words,
+		    int n, int phase)
+{
+	uint32_t b32 = p->flags & CVORA_PYRAMID_SIGNED ? BIAS : 0;
+	struct level *lv;
+	uint32_t *out;
+	int c, i, j, m, cc = 0;
+
+	for (c = 0; c < n; c++) {
+		lv = p->lv[c];
+		i = (c - phase + n) % n;
+		m = i < words ? (words - i + n - 1) / n : 0;
+		if (m > p->maxsamples - lv->n) {
+			m = p->maxsamples - lv->n;
+			cc = -ENOSPC;
+		}
+		out = lv->min + lv->n;
+		for (j = 0; j < m; j++, i += n)
+			out[j] = w[i] ^ b32;
+		lv->n += m;
+	}
+	return cc;
+}
+
+static uint32_t umin(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+static uint32_t umax(uint32_t a, uint32_t b)
+{
+	return a > b ? a : b;
+}
+
+/*
+ * Min and max of samples [a, b), taking the unpaired entries at either
+ * end of each level and going up for the rest, scanning the top level
+ */
+
+static void range(const struct level *lv, int levels, int a, int b,
+		  uint32_t *mn, uint32_t *mx)
+{
+	int k;
+
+	*mn = ~0U;
+	*mx = 0;
+	for (k = 0; a < b; k++, a >>= 1, b >>= 1) {
+		if (k == levels - 1) {
+			for (; a < b; a++) {
+				*mn = umin(*mn, lv[k].min[a]);
+				*mx = umax(*mx, lv[k].max[a]);
+			}
+			break;
+		}
+		if (a & 1) {
+			*mn = umin(*mn, lv[k].min[a]);
+			*mx = umax(*mx, lv[k].max[a]);
+			a++;
+		}
+		if (b & 1) {
+			b--;
+			*mn = umin(*mn, lv[k].min[b]);
+			*mx = umax(*mx, lv[k].max[b]);
+		}
+	}
+}
+
+static int64_t unbias(uint32_t u, int flags)
+{
+	return flags & CVORA_PYRAMID_SIGNED ?
+		(int64_t)(int32_t)(u ^ BIAS) : (int64_t)u;
+}
+
+/* ==================== */
+
+struct cvora_pyramid *cvora_pyramid_create(int nchans, int maxsamples,
+					   int width, int flags)
+{
+	struct cvora_pyramid *p;
+	struct level *lv;
+	uint32_t *mem;
+	size_t words;
+	int c, k, levels;
+
+	if (maxsamples == 0)
+		maxsamples = CVORA_MEM_SIZE / 2;
+	if (nchans <= 0 || nchans > MAX_CHANS || maxsamples < 0 ||
+	    width <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	for (levels = 1, words = maxsamples;
+	     levels < MAX_LEVELS && (maxsamples >> (levels - 1)) > width;
+	     levels++)
+		words += 2 * (maxsamples >> levels);
+
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return NULL;
+	p->lv = calloc(nchans, sizeof(*p->lv));
+	p->mem = malloc(nchans * words * sizeof(*p->mem));
+	if (p->lv == NULL || p->mem == NULL) {
+		cvora_pyramid_destroy(p);
+		return NULL;
+	}
+	p->nchans = nchans;
+	p->maxsamples = maxsamples;
+	p->levels = levels;
+	p->flags = flags;
+
+	for (c = 0, mem = p->mem; c < nchans; c++) {
+		lv = p->lv[c];
+		lv[0].min = lv[0].max = mem;
+		mem += maxsamples;
+		for (k = 1; k < levels; k++) {
+			lv[k].min = mem;
+			mem += maxsamples >> k;
+			lv[k].max = mem;
+			mem += maxsamples >> k;
+		}
+	}
+	return p;
+}
+
+void cvora_pyramid_destroy(struct cvora_pyramid *p)
+{
+	free(p->mem);
+	free(p->lv);
+	free(p);
+}
+
+void cvora_pyramid_reset(struct cvora_pyramid *p)
+{
+	int c, k;
+
+	for (c = 0; c < p->nchans; c++)
+		for (k = 0; k < p->levels; k++)
+			p->lv[c][k].n = 0;
+}
+
+int cvora_pyramid_update(struct cvora_pyramid *p, int mode,
+			 unsigned int chans, const unsigned int *buf,
+			 int bytes, int offset)
+{
+	int width, n, c, cc;
+
+	n = cvora_mode_channels(mode, chans, &width);
+	if (bytes < 0 || offset < 0 || n > p->nchans)
+		return -EINVAL;
+	if (width == 16)
+		cc = append16(p, buf, bytes / 4, n);
+	else
+		cc = append32(p, buf, bytes / 4, n, offset / 4 % n);
+	for (c = 0; c < n; c++)
+		build(p->lv[c], p->levels);
+	return cc;
+}
+
+int cvora_pyramid_samples(struct cvora_pyramid *p, int chan)
+{
+	if (chan < 0 || chan >= p->nchans)
+		return -EINVAL;
+	return p->lv[chan][0].n;
+}
+
+int cvora_pyramid_envelope(struct cvora_pyramid *p, int chan, int first,
+			   int count, int width, int64_t *min, int64_t *max)
+{
+	struct level *lv;
+	uint32_t mn, mx;
+	int64_t a, b;
+	int i;
+
+	if (chan < 0 || chan >= p->nchans || first < 0 || count < 0 ||
+	    width <= 0)
+		return -EINVAL;
+	lv = p->lv[chan];
+	if (first > lv[0].n)
+		first = lv[0].n;
+	if (count > lv[0].n - first)
+		count = lv[0].n - first;
+	if (width > count)
+		width = count;
+
+	for (i = 0; i < width; i++) {
+		a = first + (int64_t)count * i / width;
+		b = first + (int64_t)count * (i + 1) / width;
+		range(lv, p->levels, a, b, &mn, &mx);
+		min[i] = unbias(mn, p->flags);
+		max[i] = unbias(mx, p->flags);
+	}
+	return width;
+}
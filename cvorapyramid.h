@@ -0,0 +1,98 @@
+/**
+ * Min/max decimation pyramid for cvora displays
+ *
+ * The samples of each channel are kept with their min/max envelope at
+ * decimation factors 2, 4, 8 and so on, down to a display width, built
+ * as the samples are decoded. The envelope of any sample range at any
+ * resolution then costs a few entries per point instead of a pass over
+ * the samples, so zooming stays interactive and displays get one
+ * min/max pair per pixel column.
+ *
+ * Channels follow the memory layout of the mode, as cvora_demux does.
+ */
+
+#ifndef _CVORAPYRAMID_H
+#define _CVORAPYRAMID_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** pyramid flags */
+#define CVORA_PYRAMID_SIGNED	0x1	/**< samples are two's complement */
+
+/** @cond */
+struct cvora_pyramid;
+/** @endcond */
+
+/**
+ * @brief create a pyramid
+ * @param nchans channels kept, see cvora_mode_channels
+ * @param maxsamples samples kept per channel, 0 for a whole memory of
+ *	  16 bit samples
+ * @param width entries of the coarsest level at most, the display width
+ * @param flags CVORA_PYRAMID_SIGNED
+ * @return the pyramid, or NULL with errno set if error
+ */
+struct cvora_pyramid *cvora_pyramid_create(int nchans, int maxsamples,
+					   int width, int flags);
+
+/**
+ * @brief destroy a pyramid
+ * @param p pyramid
+ */
+void cvora_pyramid_destroy(struct cvora_pyramid *p);
+
+/**
+ * @brief drop the samples of a pyramid, to start a new acquisition
+ * @param p pyramid
+ */
+void cvora_pyramid_reset(struct cvora_pyramid *p);
+
+/**
+ * @brief append samples to the channels of a pyramid
+ * Samples past maxsamples are dropped.
+ * @param p pyramid
+ * @param mode the mode the samples were acquired in, enum cvora_mode
+ * @param chans parallel channels mask, for the 32 bit modes
+ * @param buf samples, as returned by cvora_read_samples
+ * @param bytes sample bytes
+ * @param offset byte offset of buf in the sample memory, as
+ *	  cvora_stream_read returns it, 0 for a whole memory
+ * @return 0 if OK, -ENOSPC if samples were dropped, < 0 if error
+ */
+int cvora_pyramid_update(struct cvora_pyramid *p, int mode,
+			 unsigned int chans, const unsigned int *buf,
+			 int bytes, int offset);
+
+/**
+ * @brief samples of a channel in a pyramid
+ * @param p pyramid
+ * @param chan channel
+ * @return number of samples, or < 0 if error
+ */
+int cvora_pyramid_samples(struct cvora_pyramid *p, int chan);
+
+/**
+ * @brief envelope of a sample range
+ * The range is split into width buckets of equal size, or count buckets
+ * of one sample if fewer, and clipped to the samples of the channel.
+ * @param p pyramid
+ * @param chan channel
+ * @param first first sample
+ * @param count number of samples
+ * @param width number of buckets wanted
+ * @param min returned smallest sample of each bucket
+ * @param max returned largest sample of each bucket
+ * @return number of buckets filled, or < 0 if error
+ */
+int cvora_pyramid_envelope(struct cvora_pyramid *p, int chan, int first,
+			   int count, int width, int64_t *min, int64_t *max);
+
+#ifdef __cplusplus
+}
+#endif
+#endif	/* _CVORAPYRAMID_H */
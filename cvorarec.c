@@ -0,0 +1,384 @@
+/**
+ * Acquisition recorder for cvora, see cvorarec.h for the file format
+ *
+ * cvora_rec_append copies the acquisition into a queue slot laid out
+ * exactly as it goes on disk and returns. A writer thread writes the
+ * queued slots, several at a time, with O_DIRECT writevs from
+ * aligned memory, so the acquisition loop never waits on the disk.
+ *
+ * Appenders only reserve their slot and sequence number under the
+ * lock, and encode or copy into the slot outside it, so the threads
+ * of several modules fill slots at the same time. A filled slot is
+ * queued once every slot reserved before it is, keeping the file in
+ * sequence order.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "libcvora.h"
+#include "cvorarec.h"
+#include "cvoracodec.h"
+
+#define DEFAULT_QUEUE	64
+#define MAX_BATCH	16
+
+#define ALIGN_UP(x)	(((x) + CVORA_REC_ALIGN - 1) & \
+			 ~(uint64_t)(CVORA_REC_ALIGN - 1))
+#define SLOT_SIZE	ALIGN_UP(sizeof(struct cvora_rec_header) + \
+				 CVORA_CODEC_BOUND(CVORA_MEM_SIZE))
+
+struct cvora_recorder {
+	int			fd;
+	int			flags;
+	int			nslots;
+	char			*slots;		/* nslots of SLOT_SIZE */
+
+	pthread_mutex_t		lock;		/* protects what follows */
+	pthread_cond_t		queued;		/* head moved or closing */
+	pthread_cond_t		room;		/* tail moved */
+	uint64_t		sequence;	/* next record number */
+	char			*filled;	/* per slot, reserved and filled */
+	unsigned long		reserved;	/* slots handed to appenders */
+	unsigned long		head;		/* slots queued */
+	unsigned long		tail;		/* slots written */
+	int			closing;
+	struct cvora_rec_stats	stats;
+
+	pthread_t		thread;		/* writer, owns what follows */
+	uint64_t		offset;		/* file offset of next record */
+	struct cvora_rec_index	*index;
+	uint64_t		index_count;
+	uint64_t		index_size;
+	int			no_index;	/* out of memory for it */
+};
+
+static struct cvora_rec_header *slot(struct cvora_recorder *rec,
+				     unsigned long n)
+{
+	return (void *)(rec->slots + (n % rec->nslots) * SLOT_SIZE);
+}
+
+static int writev_all(int fd, struct iovec *iov, int cnt)
+{
+	ssize_t n;
+
+	while (cnt > 0) {
+		n = writev(fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		while (cnt > 0 && n >= (ssize_t)iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static void add_index(struct cvora_recorder *rec,
+		      struct cvora_rec_header *hdr)
+{
+	struct cvora_rec_index *ix;
+
+	if (rec->no_index)
+		return;
+	if (rec->index_count == rec->index_size) {
+		uint64_t size = rec->index_size ? rec->index_size * 2 : 1024;
+
+		ix = realloc(rec->index, size * sizeof(*ix));
+		if (!ix) {
+			free(rec->index);	/* the file can be scanned */
+			rec->index = NULL;
+			rec->no_index = 1;
+			return;
+		}
+		rec->index = ix;
+		rec->index_size = size;
+	}
+	ix = &rec->index[rec->index_count++];
+	ix->sequence = hdr->sequence;
+	ix->offset = rec->offset;
+	ix->isr_sec = hdr->isr_sec;
+	ix->isr_nsec = hdr->isr_nsec;
+	ix->lun = hdr->lun;
+	ix->bytes = hdr->bytes;
+}
+
+static void *writer(void *arg)
+{
+	struct cvora_recorder *rec = arg;
+	struct iovec iov[MAX_BATCH];
+	struct cvora_rec_header *hdr;
+	unsigned long first, n, i;
+	uint64_t bytes;
+	int cc;
+
+	for (;;) {
+		pthread_mutex_lock(&rec->lock);
+		while (rec->tail == rec->head && !rec->closing)
+			pthread_cond_wait(&rec->queued, &rec->lock);
+		first = rec->tail;
+		n = rec->head - first;
+		pthread_mutex_unlock(&rec->lock);
+		if (n == 0)
+			break;		/* closing and drained */
+		if (n > MAX_BATCH)
+			n = MAX_BATCH;
+
+		for (i = 0, bytes = 0; i < n; i++) {
+			hdr = slot(rec, first + i);
+			iov[i].iov_base = hdr;
+			iov[i].iov_len = hdr->record_size;
+			add_index(rec, hdr);
+			rec->offset += hdr->record_size;
+			bytes += hdr->record_size;
+		}
+		cc = writev_all(rec->fd, iov, n);
+
+		pthread_mutex_lock(&rec->lock);
+		rec->tail += n;
+		if (cc == 0) {
+			rec->stats.written += n;
+			rec->stats.bytes += bytes;
+		} else if (!rec->stats.error)
+			rec->stats.error = -cc;
+		pthread_cond_broadcast(&rec->room);
+		pthread_mutex_unlock(&rec->lock);
+	}
+	return NULL;
+}
+
+/* ==================== */
+
+static int write_file_header(struct cvora_recorder *rec)
+{
+	struct cvora_rec_file *fh;
+	ssize_t n;
+
+	if (posix_memalign((void **)&fh, CVORA_REC_ALIGN, CVORA_REC_ALIGN))
+		return -ENOMEM;
+	memset(fh, 0, CVORA_REC_ALIGN);
+	memcpy(fh->magic, CVORA_REC_MAGIC, sizeof(fh->magic));
+	fh->version = CVORA_REC_VERSION;
+	fh->align = CVORA_REC_ALIGN;
+	fh->created = time(NULL);
+	if (rec->index) {
+		fh->index_offset = rec->offset;
+		fh->index_count = rec->index_count;
+	}
+	n = pwrite(rec->fd, fh, CVORA_REC_ALIGN, 0);
+	free(fh);
+	if (n != CVORA_REC_ALIGN)
+		return n < 0 ? -errno : -EIO;
+	return 0;
+}
+
+static int write_index(struct cvora_recorder *rec)
+{
+	struct iovec iov;
+	uint64_t size;
+	void *buf;
+	int cc;
+
+	if (!rec->index)
+		return 0;
+	size = rec->index_count * sizeof(*rec->index);
+	if (posix_memalign(&buf, CVORA_REC_ALIGN, ALIGN_UP(size)))
+		return -ENOMEM;
+	memset(buf, 0, ALIGN_UP(size));
+	memcpy(buf, rec->index, size);
+	iov.iov_base = buf;
+	iov.iov_len = ALIGN_UP(size);
+	cc = writev_all(rec->fd, &iov, 1);
+	free(buf);
+	return cc;
+}
+
+struct cvora_recorder *cvora_rec_open(const char *path, int queue_size,
+				      int flags)
+{
+	struct cvora_recorder *rec;
+	int cc;
+
+	if ((rec = calloc(1, sizeof(*rec))) == NULL)
+		return NULL;
+	rec->flags = flags;
+	rec->nslots = queue_size > 0 ? queue_size : DEFAULT_QUEUE;
+	rec->filled = calloc(rec->nslots, 1);
+	if (rec->filled == NULL || posix_memalign((void **)&rec->slots,
+						  CVORA_REC_ALIGN,
+						  rec->nslots * SLOT_SIZE)) {
+		free(rec->filled);
+		free(rec);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* Not every file system takes O_DIRECT */
+
+	rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if (rec->fd < 0 && errno == EINVAL)
+		rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (rec->fd < 0)
+		goto fail;
+
+	rec->offset = CVORA_REC_ALIGN;
+	if ((cc = write_file_header(rec)) != 0 ||
+	    lseek(rec->fd, rec->offset, SEEK_SET) < 0) {
+		errno = cc ? -cc : errno;
+		goto fail_fd;
+	}
+
+	pthread_mutex_init(&rec->lock, NULL);
+	pthread_cond_init(&rec->queued, NULL);
+	pthread_cond_init(&rec->room, NULL);
+	if ((cc = pthread_create(&rec->thread, NULL, writer, rec)) != 0) {
+		errno = cc;
+		goto fail_fd;
+	}
+	return rec;
+
+fail_fd:
+	close(rec->fd);
+fail:
+	cc = errno;
+	free(rec->slots);
+	free(rec->filled);
+	free(rec);
+	errno = cc;
+	return NULL;
+}
+
+int cvora_rec_append(struct cvora_recorder *rec,
+		     const struct cvora_rec_info *info,
+		     const unsigned int *buf, int bytes)
+{
+	struct cvora_rec_header *hdr;
+	unsigned long n;
+	uint64_t sequence;
+	uint32_t size;
+	int stored;
+
+	if (bytes < 0 || bytes > CVORA_MEM_SIZE)
+		return -EINVAL;
+
+	pthread_mutex_lock(&rec->lock);
+	while (rec->reserved - rec->tail == (unsigned long)rec->nslots) {
+		if (!(rec->flags & CVORA_REC_BLOCK)) {
+			rec->stats.dropped++;
+			pthread_mutex_unlock(&rec->lock);
+			return -EAGAIN;
+		}
+		pthread_cond_wait(&rec->room, &rec->lock);
+	}
+	n = rec->reserved++;
+	sequence = rec->sequence++;
+	pthread_mutex_unlock(&rec->lock);
+
+	/* The slot is ours until head moves past it, no lock to fill it */
+
+	hdr = slot(rec, n);
+
+	/* Keep the samples raw if they would not encode */
+
+	memset(hdr, 0, sizeof(*hdr));
+	if (rec->flags & CVORA_REC_COMPRESS &&
+	    cvora_encode(info->mode, info->channels, buf, bytes, hdr + 1,
+			 SLOT_SIZE - sizeof(*hdr), &stored) == 0 &&
+	    stored < bytes) {
+		hdr->codec = CVORA_CODEC_DELTA;
+	} else {
+		memcpy(hdr + 1, buf, bytes);
+		stored = bytes;
+	}
+	size = ALIGN_UP(sizeof(*hdr) + stored);
+	hdr->magic = CVORA_REC_HMAGIC;
+	hdr->header_size = sizeof(*hdr);
+	hdr->record_size = size;
+	hdr->bytes = stored;
+	hdr->sequence = sequence;
+	hdr->lun = info->lun;
+	hdr->mode = info->mode;
+	hdr->frequency = info->frequency;
+	hdr->channels = info->channels;
+	hdr->control = info->control;
+	hdr->count = info->count;
+	hdr->isr_sec = info->isr_sec;
+	hdr->isr_nsec = info->isr_nsec;
+	if (info->control & (1 << CVORA_COUNTER_OVERFLOW))
+		hdr->flags |= CVORA_REC_COUNTER_OVERFLOW;
+	if (info->control & (1 << CVORA_RAM_OVERFLOW))
+		hdr->flags |= CVORA_REC_RAM_OVERFLOW;
+	memset((char *)(hdr + 1) + stored, 0, size - sizeof(*hdr) - stored);
+
+	/* Queue it with the filled slots that follow, if it was next */
+
+	pthread_mutex_lock(&rec->lock);
+	rec->filled[n % rec->nslots] = 1;
+	rec->stats.appended++;
+	if (n == rec->head) {
+		while (rec->head != rec->reserved &&
+		       rec->filled[rec->head % rec->nslots])
+			rec->filled[rec->head++ % rec->nslots] = 0;
+		pthread_cond_signal(&rec->queued);
+	}
+	pthread_mutex_unlock(&rec->lock);
+	return 0;
+}
+
+int cvora_rec_get_stats(struct cvora_recorder *rec,
+			struct cvora_rec_stats *stats)
+{
+	pthread_mutex_lock(&rec->lock);
+	*stats = rec->stats;
+	pthread_mutex_unlock(&rec->lock);
+	return 0;
+}
+
+int cvora_rec_close(struct cvora_recorder *rec)
+{
+	int cc;
+
+	pthread_mutex_lock(&rec->lock);
+	rec->closing = 1;
+	pthread_cond_signal(&rec->queued);
+	pthread_mutex_unlock(&rec->lock);
+	pthread_join(rec->thread, NULL);
+
+	cc = -rec->stats.error;
+	if (cc == 0)
+		cc = write_index(rec);
+	if (cc == 0)
+		cc = write_file_header(rec);
+	if (fdatasync(rec->fd) != 0 && cc == 0)
+		cc = -errno;
+	if (close(rec->fd) != 0 && cc == 0)
+		cc = -errno;
+
+	pthread_cond_destroy(&rec->room);
+	pthread_cond_destroy(&rec->queued);
+	pthread_mutex_destroy(&rec->lock);
+	free(rec->index);
+	free(rec->filled);
+	free(rec->slots);
+	free(rec);
+	return cc;
+}
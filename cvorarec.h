@@ -0,0 +1,275 @@
+/**
+ * Acquisition recorder for cvora
+ *
+ * A recording is a file of records, one per acquisition, each
+ * starting on a CVORA_REC_ALIGN boundary, followed by an index of
+ * all records. Integers are in host byte order, the magic tells
+ * which it was.
+ *
+ *	offset 0		struct cvora_rec_file, padded to ALIGN
+ *	first record		struct cvora_rec_header, then the samples
+ *				as returned by cvora_read_samples, padded
+ *	...
+ *	index_offset		index_count struct cvora_rec_index
+ *
+ * The index is written when the recorder is closed, a file whose
+ * index_offset is zero was not closed and can be scanned instead.
+ */
+
+#ifndef _CVORAREC_H
+#define _CVORAREC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @cond */
+#define CVORA_REC_MAGIC		"CVORAREC"
+#define CVORA_REC_VERSION	1
+#define CVORA_REC_ALIGN		4096
+#define CVORA_REC_HMAGIC	0x52525643	/* "CVRR" */
+/** @endcond */
+
+/** record flags */
+#define CVORA_REC_COUNTER_OVERFLOW	0x1	/**< sample counter overflowed */
+#define CVORA_REC_RAM_OVERFLOW		0x2	/**< sample memory overflowed */
+
+/** recorder open flags */
+#define CVORA_REC_BLOCK		0x1	/**< wait for room, never drop */
+#define CVORA_REC_COMPRESS	0x2	/**< encode samples, see cvoracodec.h */
+
+/**
+ * File header, at offset 0
+ */
+struct cvora_rec_file {
+	char		magic[8];	/**< CVORA_REC_MAGIC */
+	uint32_t	version;	/**< CVORA_REC_VERSION */
+	uint32_t	align;		/**< record alignment */
+	uint64_t	index_offset;	/**< 0 if not closed */
+	uint64_t	index_count;	/**< records in index */
+	int64_t		created;	/**< seconds since the epoch */
+};
+
+/**
+ * Record header, followed by bytes of samples
+ */
+struct cvora_rec_header {
+	uint32_t	magic;		/**< CVORA_REC_HMAGIC */
+	uint32_t	header_size;	/**< sizeof(struct cvora_rec_header) */
+	uint32_t	record_size;	/**< header, samples and padding */
+	uint32_t	bytes;		/**< sample bytes, as stored */
+	uint64_t	sequence;	/**< record number in the file */
+	int32_t		lun;		/**< logical unit number */
+	int32_t		mode;		/**< enum cvora_mode */
+	uint32_t	frequency;	/**< clock frequency register */
+	uint32_t	channels;	/**< parallel channels mask */
+	uint32_t	control;	/**< control/status register */
+	uint32_t	flags;		/**< CVORA_REC_xxx_OVERFLOW */
+	uint32_t	count;		/**< interrupt counter */
+	uint32_t	codec;		/**< sample encoding, CVORA_CODEC_xxx */
+	int64_t		isr_sec;	/**< interrupt time */
+	int64_t		isr_nsec;
+};
+
+/**
+ * Index entry, one per record
+ */
+struct cvora_rec_index {
+	uint64_t	sequence;	/**< record number */
+	uint64_t	offset;		/**< file offset of the record */
+	int64_t		isr_sec;	/**< interrupt time */
+	int64_t		isr_nsec;
+	int32_t		lun;		/**< logical unit number */
+	uint32_t	bytes;		/**< sample bytes, as stored */
+};
+
+/**
+ * Acquisition description given to cvora_rec_append
+ */
+struct cvora_rec_info {
+	int		lun;		/**< logical unit number */
+	int		mode;		/**< enum cvora_mode */
+	unsigned int	frequency;	/**< clock frequency register */
+	unsigned int	channels;	/**< parallel channels mask */
+	unsigned int	control;	/**< control/status register */
+	unsigned int	count;		/**< interrupt counter */
+	long		isr_sec;	/**< interrupt time */
+	long		isr_nsec;
+};
+
+/**
+ * Recorder counters
+ */
+struct cvora_rec_stats {
+	unsigned long	appended;	/**< records queued */
+	unsigned long	written;	/**< records on disk */
+	unsigned long	dropped;	/**< records lost, queue full */
+	uint64_t	bytes;		/**< bytes written */
+	int		error;		/**< first write errno, 0 if none */
+};
+
+struct cvora_recorder;
+
+/**
+ * @brief create a recording and start its writer thread
+ * Records are copied into a queue of queue_size records and written
+ * by the thread with large aligned O_DIRECT writes.
+ * @param path file to create, truncated if it exists
+ * @param queue_size records the queue holds, 0 for the default of 64
+ * @param flags CVORA_REC_BLOCK to wait for room rather than drop,
+ * CVORA_REC_COMPRESS to encode the samples as they are queued
+ * @return recorder, or NULL with errno set if error
+ */
+struct cvora_recorder *cvora_rec_open(const char *path, int queue_size,
+				      int flags);
+
+/**
+ * @brief queue an acquisition for writing
+ * Returns at once unless CVORA_REC_BLOCK was given and the queue is full.
+ * @param rec recorder returned by cvora_rec_open
+ * @param info acquisition description
+ * @param buf samples, as returned by cvora_read_samples
+ * @param bytes sample bytes, at most CVORA_MEM_SIZE
+ * @return 0 if OK, < 0 if error, -EAGAIN if dropped
+ */
+int cvora_rec_append(struct cvora_recorder *rec,
+		     const struct cvora_rec_info *info,
+		     const unsigned int *buf, int bytes);
+
+/**
+ * @brief get the recorder counters
+ * @param rec recorder returned by cvora_rec_open
+ * @param stats returned counters
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_rec_get_stats(struct cvora_recorder *rec,
+			struct cvora_rec_stats *stats);
+
+/**
+ * @brief write what is queued, the index, and close the recording
+ * @param rec recorder returned by cvora_rec_open
+ * @return 0 if OK, < 0 if a write failed
+ */
+int cvora_rec_close(struct cvora_recorder *rec);
+
+/* ==================== */
+
+/**
+ * Archive query, records matching all given conditions
+ */
+struct cvora_arc_query {
+	int		lun;		/**< logical unit, < 0 any */
+	int64_t		from_sec;	/**< interrupt time from, inclusive */
+	int64_t		from_nsec;
+	int64_t		to_sec;		/**< interrupt time to, exclusive, */
+	int64_t		to_nsec;	/**< 0 and 0 for no limit */
+	uint64_t	first_seq;	/**< sequence from, inclusive */
+	uint64_t	last_seq;	/**< sequence to, inclusive, 0 no limit */
+};
+
+/**
+ * Called for every record found. hdr and samples point into the
+ * mapped file and are only valid during the call, samples are in the
+ * record's codec, see cvora_arc_samples. Return > 0 to stop the
+ * query, < 0 to stop it and have it return that error.
+ */
+typedef int (*cvora_arc_fn)(const struct cvora_rec_header *hdr,
+			    const void *samples, void *arg);
+
+struct cvora_archive;
+
+/**
+ * @brief open a recording for reading
+ * The index is mapped, or rebuilt by scanning if the recording was
+ * not closed. Records are only mapped when a query reaches them.
+ * @param path recording file
+ * @return archive, or NULL with errno set if error
+ */
+struct cvora_archive *cvora_arc_open(const char *path);
+
+/**
+ * @brief close a recording
+ * @param arc archive returned by cvora_arc_open
+ */
+void cvora_arc_close(struct cvora_archive *arc);
+
+/**
+ * @brief number of records in a recording
+ * @param arc archive returned by cvora_arc_open
+ * @return record count
+ */
+uint64_t cvora_arc_count(struct cvora_archive *arc);
+
+/**
+ * @brief index entry of a record, in file order
+ * @param arc archive returned by cvora_arc_open
+ * @param i record 0..count-1
+ * @return index entry, NULL if out of range
+ */
+const struct cvora_rec_index *cvora_arc_index(struct cvora_archive *arc,
+					      uint64_t i);
+
+/**
+ * @brief call fn with one record, in file order
+ * @param arc archive returned by cvora_arc_open
+ * @param i record 0..count-1
+ * @param fn called with the record
+ * @param arg passed to fn
+ * @return fn's value, < 0 if error
+ */
+int cvora_arc_visit(struct cvora_archive *arc, uint64_t i,
+		    cvora_arc_fn fn, void *arg);
+
+/**
+ * @brief call fn for each record matching a query
+ * Records are found with the index by binary search, a lun's records
+ * come in time order, one lun after the other.
+ * @param arc archive returned by cvora_arc_open
+ * @param q query
+ * @param fn called with each record
+ * @param arg passed to fn
+ * @return records passed to fn, < 0 if error
+ */
+int cvora_arc_query(struct cvora_archive *arc,
+		    const struct cvora_arc_query *q,
+		    cvora_arc_fn fn, void *arg);
+
+/**
+ * @brief query several recordings in parallel
+ * Each file is opened and queried by one of threads threads, so fn
+ * must be thread safe.
+ * @param paths recording files
+ * @param nfiles number of files
+ * @param threads threads to use, 0 for one per file
+ * @param q query
+ * @param fn called with each record
+ * @param arg passed to fn
+ * @return records passed to fn, < 0 if a file could not be read
+ */
+int cvora_arc_query_files(const char **paths, int nfiles, int threads,
+			  const struct cvora_arc_query *q,
+			  cvora_arc_fn fn, void *arg);
+
+/**
+ * @brief get the samples of a record
+ * Samples are returned as cvora_read_samples returns them, decoding
+ * them if the record was encoded. Encoded records are only decoded
+ * whole, CVORA_MEM_SIZE is always enough for them.
+ * @param hdr record header passed to a cvora_arc_fn
+ * @param samples samples passed to a cvora_arc_fn
+ * @param maxsz max byte size to return
+ * @param actsz actual byte size returned
+ * @param buf pointer to data area
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_arc_samples(const struct cvora_rec_header *hdr,
+		      const void *samples, int maxsz, int *actsz,
+		      unsigned int *buf);
+
+#ifdef __cplusplus
+}
+#endif
+#endif	/* _CVORAREC_H */
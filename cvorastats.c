@@ -0,0 +1,356 @@
+/**
+ * Per channel sample statistics for cvora, see cvorastats.h
+ *
+ * The kernels are inlined once per layout and signedness so the
+ * compiler sees constant widths and bounds and vectorizes the loops.
+ * They run over blocks small enough for 32 bit partial sums of 16 bit
+ * samples, folded into the channel statistics after each block.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "libcvora.h"
+#include "cvorastats.h"
+
+#define BLOCK		4096		/* words */
+#define MAX_CHANS	32
+#define LANES		16
+
+#define INLINE		static inline __attribute__((always_inline))
+
+struct cvora_stats_window {
+	int			cycles;		/* kept */
+	int			nchans;
+	int			count;		/* cycles in the window */
+	int			next;		/* slot of the next cycle */
+	struct cvora_stats	*ring;		/* cycles * nchans */
+};
+
+static void finish(struct cvora_stats *st, int n)
+{
+	double var;
+	int c;
+
+	for (c = 0; c < n; c++, st++) {
+		if (st->count == 0) {
+			st->mean = st->rms = st->stddev = 0;
+			continue;
+		}
+		st->mean = st->sum / st->count;
+		st->rms = sqrt(st->sumsq / st->count);
+		var = st->sumsq / st->count - st->mean * st->mean;
+		st->stddev = var > 0 ? sqrt(var) : 0;
+	}
+}
+
+static void add_one(struct cvora_stats *st, int64_t v, int64_t bot,
+		    int64_t top)
+{
+	st->count++;
+	if (v < st->min)
+		st->min = v;
+	if (v > st->max)
+		st->max = v;
+	st->sum += v;
+	st->sumsq += (double)v * v;
+	st->overflows += v == bot || v == top;
+}
+
+static void accumulate(struct cvora_stats *to,
+		       const struct cvora_stats *from, int n)
+{
+	int c;
+
+	for (c = 0; c < n; c++) {
+		to[c].count += from[c].count;
+		if (from[c].min < to[c].min)
+			to[c].min = from[c].min;
+		if (from[c].max > to[c].max)
+			to[c].max = from[c].max;
+		to[c].sum += from[c].sum;
+		to[c].sumsq += from[c].sumsq;
+		to[c].overflows += from[c].overflows;
+	}
+}
+
+/* ==================== */
+
+/*
+ * 16 bit samples, high halves to hi and low halves to lo, which are
+ * the same channel in the single input modes
+ */
+
+INLINE void kernel16(const uint32_t *w, int n, const int sgn,
+		     struct cvora_stats *hi, struct cvora_stats *lo)
+{
+	const int32_t bot = sgn ? -32768 : 0, top = sgn ? 32767 : 65535;
+	int32_t mnh = top, mxh = bot, mnl = top, mxl = bot, sh = 0, sl = 0;
+	uint64_t qh = 0, ql = 0;
+	uint32_t oh = 0, ol = 0;
+	int32_t a, b;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		a = sgn ? (int16_t)(w[i] >> 16) : (int32_t)(w[i] >> 16);
+		b = sgn ? (int16_t)w[i] : (int32_t)(w[i] & 0xffff);
+		mnh = a < mnh ? a : mnh;
+		mxh = a > mxh ? a : mxh;
+		mnl = b < mnl ? b : mnl;
+		mxl = b > mxl ? b : mxl;
+		sh += a;
+		sl += b;
+		qh += (uint32_t)a * (uint32_t)a;
+		ql += (uint32_t)b * (uint32_t)b;
+		oh += (a == bot) | (a == top);
+		ol += (b == bot) | (b == top);
+	}
+
+	hi->count += n;
+	hi->min = mnh < hi->min ? mnh : hi->min;
+	hi->max = mxh > hi->max ? mxh : hi->max;
+	hi->sum += sh;
+	hi->sumsq += qh;
+	hi->overflows += oh;
+	lo->count += n;
+	lo->min = mnl < lo->min ? mnl : lo->min;
+	lo->max = mxl > lo->max ? mxl : lo->max;
+	lo->sum += sl;
+	lo->sumsq += ql;
+	lo->overflows += ol;
+}
+
+/*
+ * 32 bit samples. Flipping the sign bit of signed samples keeps their
+ * order as unsigned, so min, max and the full scale test are unsigned
+ * compares whatever the signedness.
+ */
+
+#define BIAS(sgn)	((sgn) ? 0x80000000U : 0)
+
+static int64_t unbias(uint32_t u, int sgn)
+{
+	return sgn ? (int64_t)(int32_t)(u ^ BIAS(sgn)) : (int64_t)u;
+}
+
+/*
+ * A sample as a double, converted from int32 which vectorizes where
+ * int64 and uint32 conversions do not
+ */
+
+INLINE double dbl(uint32_t x, int sgn)
+{
+	return sgn ? (double)(int32_t)x :
+		     (double)(int32_t)(x ^ 0x80000000U) + 2147483648.0;
+}
+
+INLINE void fold32(struct cvora_stats *st, int n, int sgn, uint32_t mn,
+		   uint32_t mx, int64_t s, double q, uint32_t ov)
+{
+	st->count += n;
+	if (unbias(mn, sgn) < st->min)
+		st->min = unbias(mn, sgn);
+	if (unbias(mx, sgn) > st->max)
+		st->max = unbias(mx, sgn);
+	st->sum += s;
+	st->sumsq += q;
+	st->overflows += ov;
+}
+
+/*
+ * Sets of nc words holding one sample of each channel
+ */
+
+INLINE void kernel32(const uint32_t *w, int sets, int nc, const int sgn,
+		     struct cvora_stats *st)
+{
+	uint32_t mn[MAX_CHANS], mx[MAX_CHANS], ov[MAX_CHANS], u;
+	int64_t s[MAX_CHANS], v;
+	double q[MAX_CHANS];
+	int i, c;
+
+	for (c = 0; c < nc; c++) {
+		mn[c] = ~0U;
+		mx[c] = 0;
+		s[c] = 0;
+		q[c] = 0;
+		ov[c] = 0;
+	}
+	for (i = 0; i < sets; i++, w += nc) {
+		for (c = 0; c < nc; c++) {
+			u = w[c] ^ BIAS(sgn);
+			v = sgn ? (int64_t)(int32_t)w[c] : (int64_t)w[c];
+			mn[c] = u < mn[c] ? u : mn[c];
+			mx[c] = u > mx[c] ? u : mx[c];
+			s[c] += v;
+			q[c] += dbl(w[c], sgn) * dbl(w[c], sgn);
+			ov[c] += (u == 0) | (u == ~0U);
+		}
+	}
+	for (c = 0; c < nc; c++)
+		fold32(&st[c], sets, sgn, mn[c], mx[c], s[c], q[c], ov[c]);
+}
+
+/*
+ * One channel, taken as LANES interleaved ones so the sums spread
+ * over independent accumulators, the double ones not being reordered
+ * by the compiler otherwise
+ */
+
+static void kernel32_1(const uint32_t *w, int n, int sgn,
+		       struct cvora_stats *st)
+{
+	struct cvora_stats lanes[LANES];
+	int i, sets = n / LANES;
+
+	cvora_stats_reset(lanes, LANES);
+	if (sgn)
+		kernel32(w, sets, LANES, 1, lanes);
+	else
+		kernel32(w, sets, LANES, 0, lanes);
+	accumulate(st, lanes, 1);
+	for (i = 1; i < LANES; i++)
+		accumulate(st, &lanes[i], 1);
+	for (i = sets * LANES; i < n; i++)
+		add_one(st, sgn ? (int32_t)w[i] : (int64_t)w[i],
+			sgn ? -2147483647LL - 1 : 0,
+			sgn ? 2147483647LL : 4294967295LL);
+}
+
+static void update16(const uint32_t *w, int words, int n, int sgn,
+		     struct cvora_stats *st)
+{
+	struct cvora_stats *lo = n == 2 ? &st[1] : &st[0];
+	int i, m;
+
+	for (i = 0; i < words; i += m) {
+		m = words - i < BLOCK ? words - i : BLOCK;
+		if (sgn)
+			kernel16(w + i, m, 1, &st[0], lo);
+		else
+			kernel16(w + i, m, 0, &st[0], lo);
+	}
+}
+
+static void update32(const uint32_t *w, int words, int n, int phase,
+		     int sgn, struct cvora_stats *st)
+{
+	const int64_t bot = sgn ? -2147483647LL - 1 : 0;
+	const int64_t top = sgn ? 2147483647LL : 4294967295LL;
+	int i = 0, sets, m;
+
+	/* Words up to the first of channel 0 */
+
+	for (; phase && i < words; i++, phase = (phase + 1) % n)
+		add_one(&st[phase], sgn ? (int32_t)w[i] : (int64_t)w[i],
+			bot, top);
+
+	for (sets = (words - i) / n; sets > 0; sets -= m, i += m * n) {
+		m = sets < BLOCK / n ? sets : BLOCK / n;
+		if (n == 1)
+			kernel32_1(w + i, m, sgn, st);
+		else if (sgn)
+			kernel32(w + i, m, n, 1, st);
+		else
+			kernel32(w + i, m, n, 0, st);
+	}
+
+	for (phase = 0; i < words; i++, phase++)
+		add_one(&st[phase], sgn ? (int32_t)w[i] : (int64_t)w[i],
+			bot, top);
+}
+
+/* ==================== */
+
+void cvora_stats_reset(struct cvora_stats *st, int n)
+{
+	int c;
+
+	memset(st, 0, n * sizeof(*st));
+	for (c = 0; c < n; c++) {
+		st[c].min = INT64_MAX;
+		st[c].max = INT64_MIN;
+	}
+}
+
+int cvora_stats_update(int mode, unsigned int chans, int flags,
+		       const unsigned int *buf, int bytes, int offset,
+		       struct cvora_stats *st, int maxchans)
+{
+	int width, n, sgn = flags & CVORA_STATS_SIGNED;
+
+	n = cvora_mode_channels(mode, chans, &width);
+	if (bytes < 0 || offset < 0 || n > maxchans || n > MAX_CHANS)
+		return -EINVAL;
+	if (width == 16)
+		update16(buf, bytes / 4, n, sgn, st);
+	else
+		update32(buf, bytes / 4, n, offset / 4 % n, sgn, st);
+	finish(st, n);
+	return 0;
+}
+
+void cvora_stats_merge(struct cvora_stats *to,
+		       const struct cvora_stats *from, int n)
+{
+	accumulate(to, from, n);
+	finish(to, n);
+}
+
+/* ==================== */
+
+struct cvora_stats_window *cvora_stats_window_create(int cycles,
+						     int nchans)
+{
+	struct cvora_stats_window *w;
+
+	if (cycles <= 0 || nchans <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((w = calloc(1, sizeof(*w))) == NULL)
+		return NULL;
+	w->ring = malloc((size_t)cycles * nchans * sizeof(*w->ring));
+	if (w->ring == NULL) {
+		free(w);
+		return NULL;
+	}
+	w->cycles = cycles;
+	w->nchans = nchans;
+	return w;
+}
+
+void cvora_stats_window_destroy(struct cvora_stats_window *w)
+{
+	free(w->ring);
+	free(w);
+}
+
+int cvora_stats_window_add(struct cvora_stats_window *w,
+			   const struct cvora_stats *st)
+{
+	memcpy(&w->ring[w->next * w->nchans], st,
+	       w->nchans * sizeof(*st));
+	w->next = (w->next + 1) % w->cycles;
+	if (w->count < w->cycles)
+		w->count++;
+	return 0;
+}
+
+/*
+ * Summed again on each call, rather than kept as running totals, so
+ * min and max follow the cycles dropped and no rounding accumulates
+ */
+
+int cvora_stats_window_get(struct cvora_stats_window *w,
+			   struct cvora_stats *st)
+{
+	int i;
+
+	cvora_stats_reset(st, w->nchans);
+	for (i = 0; i < w->count; i++)
+		accumulate(st, &w->ring[i * w->nchans], w->nchans);
+	finish(st, w->nchans);
+	return w->count;
+}
@@ -0,0 +1,114 @@
+/**
+ * Per channel sample statistics for cvora
+ *
+ * One pass over the samples as cvora_read_samples returns them gives
+ * the count, min, max, mean, RMS and full scale samples of every
+ * channel, following the memory layout of the mode as cvora_demux
+ * does. Updates accumulate, so the chunks of cvora_stream_read can be
+ * fed as they come, and a window keeps the statistics of the last
+ * cycles for rolling figures.
+ */
+
+#ifndef _CVORASTATS_H
+#define _CVORASTATS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** statistics flags */
+#define CVORA_STATS_SIGNED	0x1	/**< samples are two's complement */
+
+/**
+ * Statistics of one channel
+ */
+struct cvora_stats {
+	uint64_t	count;		/**< samples */
+	int64_t		min;		/**< smallest sample */
+	int64_t		max;		/**< largest sample */
+	double		mean;		/**< mean */
+	double		rms;		/**< root mean square */
+	double		stddev;		/**< standard deviation */
+	uint64_t	overflows;	/**< samples at either end of the range */
+	double		sum;		/**< sum of the samples */
+	double		sumsq;		/**< sum of their squares */
+};
+
+/** @cond */
+struct cvora_stats_window;
+/** @endcond */
+
+/**
+ * @brief clear statistics
+ * @param st statistics of n channels
+ * @param n number of channels
+ */
+void cvora_stats_reset(struct cvora_stats *st, int n);
+
+/**
+ * @brief add samples to the statistics of their channels
+ * st holds one entry per channel, cvora_mode_channels of them.
+ * @param mode the mode the samples were acquired in, enum cvora_mode
+ * @param chans parallel channels mask, for the 32 bit modes
+ * @param flags CVORA_STATS_SIGNED
+ * @param buf samples, as returned by cvora_read_samples
+ * @param bytes sample bytes
+ * @param offset byte offset of buf in the sample memory, as
+ *	  cvora_stream_read returns it, 0 for a whole memory
+ * @param st channel statistics, updated
+ * @param maxchans entries in st
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_stats_update(int mode, unsigned int chans, int flags,
+		       const unsigned int *buf, int bytes, int offset,
+		       struct cvora_stats *st, int maxchans);
+
+/**
+ * @brief add statistics to others
+ * @param to statistics of n channels, updated
+ * @param from statistics of n channels
+ * @param n number of channels
+ */
+void cvora_stats_merge(struct cvora_stats *to,
+		       const struct cvora_stats *from, int n);
+
+/**
+ * @brief create a window over the statistics of the last cycles
+ * @param cycles cycles kept
+ * @param nchans channels per cycle
+ * @return the window, or NULL with errno set if error
+ */
+struct cvora_stats_window *cvora_stats_window_create(int cycles,
+						     int nchans);
+
+/**
+ * @brief destroy a window
+ * @param w window
+ */
+void cvora_stats_window_destroy(struct cvora_stats_window *w);
+
+/**
+ * @brief add the statistics of a cycle, dropping the oldest if full
+ * @param w window
+ * @param st statistics of the window's channels
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_stats_window_add(struct cvora_stats_window *w,
+			   const struct cvora_stats *st);
+
+/**
+ * @brief statistics of the cycles in a window
+ * @param w window
+ * @param st returned statistics of the window's channels
+ * @return number of cycles in the window
+ */
+int cvora_stats_window_get(struct cvora_stats_window *w,
+			   struct cvora_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+#endif	/* _CVORASTATS_H */
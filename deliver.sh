@@ -9,7 +9,9 @@ DRIVER=$DRIVER_NAME.ko
 INSTALL_SCRIPTS="install_$DRIVER_NAME.sh transfer2insmod.awk"
 
 LIBS=lib$DRIVER_NAME.L865.a
-HEADERS=lib$DRIVER_NAME.h
+HEADERS="lib$DRIVER_NAME.h lib$DRIVER_NAME.hpp ${DRIVER_NAME}async.h \
+	${DRIVER_NAME}rec.h ${DRIVER_NAME}codec.h ${DRIVER_NAME}stats.h \
+	${DRIVER_NAME}pyramid.h ${DRIVER_NAME}cal.h"
 
 DRIVER_PATH=/acc/dsc/$ACC/$CPU/$KVER/$DRIVER_NAME
 LIBRARY_PATH=/acc/local/$CPU/drv/$DRIVER_NAME
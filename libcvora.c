@@ -1,5 +1,7 @@
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -7,14 +9,467 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include "cvora.h"
 #include "libcvora.h"
+#include "cvorarec.h"
+
+static inline uint32_t swab32(uint32_t x)
+{
+	return (((x & 0x000000ff) << 24) |
+		((x & 0x0000ff00) <<  8) |
+		((x & 0x00ff0000) >>  8) |
+		((x & 0xff000000) >> 24));
+}
+
+/* ==================== */
+/* Replay of recordings */
+
+/*
+ * A replay stands in for the driver: cvora_replay_init returns a file
+ * descriptor on the recording, and the ioctl, read and mmap calls the
+ * library makes on it are served from the recorded cycles of one lun
+ * instead. The rest of the library does not know the difference.
+ */
+
+#define REPLAY_REGS	(CVORA_MEMORY / 4)
+
+struct replay {
+	int			fd;
+	int			lun;
+	double			speed;
+	int			flags;
+	struct cvora_archive	*arc;
+	uint64_t		*recs;		/* the lun's index entries */
+	uint64_t		nrecs;
+	uint64_t		next;		/* next cycle to deliver */
+
+	pthread_mutex_t		lock;		/* protects what follows */
+	int			loaded;		/* a cycle was delivered */
+	struct cvora_rec_header	hdr;		/* its header */
+	unsigned int		*mem;		/* its samples, host order */
+	int			memsz;
+	unsigned int		regs[REPLAY_REGS];
+	int			timeout_us;
+	struct timespec		start;		/* pace origin */
+	int64_t			t0;		/* record time at start */
+	struct vmeio_status_page_s *page;
+};
+
+static pthread_mutex_t replays_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct replay **replays;
+static int nreplays;
+
+/*
+ * nreplays changes under replays_lock. A module fd is never a replay,
+ * so it is looked up without the lock while there are none: the load
+ * and the barrier pair with the unlock that published a replay, which
+ * happened before its fd could reach another thread.
+ */
+
+static int replaying(void)
+{
+	int n = *(volatile int *)&nreplays;
+
+	__sync_synchronize();
+	return n;
+}
+
+static struct replay *replay_find(int fd)
+{
+	struct replay *r = NULL;
+	int i;
+
+	if (!replaying())
+		return NULL;		/* the usual case, no locking */
+	pthread_mutex_lock(&replays_lock);
+	for (i = 0; i < nreplays; i++)
+		if (replays[i]->fd == fd)
+			r = replays[i];
+	pthread_mutex_unlock(&replays_lock);
+	return r;
+}
+
+static int replay_page(const void *page)
+{
+	int i, found = 0;
+
+	pthread_mutex_lock(&replays_lock);
+	for (i = 0; i < nreplays; i++)
+		if (replays[i]->page == page)
+			found = 1;
+	pthread_mutex_unlock(&replays_lock);
+	return found;
+}
+
+static int64_t ts_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static int replay_load(const struct cvora_rec_header *hdr,
+		       const void *samples, void *arg)
+{
+	struct replay *r = arg;
+	int cc;
+
+	if ((cc = cvora_arc_samples(hdr, samples, CVORA_MEM_SIZE,
+				    &r->memsz, r->mem)) != 0)
+		return cc;
+	r->hdr = *hdr;
+	return 1;
+}
+
+/*
+ * Make cycle n the current one, as the driver would on its interrupt
+ */
+
+static int replay_deliver(struct replay *r, uint64_t n)
+{
+	struct vmeio_status_page_s *st = r->page;
+	int cc;
+
+	if ((cc = cvora_arc_visit(r->arc, r->recs[n], replay_load, r)) < 0)
+		return cc;
+
+	r->loaded = 1;
+	r->regs[CVORA_CONTROL / 4] = r->hdr.control;
+	r->regs[CVORA_MEMORY_POINTER / 4] = CVORA_MEM_MIN + r->memsz;
+	r->regs[CVORA_MODE / 4] = r->hdr.mode;
+	r->regs[CVORA_CHANNEL / 4] = r->hdr.channels;
+	r->regs[CVORA_FREQUENCY / 4] = r->hdr.frequency;
+
+	st->seq++;
+	__sync_synchronize();
+	st->interrupt_count = r->hdr.count;
+	st->interrupt_mask = 1;
+	st->isr_sec = r->hdr.isr_sec;
+	st->isr_nsec = r->hdr.isr_nsec;
+	st->control = r->hdr.control;
+	st->memory_pointer = CVORA_MEM_MIN + r->memsz;
+	st->mode = r->hdr.mode;
+	st->frequency = r->hdr.frequency;
+	__sync_synchronize();
+	st->seq++;
+	return 0;
+}
+
+/*
+ * Wait for the next recorded cycle, paced by the recorded interrupt
+ * times divided by speed, and deliver it
+ */
+
+static int replay_wait(struct replay *r, int next, int icnt, int timeout,
+		       struct vmeio_read_buf_ext_s *ev)
+{
+	struct timespec now, due;
+	const struct cvora_rec_index *ix;
+	int64_t delay;
+	int cc = 0;
+
+	pthread_mutex_lock(&r->lock);
+	if (!next && r->loaded && icnt != (int)r->hdr.count)
+		goto done;		/* already past that count */
+	if (r->next >= r->nrecs) {
+		if (!(r->flags & CVORA_REPLAY_LOOP) || !r->nrecs) {
+			cc = -ENODATA;
+			goto out;
+		}
+		r->next = 0;
+		r->start.tv_sec = 0;	/* restart the pace */
+	}
+
+	ix = cvora_arc_index(r->arc, r->recs[r->next]);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (r->start.tv_sec == 0) {
+		r->start = now;
+		r->t0 = ix->isr_sec * 1000000000LL + ix->isr_nsec;
+	}
+	delay = 0;
+	if (r->speed > 0)
+		delay = ts_ns(&r->start) - ts_ns(&now) +
+			(ix->isr_sec * 1000000000LL + ix->isr_nsec - r->t0) /
+			r->speed;
+	if (timeout < 0)
+		timeout = r->timeout_us;
+	if (delay > 0) {
+		if (timeout > 0 && delay > timeout * 1000LL) {
+			delay = timeout * 1000LL;
+			cc = -ETIME;
+		}
+		due.tv_sec = (ts_ns(&now) + delay) / 1000000000LL;
+		due.tv_nsec = (ts_ns(&now) + delay) % 1000000000LL;
+		pthread_mutex_unlock(&r->lock);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &due, NULL) == EINTR)
+			;
+		pthread_mutex_lock(&r->lock);
+		if (cc) {
+			r->page->timeouts++;
+			goto out;
+		}
+	}
+	if ((cc = replay_deliver(r, r->next)) != 0)
+		goto out;
+	r->next++;
+
+done:
+	ev->logical_unit = r->lun;
+	ev->interrupt_mask = 1;
+	ev->interrupt_count = r->hdr.count;
+	ev->control = r->regs[CVORA_CONTROL / 4];
+	ev->memory_pointer = r->regs[CVORA_MEMORY_POINTER / 4];
+	ev->mode = r->regs[CVORA_MODE / 4];
+	ev->frequency = r->regs[CVORA_FREQUENCY / 4];
+out:
+	pthread_mutex_unlock(&r->lock);
+	return cc;
+}
+
+/*
+ * Registers read back what was recorded or last written, the memory
+ * reads back the samples big endian as the module holds them
+ */
+
+static int replay_rw(struct replay *r, struct vmeio_riob_s *riob, int write)
+{
+	uint32_t *buf = riob->buffer;
+	uint32_t word;
+	int i, off, n;
+
+	if (riob->winum != 1 || riob->offset < 0 || riob->bsize < 0 ||
+	    riob->offset & 3 || riob->offset + riob->bsize > CVORA_WINDOW)
+		return -EINVAL;
+
+	pthread_mutex_lock(&r->lock);
+	for (i = 0; i < (riob->bsize + 3) / 4; i++) {
+		off = riob->offset / 4 + i;
+		n = riob->bsize - i * 4 < 4 ? riob->bsize - i * 4 : 4;
+		if (write) {
+			word = 0;
+			memcpy(&word, &buf[i], n);
+			if (off < REPLAY_REGS)
+				r->regs[off] = word;
+			continue;
+		}
+		if (off < REPLAY_REGS)
+			word = r->regs[off];
+		else if (off - REPLAY_REGS < (r->memsz + 3) / 4)
+			word = swab32(r->mem[off - REPLAY_REGS]);
+		else
+			word = 0;
+		memcpy(&buf[i], &word, n);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return 0;
+}
+
+static int replay_ioctl(struct replay *r, unsigned long request, void *arg)
+{
+	struct vmeio_get_window_s *win;
+	struct vmeio_wait_s *w;
+	int cc;
+
+	switch (request) {
+	case VMEIO_RAW_READ:
+	case VMEIO_RAW_READ_DMA:
+		cc = replay_rw(r, arg, 0);
+		break;
+	case VMEIO_RAW_WRITE:
+	case VMEIO_RAW_WRITE_DMA:
+		cc = replay_rw(r, arg, 1);
+		break;
+	case VMEIO_WAIT:
+		w = arg;
+		cc = replay_wait(r, w->next, w->interrupt_count, w->timeout,
+				 &w->event);
+		break;
+	case VMEIO_SET_TIMEOUT:
+		r->timeout_us = *(int *)arg * 1000;
+		cc = 0;
+		break;
+	case VMEIO_GET_TIMEOUT:
+		*(int *)arg = r->timeout_us / 1000;
+		cc = 0;
+		break;
+	case VMEIO_SET_TIMEOUT_US:
+		r->timeout_us = *(int *)arg;
+		cc = 0;
+		break;
+	case VMEIO_GET_TIMEOUT_US:
+		*(int *)arg = r->timeout_us;
+		cc = 0;
+		break;
+	case VMEIO_GET_DEVICE:
+		win = arg;
+		memset(win, 0, sizeof(*win));
+		win->lun = r->lun;
+		win->amd1 = CVORA_AM;
+		win->dwd1 = CVORA_DWIDTH;
+		win->win1 = CVORA_WINDOW;
+		cc = 0;
+		break;
+	default:
+		cc = -ENOTTY;	/* no interrupts, DMA or streams to set up */
+		break;
+	}
+	if (cc < 0) {
+		errno = -cc;
+		return -1;
+	}
+	return 0;
+}
+
+static int replay_read(struct replay *r, void *buf, size_t count)
+{
+	struct vmeio_read_buf_ext_s ev;
+	int cc;
+
+	if (count < sizeof(struct vmeio_read_buf_s)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((cc = replay_wait(r, 1, 0, -1, &ev)) != 0) {
+		errno = -cc;
+		return -1;
+	}
+	if (count > sizeof(ev))
+		count = sizeof(ev);
+	if (count < sizeof(ev))
+		count = sizeof(struct vmeio_read_buf_s);
+	memcpy(buf, &ev, count);
+	return count;
+}
+
+static void replay_free(struct replay *r)
+{
+	if (r->page)
+		munmap(r->page, sizeof(*r->page));
+	if (r->arc)
+		cvora_arc_close(r->arc);
+	if (r->fd >= 0)
+		close(r->fd);
+	pthread_mutex_destroy(&r->lock);
+	free(r->recs);
+	free(r->mem);
+	free(r);
+}
+
+int cvora_replay_init(const char *path, int lun, double speed, int flags)
+{
+	const struct cvora_rec_index *ix;
+	struct replay *r, **tab;
+	uint64_t i, n;
+	void *page;
+
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return -1;
+	r->fd = -1;
+	r->lun = lun;
+	r->speed = speed;
+	r->flags = flags;
+	pthread_mutex_init(&r->lock, NULL);
+	page = mmap(NULL, sizeof(*r->page), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (page == MAP_FAILED)
+		goto fail;
+	r->page = page;
+	r->page->logical_unit = lun;
+	if ((r->mem = malloc(CVORA_MEM_SIZE)) == NULL)
+		goto fail;
+	if ((r->arc = cvora_arc_open(path)) == NULL ||
+	    (r->fd = open(path, O_RDONLY)) < 0)
+		goto fail;
+
+	/* A board's cycles are recorded in the order they happened */
+
+	n = cvora_arc_count(r->arc);
+	if ((r->recs = malloc((n ? n : 1) * sizeof(*r->recs))) == NULL)
+		goto fail;
+	for (i = 0; i < n; i++) {
+		ix = cvora_arc_index(r->arc, i);
+		if (ix->lun == lun)
+			r->recs[r->nrecs++] = i;
+	}
+	if (r->nrecs == 0) {
+		errno = ENODEV;
+		goto fail;
+	}
+
+	pthread_mutex_lock(&replays_lock);
+	tab = realloc(replays, (nreplays + 1) * sizeof(*tab));
+	if (tab) {
+		replays = tab;
+		replays[nreplays++] = r;
+	}
+	pthread_mutex_unlock(&replays_lock);
+	if (!tab)
+		goto fail;
+	return r->fd;
+
+fail:
+	fprintf(stderr, "Error:cvora_replay_init:"
+		"Can't replay lun %d from:%s\n", lun, path);
+	replay_free(r);
+	return -1;
+}
+
+static int replay_close(struct replay *r)
+{
+	int i;
+
+	pthread_mutex_lock(&replays_lock);
+	for (i = 0; i < nreplays; i++)
+		if (replays[i] == r)
+			replays[i] = replays[--nreplays];
+	pthread_mutex_unlock(&replays_lock);
+	replay_free(r);
+	return 0;
+}
+
+/*
+ * Every call the library makes on the device goes through these
+ */
+
+static int dev_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct replay *r = replay_find(fd);
+
+	if (r)
+		return replay_ioctl(r, request, arg);
+	return ioctl(fd, request, arg);
+}
+
+static int dev_read(int fd, void *buf, size_t count)
+{
+	struct replay *r = replay_find(fd);
+
+	if (r)
+		return replay_read(r, buf, count);
+	return read(fd, buf, count);
+}
+
+/* ==================== */
+
+/*
+ * CVORA_REPLAY names a recording to replay instead of opening the
+ * device, CVORA_REPLAY_SPEED and CVORA_REPLAY_LOOP set its pace and
+ * whether it starts over, so a whole application can run on one
+ */
 
 int cvora_init(int lun)
 {
 	char fname[256];
+	char *replay, *speed;
 	int fnum;
 
+	if ((replay = getenv("CVORA_REPLAY")) != NULL) {
+		speed = getenv("CVORA_REPLAY_SPEED");
+		return cvora_replay_init(replay, lun, speed ? atof(speed) : 1,
+					 getenv("CVORA_REPLAY_LOOP") ?
+					 CVORA_REPLAY_LOOP : 0);
+	}
+
 	sprintf(fname, "/dev/cvora.%d", lun);
 	if ((fnum = open(fname, O_RDWR, 0)) < 0)
 		fprintf(stderr, "Error:cvora_open:"
@@ -24,6 +479,10 @@ int cvora_init(int lun)
 
 int cvora_close(int fd)
 {
+	struct replay *r = replay_find(fd);
+
+	if (r)
+		return replay_close(r);
 	return close(fd);
 }
 
@@ -36,7 +495,7 @@ static int read_reg(int fd, unsigned offset, unsigned *value)
 	cb.bsize = sizeof(unsigned);
 	cb.buffer = value;
 
-	return ioctl(fd, VMEIO_RAW_READ, &cb);
+	return dev_ioctl(fd, VMEIO_RAW_READ, &cb);
 }
 
 
@@ -49,7 +508,17 @@ static int write_reg(int fd, unsigned offset, unsigned value)
 	cb.bsize = sizeof(unsigned);
 	cb.buffer = &value;
 
-	return ioctl(fd, VMEIO_RAW_WRITE, &cb);
+	return dev_ioctl(fd, VMEIO_RAW_WRITE, &cb);
+}
+
+int cvora_read_reg(int fd, unsigned int offset, unsigned int *value)
+{
+	return read_reg(fd, offset, value);
+}
+
+int cvora_write_reg(int fd, unsigned int offset, unsigned int value)
+{
+	return write_reg(fd, offset, value);
 }
 
 static int set_reg_bit(int fd, unsigned offset, unsigned bit,
@@ -146,19 +615,212 @@ int cvora_get_hardware_status(int fd, unsigned int *status)
 
 int cvora_set_timeout(int fd, int timeout)
 {
-	return ioctl(fd, VMEIO_SET_TIMEOUT, &timeout);
+	return dev_ioctl(fd, VMEIO_SET_TIMEOUT, &timeout);
 }
 
 int cvora_get_timeout(int fd, int *timeout)
 {
-	return ioctl(fd, VMEIO_GET_TIMEOUT, timeout);
+	return dev_ioctl(fd, VMEIO_GET_TIMEOUT, timeout);
+}
+
+int cvora_set_timeout_us(int fd, int timeout)
+{
+	return dev_ioctl(fd, VMEIO_SET_TIMEOUT_US, &timeout);
+}
+
+int cvora_get_timeout_us(int fd, int *timeout)
+{
+	return dev_ioctl(fd, VMEIO_GET_TIMEOUT_US, timeout);
 }
 
 int cvora_wait(int fd)
 {
 	struct vmeio_read_buf_s event;
 
-	return read(fd, &event, sizeof(event));
+	return dev_read(fd, &event, sizeof(event));
+}
+
+static void event_from_wait(struct cvora_event *ev,
+			    struct vmeio_read_buf_ext_s *event)
+{
+	ev->lun = event->logical_unit;
+	ev->mask = event->interrupt_mask;
+	ev->count = event->interrupt_count;
+	ev->control = event->control;
+	ev->memory_pointer = event->memory_pointer;
+	ev->mode = event->mode;
+	ev->frequency = event->frequency;
+}
+
+int cvora_wait_event(int fd, struct cvora_event *ev)
+{
+	struct vmeio_read_buf_ext_s event;
+	int cc;
+
+	cc = dev_read(fd, &event, sizeof(event));
+	if (cc < 0)
+		return cc;
+	if (cc != sizeof(event))
+		return -EIO;
+	event_from_wait(ev, &event);
+	return 0;
+}
+
+int cvora_wait_timeout(int fd, int timeout, struct cvora_event *ev)
+{
+	struct vmeio_wait_s wbuf;
+	int cc;
+
+	memset(&wbuf, 0, sizeof(wbuf));
+	wbuf.next = 1;
+	wbuf.timeout = timeout;
+	if ((cc = dev_ioctl(fd, VMEIO_WAIT, &wbuf)) != 0)
+		return cc;
+	if (ev)
+		event_from_wait(ev, &wbuf.event);
+	return 0;
+}
+
+int cvora_status_map(int fd, const void **page)
+{
+	struct replay *r = replay_find(fd);
+	void *map;
+
+	if (r) {
+		*page = r->page;	/* kept until cvora_close */
+		return 0;
+	}
+	map = mmap(NULL, sizeof(struct vmeio_status_page_s), PROT_READ,
+		   MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+	*page = map;
+	return 0;
+}
+
+int cvora_status_unmap(const void *page)
+{
+	if (replay_page(page))
+		return 0;
+	return munmap((void *)page, sizeof(struct vmeio_status_page_s));
+}
+
+int cvora_status_read(const void *page, struct cvora_status *status)
+{
+	const volatile struct vmeio_status_page_s *st = page;
+	unsigned int seq;
+
+	do {
+		while ((seq = st->seq) & 1)
+			;
+		__sync_synchronize();
+
+		status->lun = st->logical_unit;
+		status->count = st->interrupt_count;
+		status->mask = st->interrupt_mask;
+		status->isr_sec = st->isr_sec;
+		status->isr_nsec = st->isr_nsec;
+		status->control = st->control;
+		status->memory_pointer = st->memory_pointer;
+		status->mode = st->mode;
+		status->frequency = st->frequency;
+		status->bus_errors = st->bus_errors;
+		status->timeouts = st->timeouts;
+
+		__sync_synchronize();
+	} while (st->seq != seq);
+	return 0;
+}
+
+static long elapsed_us(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+		(now.tv_usec - start->tv_usec);
+}
+
+int cvora_wait_hybrid(int fd, const void *page, int spin_us,
+		      struct cvora_event *ev)
+{
+	struct cvora_status st;
+	struct vmeio_wait_s wbuf;
+	struct timeval start;
+	int cc;
+
+	cvora_status_read(page, &st);
+	memset(&wbuf, 0, sizeof(wbuf));
+	wbuf.interrupt_count = st.count;
+	wbuf.timeout = -1;
+
+	gettimeofday(&start, NULL);
+	while (elapsed_us(&start) < spin_us) {
+		cvora_status_read(page, &st);
+		if (st.count == wbuf.interrupt_count)
+			continue;
+		ev->lun = st.lun;
+		ev->mask = st.mask;
+		ev->count = st.count;
+		ev->control = st.control;
+		ev->memory_pointer = st.memory_pointer;
+		ev->mode = st.mode;
+		ev->frequency = st.frequency;
+		return 0;
+	}
+
+	if ((cc = dev_ioctl(fd, VMEIO_WAIT, &wbuf)) != 0)
+		return cc;
+	event_from_wait(ev, &wbuf.event);
+	return 0;
+}
+
+int cvora_attach_eventfd(int fd, int efd)
+{
+	return dev_ioctl(fd, VMEIO_ADD_EVENTFD, &efd);
+}
+
+int cvora_detach_eventfd(int fd, int efd)
+{
+	return dev_ioctl(fd, VMEIO_DEL_EVENTFD, &efd);
+}
+
+int cvora_event_get_hardware_status(struct cvora_event *ev,
+				    unsigned int *status)
+{
+	if (ev->control == CVORA_REG_INVALID)
+		return -EIO;
+	*status = ev->control;
+	return 0;
+}
+
+int cvora_event_get_sample_size(struct cvora_event *ev, int *memsz)
+{
+	unsigned memp = ev->memory_pointer;
+
+	if (memp == CVORA_REG_INVALID)
+		return -EIO;
+	if (memp < CVORA_MEM_MIN || memp > CVORA_MEM_MAX)
+		return -EINVAL;
+	*memsz = memp - CVORA_MEM_MIN;
+	return 0;
+}
+
+int cvora_event_get_clock_frequency(struct cvora_event *ev,
+				    unsigned int *freq)
+{
+	if (ev->frequency == CVORA_REG_INVALID)
+		return -EIO;
+	*freq = ev->frequency;
+	return 0;
+}
+
+int cvora_event_get_mode(struct cvora_event *ev, enum cvora_mode *mode)
+{
+	if (ev->mode == CVORA_REG_INVALID)
+		return -EIO;
+	*mode = ev->mode & CVORA_MODE_MASK;
+	return 0;
 }
 
 int cvora_get_sample_size(int fd, int *memsz)
@@ -174,37 +836,530 @@ int cvora_get_sample_size(int fd, int *memsz)
 	return 0;
 }
 
-static inline swab32(uint32_t x)
+static int read_samples(int fd, int maxsz, int *actsz, unsigned int *buf)
 {
-	return (((x & 0x000000ff) << 24) |
-		((x & 0x0000ff00) <<  8) |
-		((x & 0x00ff0000) >>  8) |
-		((x & 0xff000000) >> 24));
+	int cc;
+	int i;
+	struct vmeio_riob_s riob;
+	uint32_t *buffer = (uint32_t *)buf;
+
+	if (*actsz > maxsz)
+		*actsz = maxsz;
+
+	riob.winum = 1;
+	riob.offset = CVORA_MEMORY;
+	riob.bsize = *actsz;
+	riob.buffer = buf;
+
+	if ((cc = dev_ioctl(fd, VMEIO_RAW_READ_DMA, &riob)) != 0)
+		return cc;
+
+	for (i = 0; i < (*actsz >> 2); i++)
+		buffer[i] = swab32(buffer[i]);
+	return 0;
 }
 
 int cvora_read_samples(int fd, int maxsz, int *actsz, unsigned int *buf)
 {
 	int cc;
-	int i;
-	struct vmeio_riob_s riob;
-	uint32_t *buffer = (uint32_t *)buf;
 
 	if ((cc = cvora_get_sample_size(fd, actsz)) != 0)
 		return cc;
+	return read_samples(fd, maxsz, actsz, buf);
+}
+
+int cvora_read_event_samples(int fd, struct cvora_event *ev,
+			     int maxsz, int *actsz, unsigned int *buf)
+{
+	int cc;
+
+	if ((cc = cvora_event_get_sample_size(ev, actsz)) != 0)
+		return cc;
+	return read_samples(fd, maxsz, actsz, buf);
+}
+
+/*
+ * Bytes per sample in the memory, a sample holding one value of every
+ * channel as cvora_mode_channels counts them. The 16 bit single input
+ * modes pack two samples in a word, the two input modes store one
+ * word per sample and the 32 bit modes one word per channel.
+ */
+
+static int sample_bytes(int fd, int *bytes)
+{
+	enum cvora_mode mode;
+	unsigned int chans;
+	int width, n, cc;
+
+	if ((cc = cvora_get_mode(fd, &mode)) != 0)
+		return cc;
+	if ((cc = cvora_get_channels_mask(fd, &chans)) != 0)
+		return cc;
+	n = cvora_mode_channels(mode, chans, &width);
+	*bytes = width == 16 ? 4 / (3 - n) : 4 * n;
+	return 0;
+}
+
+/*
+ * DMA the samples [*first, *first + *nsamples) out of memsz bytes,
+ * clipped to the whole samples in the memory and widened to whole
+ * words, and return the range actually read.
+ */
+
+static int read_range(int fd, int memsz, int *first, int *nsamples,
+		      unsigned int *buf)
+{
+	struct vmeio_riob_s riob;
+	int bytes, start, end, i, cc;
+
+	if (*first < 0 || *nsamples < 0)
+		return -EINVAL;
+	if ((cc = sample_bytes(fd, &bytes)) != 0)
+		return cc;
+
+	memsz -= memsz % bytes;
+	start = *first * bytes;
+	if (start > memsz || *nsamples > (memsz - start) / bytes)
+		end = memsz;
+	else
+		end = start + *nsamples * bytes;
+	start &= ~3;
+	end = (end + 3) & ~3;
+	if (start >= end) {
+		*nsamples = 0;
+		return 0;
+	}
+
+	riob.winum = 1;
+	riob.offset = CVORA_MEMORY + start;
+	riob.bsize = end - start;
+	riob.buffer = buf;
+	if ((cc = dev_ioctl(fd, VMEIO_RAW_READ_DMA, &riob)) != 0)
+		return cc;
+
+	for (i = 0; i < (riob.bsize >> 2); i++)
+		buf[i] = swab32(buf[i]);
+	*first = start / bytes;
+	*nsamples = (end - start) / bytes;
+	return 0;
+}
+
+int cvora_read_samples_range(int fd, int *first_sample, int *nsamples,
+			     unsigned int *buf)
+{
+	int memsz, cc;
+
+	if ((cc = cvora_get_sample_size(fd, &memsz)) != 0)
+		return cc;
+	return read_range(fd, memsz, first_sample, nsamples, buf);
+}
+
+int cvora_read_last_samples(int fd, int *first_sample, int *nsamples,
+			    unsigned int *buf)
+{
+	int memsz, bytes, total, cc;
+
+	if (*nsamples < 0)
+		return -EINVAL;
+	if ((cc = cvora_get_sample_size(fd, &memsz)) != 0)
+		return cc;
+	if ((cc = sample_bytes(fd, &bytes)) != 0)
+		return cc;
+	total = memsz / bytes;
+	*first_sample = *nsamples < total ? total - *nsamples : 0;
+	return read_range(fd, memsz, first_sample, nsamples, buf);
+}
+
+/*
+ * Channels in the memory: the 16 bit single input modes hold one
+ * channel two samples to a word, high half first, the two input modes
+ * one sample of each channel per word, and the 32 bit modes one word
+ * per sample of each channel in the parallel channels mask, in turn.
+ */
+
+int cvora_mode_channels(enum cvora_mode mode, unsigned int chans, int *width)
+{
+	int n;
+
+	switch (mode) {
+	case cvora_optical_16:
+	case cvora_copper_16:
+		*width = 16;
+		return 1;
+	case cvora_optical_2_16:
+	case cvora_copper_2_16:
+		*width = 16;
+		return 2;
+	case cvora_btrain_counter:
+		*width = 32;
+		return 1;
+	default:
+		*width = 32;
+		n = __builtin_popcount(chans);
+		return n ? n : 1;
+	}
+}
+
+int cvora_demux(enum cvora_mode mode, unsigned int chans,
+		const unsigned int *buf, int bytes,
+		void **out, int maxsamples, int *nsamples)
+{
+	uint16_t *o16, *p16;
+	uint32_t *o32;
+	int width, n, words, i, j;
+
+	if (bytes < 0 || maxsamples < 0)
+		return -EINVAL;
+	n = cvora_mode_channels(mode, chans, &width);
+	words = bytes / 4;
+
+	if (width == 16 && n == 1) {
+		*nsamples = 2 * words < maxsamples ? 2 * words : maxsamples;
+		o16 = out[0];
+		for (i = 0; i < *nsamples / 2; i++) {
+			o16[2 * i] = buf[i] >> 16;
+			o16[2 * i + 1] = buf[i];
+		}
+		if (*nsamples & 1)
+			o16[*nsamples - 1] = buf[i] >> 16;
+	} else if (width == 16) {
+		*nsamples = words < maxsamples ? words : maxsamples;
+		o16 = out[0];
+		p16 = out[1];
+		for (i = 0; i < *nsamples; i++) {
+			o16[i] = buf[i] >> 16;
+			p16[i] = buf[i];
+		}
+	} else {
+		*nsamples = words / n < maxsamples ? words / n : maxsamples;
+		for (j = 0; j < n; j++) {
+			o32 = out[j];
+			for (i = 0; i < *nsamples; i++)
+				o32[i] = buf[i * n + j];
+		}
+	}
+	return 0;
+}
+
+/*
+ * Pipelined readout: a helper thread DMAs one chunk after the other
+ * into the caller's buffer while the caller swaps the chunks already
+ * transferred. The driver serializes the DMAs, not the swapping, so
+ * the two overlap.
+ */
+
+#define DEFAULT_READ_CHUNK	0x10000
+
+struct pipeline {
+	int		fd;
+	int		chunk;
+	int		size;
+	char		*buf;
+	int		done;		/* bytes transferred */
+	int		cc;		/* DMA error and its errno */
+	int		err;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+};
+
+static void *pipeline_dma(void *arg)
+{
+	struct pipeline *p = arg;
+	struct vmeio_riob_s riob;
+	int off, len, cc;
+
+	for (off = 0; off < p->size; off += len) {
+		len = p->size - off;
+		if (len > p->chunk)
+			len = p->chunk;
+		riob.winum = 1;
+		riob.offset = CVORA_MEMORY + off;
+		riob.bsize = len;
+		riob.buffer = p->buf + off;
+		cc = dev_ioctl(p->fd, VMEIO_RAW_READ_DMA, &riob);
+
+		pthread_mutex_lock(&p->lock);
+		if (cc) {
+			p->cc = cc;
+			p->err = errno;
+		} else
+			p->done = off + len;
+		pthread_cond_signal(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+		if (cc)
+			break;
+	}
+	return NULL;
+}
+
+static int read_samples_pipelined(int fd, int chunk, int maxsz, int *actsz,
+				  unsigned int *buf)
+{
+	struct pipeline p;
+	pthread_t thread;
+	int i, done, swapped, cc;
 
 	if (*actsz > maxsz)
 		*actsz = maxsz;
+	if (chunk <= 0)
+		chunk = DEFAULT_READ_CHUNK;
+	chunk &= ~3;
+	if (chunk == 0 || *actsz <= chunk)
+		return read_samples(fd, maxsz, actsz, buf);
+
+	memset(&p, 0, sizeof(p));
+	p.fd = fd;
+	p.chunk = chunk;
+	p.size = *actsz;
+	p.buf = (char *)buf;
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.cond, NULL);
+	if (pthread_create(&thread, NULL, pipeline_dma, &p) != 0) {
+		pthread_cond_destroy(&p.cond);
+		pthread_mutex_destroy(&p.lock);
+		return read_samples(fd, maxsz, actsz, buf);
+	}
+
+	for (swapped = 0; ; swapped = done) {
+		pthread_mutex_lock(&p.lock);
+		while (p.done == swapped && p.cc == 0)
+			pthread_cond_wait(&p.cond, &p.lock);
+		done = p.done;
+		cc = p.cc;
+		pthread_mutex_unlock(&p.lock);
+
+		for (i = swapped >> 2; i < (done >> 2); i++)
+			buf[i] = swab32(buf[i]);
+		if (cc || done == p.size)
+			break;
+	}
+
+	pthread_join(thread, NULL);
+	pthread_cond_destroy(&p.cond);
+	pthread_mutex_destroy(&p.lock);
+	if (cc) {
+		errno = p.err;
+		return cc;
+	}
+	return 0;
+}
 
+int cvora_read_samples_pipelined(int fd, int chunk, int maxsz, int *actsz,
+				 unsigned int *buf)
+{
+	int cc;
+
+	if ((cc = cvora_get_sample_size(fd, actsz)) != 0)
+		return cc;
+	return read_samples_pipelined(fd, chunk, maxsz, actsz, buf);
+}
+
+int cvora_read_event_samples_pipelined(int fd, struct cvora_event *ev,
+				       int chunk, int maxsz, int *actsz,
+				       unsigned int *buf)
+{
+	int cc;
+
+	if ((cc = cvora_event_get_sample_size(ev, actsz)) != 0)
+		return cc;
+	return read_samples_pipelined(fd, chunk, maxsz, actsz, buf);
+}
+
+int cvora_sim_start(int fd, int period, int burst, int spacing, int count)
+{
+	struct vmeio_sim_s sim;
+
+	if (period <= 0)
+		return -EINVAL;
+	sim.period = period;
+	sim.burst = burst;
+	sim.spacing = spacing;
+	sim.count = count;
+	sim.mask = 0;
+	return dev_ioctl(fd, VMEIO_SET_SIM, &sim);
+}
+
+int cvora_sim_stop(int fd)
+{
+	struct vmeio_sim_s sim;
+
+	memset(&sim, 0, sizeof(sim));
+	return dev_ioctl(fd, VMEIO_SET_SIM, &sim);
+}
+
+int cvora_sim_get_stats(int fd, struct cvora_sim_stats *stats)
+{
+	struct vmeio_sim_stats_s st;
+	int cc;
+
+	if ((cc = dev_ioctl(fd, VMEIO_GET_SIM_STATS, &st)) != 0)
+		return cc;
+	stats->running = st.running;
+	stats->delivered = st.delivered;
+	stats->consumed = st.consumed;
+	stats->lost = st.lost;
+	return 0;
+}
+
+int cvora_sim_load_image(int fd, int size, unsigned int *buf)
+{
+	struct vmeio_riob_s riob;
+	uint32_t *image = NULL;
+	int i, cc;
+
+	if (size < 0 || size > CVORA_MEM_SIZE || size & 3)
+		return -EINVAL;
+	if (size) {
+		if ((image = malloc(size)) == NULL)
+			return -ENOMEM;
+		for (i = 0; i < (size >> 2); i++)
+			image[i] = swab32(buf[i]);
+	}
+
+	memset(&riob, 0, sizeof(riob));
 	riob.winum = 1;
 	riob.offset = CVORA_MEMORY;
-	riob.bsize = *actsz;
-	riob.buffer = buf;
+	riob.bsize = size;
+	riob.buffer = image;
+	cc = dev_ioctl(fd, VMEIO_SET_SIM_IMAGE, &riob);
+	free(image);
+	return cc;
+}
+
+int cvora_stream_start(int fd, int period, int size, int threshold)
+{
+	struct vmeio_stream_s stream;
+
+	if (period <= 0)
+		return -EINVAL;
+	stream.period = period;
+	stream.size = size;
+	stream.threshold = threshold;
+	return dev_ioctl(fd, VMEIO_SET_STREAM, &stream);
+}
+
+int cvora_stream_stop(int fd)
+{
+	struct vmeio_stream_s stream;
+
+	memset(&stream, 0, sizeof(stream));
+	return dev_ioctl(fd, VMEIO_SET_STREAM, &stream);
+}
+
+int cvora_stream_read(int fd, int maxsz, int *actsz, int *offset,
+		      unsigned int *buf)
+{
+	struct vmeio_stream_read_s sr;
+	int i, cc;
+
+	memset(&sr, 0, sizeof(sr));
+	sr.bsize = maxsz;
+	sr.buffer = buf;
+	if ((cc = dev_ioctl(fd, VMEIO_STREAM_READ, &sr)) != 0)
+		return cc;
+
+	for (i = 0; i < (sr.bsize >> 2); i++)
+		buf[i] = swab32(buf[i]);
+	*actsz = sr.bsize;
+	*offset = sr.offset;
+	return 0;
+}
 
-	if ((cc = ioctl(fd, VMEIO_RAW_READ_DMA, &riob)) != 0)
+int cvora_pool_count(int fd, int *count)
+{
+	struct vmeio_pool_s pool;
+	int cc;
+
+	if ((cc = dev_ioctl(fd, VMEIO_GET_POOL, &pool)) != 0)
+		return cc;
+	*count = pool.count;
+	return 0;
+}
+
+int cvora_pool_map(int fd, int index, unsigned int **buf)
+{
+	void *map;
+
+	map = mmap(NULL, VMEIO_POOL_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, VMEIO_POOL_OFFSET(index));
+	if (map == MAP_FAILED)
+		return -errno;
+	*buf = map;
+	return 0;
+}
+
+int cvora_pool_unmap(unsigned int *buf)
+{
+	return munmap(buf, VMEIO_POOL_SIZE);
+}
+
+int cvora_pool_read_samples(int fd, int index, unsigned int *buf,
+			    int maxsz, int *actsz)
+{
+	struct vmeio_pool_dma_s pd;
+	int i, cc;
+
+	if ((cc = cvora_get_sample_size(fd, actsz)) != 0)
+		return cc;
+	if (*actsz > maxsz)
+		*actsz = maxsz;
+
+	pd.index = index;
+	pd.winum = 1;
+	pd.offset = CVORA_MEMORY;
+	pd.bsize = *actsz;
+	if ((cc = dev_ioctl(fd, VMEIO_POOL_DMA, &pd)) != 0)
 		return cc;
 
 	for (i = 0; i < (*actsz >> 2); i++)
-		buffer[i] = swab32(buffer[i]);
+		buf[i] = swab32(buf[i]);
+	return 0;
+}
+
+int cvora_attach(int fd, int lun, unsigned int base, int level, int vector)
+{
+	struct vmeio_get_window_s win;
+
+	memset(&win, 0, sizeof(win));
+	win.lun = lun;
+	win.lvl = level;
+	win.vec = vector;
+	win.vme1 = base;
+	win.amd1 = CVORA_AM;
+	win.dwd1 = CVORA_DWIDTH;
+	win.win1 = CVORA_WINDOW;
+	return dev_ioctl(fd, VMEIO_ATTACH, &win);
+}
+
+int cvora_detach(int fd, int lun)
+{
+	return dev_ioctl(fd, VMEIO_DETACH, &lun);
+}
+
+int cvora_set_dma_params(int fd, struct cvora_dma_params *params)
+{
+	struct vmeio_dma_params_s dma;
+
+	dma.bsize = params->bsize;
+	dma.backoff = params->backoff;
+	dma.am = params->am;
+	dma.dwd = params->dwd;
+	dma.chunk = params->chunk;
+	return dev_ioctl(fd, VMEIO_SET_DMA, &dma);
+}
+
+int cvora_get_dma_params(int fd, struct cvora_dma_params *params)
+{
+	struct vmeio_dma_params_s dma;
+	int cc;
+
+	if ((cc = dev_ioctl(fd, VMEIO_GET_DMA, &dma)) != 0)
+		return cc;
+	params->bsize = dma.bsize;
+	params->backoff = dma.backoff;
+	params->am = dma.am;
+	params->dwd = dma.dwd;
+	params->chunk = dma.chunk;
 	return 0;
 }
 
@@ -41,6 +41,11 @@ extern "C"
 #define CVORA_MODE_BIT		0
 #define CVORA_MODE_MASK		0x7
 
+/** VME window of a module */
+#define CVORA_AM	0x39
+#define CVORA_DWIDTH	4
+#define CVORA_WINDOW	0x80000
+
 /** memory boundaries */
 #define CVORA_MEM_MIN  0x20
 #define CVORA_MEM_MAX  0x7FFFC
@@ -63,6 +68,62 @@ enum cvora_mode {
 	cvora_serial_32,        /**< 32 Serial Inputs on rear panel (P2 connector). */
 };
 
+/**
+ * Interrupt event, with the module registers as they were
+ * when the interrupt was serviced by the driver. They are all
+ * CVORA_REG_INVALID if the driver got a bus error reading them.
+ */
+#define CVORA_REG_INVALID	0xFFFFFFFF
+
+struct cvora_event {
+	int		lun;		/**< logical unit number */
+	unsigned int	mask;		/**< interrupt source mask */
+	int		count;		/**< interrupt counter value */
+	unsigned int	control;	/**< control/status register */
+	unsigned int	memory_pointer;	/**< memory pointer register */
+	unsigned int	mode;		/**< mode register */
+	unsigned int	frequency;	/**< clock frequency register */
+};
+
+/**
+ * Driver status as published in the shared status page, the
+ * registers CVORA_REG_INVALID as in struct cvora_event
+ */
+struct cvora_status {
+	int		lun;		/**< logical unit number */
+	int		count;		/**< interrupt counter value */
+	unsigned int	mask;		/**< last interrupt source mask */
+	unsigned int	isr_sec;	/**< last interrupt time, seconds */
+	unsigned int	isr_nsec;	/**< last interrupt time, nanoseconds */
+	unsigned int	control;	/**< control register at interrupt */
+	unsigned int	memory_pointer;	/**< memory pointer at interrupt */
+	unsigned int	mode;		/**< mode register at interrupt */
+	unsigned int	frequency;	/**< clock frequency at interrupt */
+	int		bus_errors;	/**< bus errors on this lun */
+	int		timeouts;	/**< interrupt waits that timed out */
+};
+
+/**
+ * Synthetic interrupt generator counters
+ */
+struct cvora_sim_stats {
+	int	running;	/**< generator still active */
+	int	delivered;	/**< synthetic interrupts delivered */
+	int	consumed;	/**< interrupts returned to waiters */
+	int	lost;		/**< interrupts no waiter has seen */
+};
+
+/**
+ * DMA transfer tuning, see cvoradmacal to find the best values
+ */
+struct cvora_dma_params {
+	int	bsize;		/**< VME and PCI block size, 32..4096 bytes */
+	int	backoff;	/**< VME and PCI backoff code, 0..7 */
+	int	am;		/**< address modifier, 0x3B A24 BLT, 0x38 MBLT.. */
+	int	dwd;		/**< data width in bits, 0 window's */
+	int	chunk;		/**< max bytes per transfer, 0 unlimited */
+};
+
 /**
  * @brief Initialize cvora user library
  * @param lun logical unit number
@@ -79,6 +140,28 @@ int cvora_init(int lun);
 
 int cvora_close(int fd);
 
+/** replay flags */
+#define CVORA_REPLAY_LOOP	0x1	/**< start over at the end */
+
+/**
+ * @brief open a recording to replay in place of a module
+ * The file descriptor returned works with the rest of the library as
+ * one from cvora_init would. Each wait delivers the next recorded cycle
+ * of the lun, with its registers and samples, at the recorded interval
+ * divided by speed. Waits past the last cycle fail with ENODATA unless
+ * looping. Interrupt, DMA, stream and simulator set up is not replayed.
+ * cvora_init replays the file named by the CVORA_REPLAY environment
+ * variable if it is set, at CVORA_REPLAY_SPEED, looping if
+ * CVORA_REPLAY_LOOP is set.
+ * @param path recording, see cvorarec.h
+ * @param lun logical unit whose cycles to replay
+ * @param speed 1 for the recorded pace, 2 twice as fast.., 0 no waiting
+ * @param flags CVORA_REPLAY_LOOP
+ * @return file descriptor, or < 0 if error
+ */
+
+int cvora_replay_init(const char *path, int lun, double speed, int flags);
+
 /**
  * @brief get version of the module
  * @param fd  file descriptor returned from cvora_init
@@ -127,6 +210,22 @@ int cvora_set_timeout(int fd, int timeout);
  */
 int cvora_get_timeout(int fd, int *timeout);
 
+/**
+ * @brief set interrupt wait timeout in microseconds
+ * @param fd  file descriptor returned from cvora_init
+ * @param timeout timeout value in microseconds, 0 waits forever
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_set_timeout_us(int fd, int timeout);
+
+/**
+ * @brief get interrupt wait timeout in microseconds
+ * @param fd  file descriptor returned from cvora_init
+ * @param timeout timeout value in microseconds
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_get_timeout_us(int fd, int *timeout);
+
 /**
  * @brief set pulse polarity
  * @param fd  file descriptor returned from cvora_init
@@ -184,6 +283,116 @@ int cvora_disable_interrupts(int fd);
  */
 int cvora_wait(int fd);
 
+/**
+ * @brief wait for end of sample interrupt and get its event
+ * Like cvora_wait, but also returns the registers captured by the
+ * driver at interrupt time, so that no further call is needed to
+ * know the status, size, mode and clock of the acquisition.
+ * @param fd  file descriptor returned from cvora_init
+ * @param ev  returned event
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_wait_event(int fd, struct cvora_event *ev);
+
+/**
+ * @brief wait for end of sample interrupt with a per call timeout
+ * @param fd  file descriptor returned from cvora_init
+ * @param timeout timeout in microseconds, 0 waits forever
+ * @param ev  returned event, may be NULL
+ * @return 0 if OK, < 0 if error (errno is ETIME on timeout)
+ */
+int cvora_wait_timeout(int fd, int timeout, struct cvora_event *ev);
+
+/**
+ * @brief map the read only driver status page
+ * Any number of processes may map the page of the same module
+ * @param fd  file descriptor returned from cvora_init
+ * @param page returned page address
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_status_map(int fd, const void **page);
+
+/**
+ * @brief unmap a status page
+ * @param page page address returned by cvora_status_map
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_status_unmap(const void *page);
+
+/**
+ * @brief take a consistent copy of the status page, without syscall
+ * @param page page address returned by cvora_status_map
+ * @param status returned status
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_status_read(const void *page, struct cvora_status *status);
+
+/**
+ * @brief wait for end of sample interrupt, spinning on the status page
+ * The status page is polled for up to spin_us microseconds, then the
+ * call blocks in the driver. No interrupt arriving in between is lost.
+ * @param fd  file descriptor returned from cvora_init
+ * @param page page address returned by cvora_status_map
+ * @param spin_us microseconds to busy poll before blocking
+ * @param ev  returned event
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_wait_hybrid(int fd, const void *page, int spin_us,
+		      struct cvora_event *ev);
+
+/**
+ * @brief attach an eventfd to the module
+ * The eventfd counter is incremented by one on each interrupt, so
+ * a read on it returns the number of interrupts since the last read.
+ * It stays attached until detached or until fd is closed.
+ * @param fd  file descriptor returned from cvora_init
+ * @param efd eventfd file descriptor
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_attach_eventfd(int fd, int efd);
+
+/**
+ * @brief detach an eventfd from the module
+ * @param fd  file descriptor returned from cvora_init
+ * @param efd eventfd file descriptor
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_detach_eventfd(int fd, int efd);
+
+/**
+ * @brief status register at interrupt time
+ * @param ev  event returned by cvora_wait_event
+ * @param status a bitmask of status bits
+ * @return 0 if OK, -EIO if the registers could not be read, < 0 if error
+ */
+int cvora_event_get_hardware_status(struct cvora_event *ev,
+				    unsigned int *status);
+
+/**
+ * @brief memory buffer samples size at interrupt time
+ * @param ev  event returned by cvora_wait_event
+ * @param memsz available memory size in bytes
+ * @return 0 if OK, -EIO if the registers could not be read, < 0 if error
+ */
+int cvora_event_get_sample_size(struct cvora_event *ev, int *memsz);
+
+/**
+ * @brief clock frequency at interrupt time
+ * @param ev  event returned by cvora_wait_event
+ * @param freq frequency value
+ * @return 0 if OK, -EIO if the registers could not be read, < 0 if error
+ */
+int cvora_event_get_clock_frequency(struct cvora_event *ev,
+				    unsigned int *freq);
+
+/**
+ * @brief mode at interrupt time
+ * @param ev  event returned by cvora_wait_event
+ * @param mode one of the CVORA modes of operation
+ * @return 0 if OK, -EIO if the registers could not be read, < 0 if error
+ */
+int cvora_event_get_mode(struct cvora_event *ev, enum cvora_mode *mode);
+
 /**
  * @brief read memory buffer samples size
  * @param fd  file descriptor returned from cvora_init
@@ -202,6 +411,266 @@ int cvora_get_sample_size(int fd, int *memsz);
  */
 int cvora_read_samples(int fd, int maxsz, int *actsz, unsigned int *buf);
 
+/**
+ * @brief Read memory sample buffer of an event
+ * Like cvora_read_samples, but the size is taken from the memory
+ * pointer captured at interrupt time instead of reading it again.
+ * @param fd  file descriptor returned from cvora_init
+ * @param ev  event returned by cvora_wait_event
+ * @param maxsz max byte size to read
+ * @param actsz actual byte size read
+ * @param buf pointer to data area
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_read_event_samples(int fd, struct cvora_event *ev,
+			     int maxsz, int *actsz, unsigned int *buf);
+
+/**
+ * @brief Read a slice of the memory sample buffer
+ * Only the words holding samples *first_sample up to *first_sample +
+ * *nsamples - 1 are transferred. A sample holds one value of each
+ * channel, see cvora_mode_channels: 16 bits in the single input 16 bit
+ * modes, two to a word, a word in the two input modes and a word per
+ * channel in the 32 bit modes. The range is clipped to the whole
+ * samples below the memory pointer and widened to whole words, so buf
+ * must have room for *nsamples + 2 samples.
+ * @param fd  file descriptor returned from cvora_init
+ * @param first_sample first sample wanted, returns the first read
+ * @param nsamples samples wanted, returns the number read
+ * @param buf pointer to data area
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_read_samples_range(int fd, int *first_sample, int *nsamples,
+			     unsigned int *buf);
+
+/**
+ * @brief Read the last samples before the stop
+ * Like cvora_read_samples_range for the last *nsamples samples below
+ * the memory pointer.
+ * @param fd  file descriptor returned from cvora_init
+ * @param first_sample returns the first sample read
+ * @param nsamples samples wanted, returns the number read
+ * @param buf pointer to data area
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_read_last_samples(int fd, int *first_sample, int *nsamples,
+			    unsigned int *buf);
+
+/**
+ * @brief number of channels in the memory for a mode
+ * @param mode one of the CVORA modes of operation
+ * @param chans parallel channels mask, for the 32 bit modes
+ * @param width returns bits per sample, 16 or 32
+ * @return number of channels
+ */
+int cvora_mode_channels(enum cvora_mode mode, unsigned int chans, int *width);
+
+/**
+ * @brief split samples into one array per channel
+ * out must hold cvora_mode_channels arrays of maxsamples samples,
+ * unsigned 16 or 32 bit as that returns. A trailing partial set of
+ * channel samples is dropped.
+ * @param mode the mode the samples were acquired in
+ * @param chans parallel channels mask, for the 32 bit modes
+ * @param buf samples, as returned by cvora_read_samples
+ * @param bytes sample bytes
+ * @param out channel arrays
+ * @param maxsamples max samples per channel
+ * @param nsamples returns samples per channel
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_demux(enum cvora_mode mode, unsigned int chans,
+		const unsigned int *buf, int bytes,
+		void **out, int maxsamples, int *nsamples);
+
+/**
+ * @brief Read memory sample buffer in pipelined chunks
+ * Like cvora_read_samples, but the memory is transferred in chunks
+ * of chunk bytes and each chunk is byte swapped while the next one
+ * is being transferred, so a full memory takes about the longer of
+ * the DMA and the swapping rather than their sum.
+ * @param fd  file descriptor returned from cvora_init
+ * @param chunk bytes per DMA transfer, 0 for the default of 64K
+ * @param maxsz max byte size to read
+ * @param actsz actual byte size read
+ * @param buf pointer to data area
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_read_samples_pipelined(int fd, int chunk, int maxsz, int *actsz,
+				 unsigned int *buf);
+
+/**
+ * @brief Read memory sample buffer of an event in pipelined chunks
+ * See cvora_read_samples_pipelined and cvora_read_event_samples.
+ * @param fd  file descriptor returned from cvora_init
+ * @param ev  event returned by cvora_wait_event
+ * @param chunk bytes per DMA transfer, 0 for the default of 64K
+ * @param maxsz max byte size to read
+ * @param actsz actual byte size read
+ * @param buf pointer to data area
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_read_event_samples_pipelined(int fd, struct cvora_event *ev,
+				       int chunk, int maxsz, int *actsz,
+				       unsigned int *buf);
+
+/**
+ * @brief start the synthetic interrupt generator
+ * Interrupts are delivered in bursts of burst interrupts spacing
+ * microseconds apart, one burst every period microseconds, until
+ * count interrupts have been delivered or the generator is stopped.
+ * @param fd  file descriptor returned from cvora_init
+ * @param period microseconds between bursts
+ * @param burst interrupts per burst (0 same as 1)
+ * @param spacing microseconds between interrupts in a burst
+ * @param count interrupts to deliver, 0 until stopped
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_sim_start(int fd, int period, int burst, int spacing, int count);
+
+/**
+ * @brief stop the synthetic interrupt generator
+ * @param fd  file descriptor returned from cvora_init
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_sim_stop(int fd);
+
+/**
+ * @brief get delivered, consumed and lost interrupt counts
+ * @param fd  file descriptor returned from cvora_init
+ * @param stats returned counters
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_sim_get_stats(int fd, struct cvora_sim_stats *stats);
+
+/**
+ * @brief load the sample memory image served while simulating
+ * Generated events report a memory size of size bytes, and sample
+ * reads return this image until it is dropped, also once a counted
+ * run is over.
+ * @param fd  file descriptor returned from cvora_init
+ * @param size image size in bytes, 0 to drop the image
+ * @param buf samples, as returned by cvora_read_samples
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_sim_load_image(int fd, int size, unsigned int *buf);
+
+/**
+ * @brief start streaming samples while the acquisition runs
+ * The driver polls the memory pointer every period microseconds and
+ * reads the newly written samples into a ring buffer. poll() on fd
+ * reports POLLIN once threshold bytes are available.
+ * @param fd  file descriptor returned from cvora_init
+ * @param period microseconds between memory pointer polls
+ * @param size ring buffer size in bytes (rounded up to a power of 2)
+ * @param threshold bytes available before fd becomes readable
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_stream_start(int fd, int period, int size, int threshold);
+
+/**
+ * @brief stop streaming samples
+ * @param fd  file descriptor returned from cvora_init
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_stream_stop(int fd);
+
+/**
+ * @brief read the streamed samples available so far
+ * Does not block, *actsz is 0 if nothing is available. A read never
+ * spans two acquisitions: *offset is the byte offset of the first
+ * sample in the sample memory and restarts at 0 after a rearm.
+ * @param fd  file descriptor returned from cvora_init
+ * @param maxsz max byte size to read
+ * @param actsz actual byte size read
+ * @param offset byte offset of buf[0] in the sample memory
+ * @param buf pointer to data area
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_stream_read(int fd, int maxsz, int *actsz, int *offset,
+		      unsigned int *buf);
+
+/**
+ * @brief get the number of persistent DMA buffers of the module
+ * The driver allocates them at install, see its pool parameter.
+ * @param fd  file descriptor returned from cvora_init
+ * @param count returned number of buffers
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_pool_count(int fd, int *count);
+
+/**
+ * @brief map a persistent DMA buffer
+ * @param fd  file descriptor returned from cvora_init
+ * @param index buffer 0..count-1
+ * @param buf returned buffer address
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_pool_map(int fd, int index, unsigned int **buf);
+
+/**
+ * @brief unmap a persistent DMA buffer
+ * @param buf buffer address returned by cvora_pool_map
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_pool_unmap(unsigned int *buf);
+
+/**
+ * @brief Read memory sample buffer into a persistent DMA buffer
+ * The samples are transferred by the driver straight into pool
+ * buffer index, then byte swapped in place.
+ * @param fd  file descriptor returned from cvora_init
+ * @param index buffer to read into
+ * @param buf the buffer as mapped by cvora_pool_map
+ * @param maxsz max byte size to read
+ * @param actsz actual byte size read
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_pool_read_samples(int fd, int index, unsigned int *buf,
+			    int maxsz, int *actsz);
+
+/**
+ * @brief attach a module to the running driver
+ * The other modules keep running. A module attached again gets back
+ * its minor, a new one the first free that no process has open, or
+ * ENOSPC if none. It is then reachable with cvora_init(lun), given a
+ * /dev/cvora.lun device node of that minor. Needs CAP_SYS_ADMIN.
+ * @param fd  file descriptor of any module, returned from cvora_init
+ * @param lun logical unit number of the new module
+ * @param base VME A24 base address
+ * @param level interrupt level, 0 for none
+ * @param vector interrupt vector, 0 for none
+ * @return the minor of the module if OK, < 0 if error
+ */
+int cvora_attach(int fd, int lun, unsigned int base, int level, int vector);
+
+/**
+ * @brief detach a module from the running driver
+ * Waits and reads in progress on the module return with ENODEV,
+ * later calls on its open file descriptors fail with ENODEV.
+ * Needs CAP_SYS_ADMIN.
+ * @param fd  file descriptor of any module, returned from cvora_init
+ * @param lun logical unit number of the module to detach
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_detach(int fd, int lun);
+
+/**
+ * @brief set DMA transfer tuning of the module
+ * @param fd  file descriptor returned from cvora_init
+ * @param params new tuning, chunk a multiple of bsize
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_set_dma_params(int fd, struct cvora_dma_params *params);
+
+/**
+ * @brief get DMA transfer tuning of the module
+ * @param fd  file descriptor returned from cvora_init
+ * @param params returned tuning
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_get_dma_params(int fd, struct cvora_dma_params *params);
+
 /**
  * @brief Issue a software start
  * @param fd  file descriptor returned from cvora_init
@@ -263,6 +732,24 @@ int cvora_get_channels_mask(int fd, unsigned int *chans);
  */
 int cvora_set_channels_mask(int fd, unsigned int chans);
 
+/**
+ * @brief read a register
+ * @param fd  file descriptor returned from cvora_init
+ * @param offset register offset, CVORA_CONTROL..CVORA_DAC
+ * @param value register contents
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_read_reg(int fd, unsigned int offset, unsigned int *value);
+
+/**
+ * @brief write a register
+ * @param fd  file descriptor returned from cvora_init
+ * @param offset register offset, CVORA_CONTROL..CVORA_DAC
+ * @param value register contents
+ * @return 0 if OK, < 0 if error
+ */
+int cvora_write_reg(int fd, unsigned int offset, unsigned int value);
+
 
 #ifdef __cplusplus
 }
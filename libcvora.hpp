@@ -0,0 +1,891 @@
+/**
+ * C++ interface to the cvora user library
+ *
+ * Header only, over the calls of libcvora.h, so a recording replayed
+ * with cvora_replay_init or CVORA_REPLAY works the same way:
+ *
+ * - cvora::Device owns a file descriptor, closes it when destroyed and
+ *   throws cvora::error where the C call returns < 0
+ * - reads go into and return spans, std::span when built as C++20, a
+ *   minimal equivalent otherwise, as the front end compilers are C++98
+ * - cvora::decoder<mode> unpacks samples with the memory layout of the
+ *   mode fixed at compile time, so the loops inline into the caller
+ *   with constant shifts and strides, and cvora::dispatch switches on
+ *   the mode once, outside the loop
+ * - registers and their fields are types built from the CVORA_xxx
+ *   offsets, bits and masks, read and written with Device::get and
+ *   Device::set
+ * - cvora::Reactor waits and reads asynchronously over any number of
+ *   devices from one thread, see cvoraasync.h, with callbacks, with
+ *   std::future from C++11 and with co_await from C++20
+ *
+ * Every member is inline and forwards to a single C call, so using it
+ * costs what calling libcvora directly does.
+ */
+
+#ifndef _LIBCVORA_HPP
+#define _LIBCVORA_HPP
+
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <stdint.h>
+#include "libcvora.h"
+#include "cvoraasync.h"
+
+#if __cplusplus >= 201103L
+#include <exception>
+#include <future>
+#endif
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define CVORA_COROUTINES
+#endif
+
+namespace cvora {
+
+/* ==================== */
+
+#if __cplusplus >= 202002L
+template <class T> using span = std::span<T>;
+#else
+/**
+ * Contiguous run of T, the part of std::span used here
+ */
+template <class T> class span {
+public:
+	typedef T element_type;
+	typedef T *iterator;
+
+	span() : p_(0), n_(0) {}
+	span(T *p, std::size_t n) : p_(p), n_(n) {}
+	template <std::size_t N> span(T (&a)[N]) : p_(a), n_(N) {}
+	template <class U> span(const span<U> &s)
+		: p_(s.data()), n_(s.size()) {}
+
+	T *data() const { return p_; }
+	std::size_t size() const { return n_; }
+	std::size_t size_bytes() const { return n_ * sizeof(T); }
+	bool empty() const { return n_ == 0; }
+	T &operator[](std::size_t i) const { return p_[i]; }
+	iterator begin() const { return p_; }
+	iterator end() const { return p_ + n_; }
+	span first(std::size_t n) const { return span(p_, n); }
+	span subspan(std::size_t off, std::size_t n) const
+	{
+		return span(p_ + off, n);
+	}
+
+private:
+	T		*p_;
+	std::size_t	n_;
+};
+#endif
+
+/**
+ * Library call failure, with the errno it failed with
+ */
+class error : public std::runtime_error {
+public:
+	error(const char *call, int code)
+		: std::runtime_error(std::string(call) + ": " +
+				     std::strerror(code)),
+		  code_(code) {}
+	int code() const { return code_; }
+
+private:
+	int	code_;
+};
+
+/** @cond */
+namespace detail {
+
+/* The library returns < 0 on error with errno set, or the error negated */
+
+inline int check(int cc, const char *call)
+{
+	if (cc < 0)
+		throw error(call, cc < -1 ? -cc : errno);
+	return cc;
+}
+
+} /* namespace detail */
+/** @endcond */
+
+/* ==================== */
+
+/**
+ * A field of a register: the bits of Mask, Shift up from bit 0,
+ * read and written as a T
+ */
+template <unsigned int Offset, unsigned int Mask, unsigned int Shift,
+	  class T = unsigned int>
+struct field {
+	typedef T type;
+	static const unsigned int offset = Offset;
+	static const unsigned int mask = Mask;
+	static const unsigned int shift = Shift;
+
+	/** the field out of register contents */
+	static T decode(unsigned int reg)
+	{
+		return static_cast<T>((reg & Mask) >> Shift);
+	}
+
+	/** register contents with the field replaced */
+	static unsigned int encode(unsigned int reg, T value)
+	{
+		return (reg & ~Mask) |
+		       ((static_cast<unsigned int>(value) << Shift) & Mask);
+	}
+};
+
+/** A whole register */
+template <unsigned int Offset, class T = unsigned int>
+struct reg : field<Offset, ~0U, 0, T> {};
+
+/** A one bit flag of a register */
+template <unsigned int Offset, unsigned int Bit>
+struct flag : field<Offset, 1U << Bit, Bit, bool> {};
+
+/**
+ * The module registers and the fields of the control and mode ones
+ */
+namespace regs {
+
+typedef reg<CVORA_CONTROL>			control;
+typedef reg<CVORA_MEMORY_POINTER>		memory_pointer;
+typedef reg<CVORA_CHANNEL>			channels_mask;
+typedef reg<CVORA_FREQUENCY>			frequency;
+typedef reg<CVORA_DAC>				dac;
+
+typedef field<CVORA_CONTROL, CVORA_POLARITY_MASK << CVORA_POLARITY_BIT,
+	      CVORA_POLARITY_BIT, int>		polarity;
+typedef flag<CVORA_CONTROL, CVORA_MODULE_ENABLE_BIT>	module_enable;
+typedef flag<CVORA_CONTROL, CVORA_INT_ENABLE_BIT>	int_enable;
+typedef flag<CVORA_CONTROL, CVORA_SOFT_START_BIT>	soft_start;
+typedef flag<CVORA_CONTROL, CVORA_SOFT_STOP_BIT>	soft_stop;
+typedef flag<CVORA_CONTROL, CVORA_SOFT_REARM_BIT>	soft_rearm;
+typedef flag<CVORA_CONTROL, CVORA_COUNTER_OVERFLOW>	counter_overflow;
+typedef flag<CVORA_CONTROL, CVORA_RAM_OVERFLOW>		ram_overflow;
+typedef field<CVORA_CONTROL, (unsigned int)CVORA_VECTOR_MASK,
+	      CVORA_VECTOR_BIT>			vector;
+typedef field<CVORA_CONTROL, (unsigned int)CVORA_VERSION_MASK,
+	      CVORA_VERSION_BIT>		version;
+
+typedef field<CVORA_MODE, CVORA_MODE_MASK << CVORA_MODE_BIT,
+	      CVORA_MODE_BIT, enum cvora_mode>	mode;
+
+} /* namespace regs */
+
+/* ==================== */
+
+/**
+ * Memory layout of a mode, as cvora_mode_channels gives it:
+ * 32 bit samples, one channel per bit of the parallel channels mask,
+ * interleaved word by word
+ */
+template <enum cvora_mode M> struct mode_traits {
+	typedef uint32_t sample_type;
+	static const int width = 32;
+	static const int channels = 0;	/**< from the mask */
+};
+
+/** @cond */
+template <> struct mode_traits<cvora_optical_16> {
+	typedef uint16_t sample_type;
+	static const int width = 16;
+	static const int channels = 1;
+};
+
+template <> struct mode_traits<cvora_copper_16>
+	: mode_traits<cvora_optical_16> {};
+
+template <> struct mode_traits<cvora_optical_2_16> {
+	typedef uint16_t sample_type;
+	static const int width = 16;
+	static const int channels = 2;
+};
+
+template <> struct mode_traits<cvora_copper_2_16>
+	: mode_traits<cvora_optical_2_16> {};
+
+template <> struct mode_traits<cvora_btrain_counter> {
+	typedef uint32_t sample_type;
+	static const int width = 32;
+	static const int channels = 1;
+};
+
+namespace detail {
+
+/*
+ * Sample i of channel c out of the memory words, per layout. Half
+ * words come high half first, in one channel two to a word, in two
+ * channels channel 0 in the high half.
+ */
+
+template <int Width, int Channels> struct layout {
+	static uint32_t sample(const unsigned int *w, int n, std::size_t i,
+			       int c)
+	{
+		return w[i * n + c];
+	}
+};
+
+template <> struct layout<32, 1> {
+	static uint32_t sample(const unsigned int *w, int, std::size_t i, int)
+	{
+		return w[i];
+	}
+};
+
+template <> struct layout<16, 1> {
+	static uint16_t sample(const unsigned int *w, int, std::size_t i, int)
+	{
+		return w[i >> 1] >> (i & 1 ? 0 : 16);
+	}
+};
+
+template <> struct layout<16, 2> {
+	static uint16_t sample(const unsigned int *w, int, std::size_t i,
+			       int c)
+	{
+		return w[i] >> (c ? 0 : 16);
+	}
+};
+
+} /* namespace detail */
+/** @endcond */
+
+/**
+ * Sample decoder for mode M
+ *
+ * Only the 32 bit modes with a parallel channels mask keep the number
+ * of channels at run time, the others have it as a constant.
+ */
+template <enum cvora_mode M> class decoder {
+public:
+	typedef typename mode_traits<M>::sample_type sample_type;
+	static const enum cvora_mode mode = M;
+	static const int width = mode_traits<M>::width;
+
+	/** chans is the parallel channels mask, for the 32 bit modes */
+	explicit decoder(unsigned int chans = 0)
+		: n_(mode_traits<M>::channels ? mode_traits<M>::channels :
+		     chans ? __builtin_popcount(chans) : 1) {}
+
+	/** number of channels */
+	int channels() const
+	{
+		return mode_traits<M>::channels ? mode_traits<M>::channels : n_;
+	}
+
+	/** samples per channel in words of memory */
+	std::size_t samples(std::size_t words) const
+	{
+		if (width == 16 && channels() == 1)
+			return 2 * words;
+		return words / channels();
+	}
+
+	/** sample i of channel c */
+	sample_type sample(span<const unsigned int> buf, std::size_t i,
+			   int c = 0) const
+	{
+		return layout::sample(buf.data(), channels(), i, c);
+	}
+
+	/**
+	 * Call f(sample) on each sample of channel c in turn, the hot
+	 * loop of a front end inlined with the layout. Returns f, as
+	 * std::for_each does.
+	 */
+	template <class F>
+	F for_each(span<const unsigned int> buf, int c, F f) const
+	{
+		const unsigned int *w = buf.data();
+		std::size_t i, n = samples(buf.size());
+		int nc = channels();
+
+		for (i = 0; i < n; i++)
+			f(layout::sample(w, nc, i, c));
+		return f;
+	}
+
+	/**
+	 * Copy channel c to out, returning the samples copied
+	 */
+	std::size_t channel(span<const unsigned int> buf, int c,
+			    span<sample_type> out) const
+	{
+		const unsigned int *w = buf.data();
+		sample_type *o = out.data();
+		std::size_t i, n = samples(buf.size());
+		int nc = channels();
+
+		if (n > out.size())
+			n = out.size();
+		for (i = 0; i < n; i++)
+			o[i] = layout::sample(w, nc, i, c);
+		return n;
+	}
+
+	/**
+	 * Split buf into the channels()'s out spans, returning the
+	 * samples per channel, the fewest any out has room for
+	 */
+	std::size_t demux(span<const unsigned int> buf,
+			  span<sample_type> *out) const
+	{
+		std::size_t n = samples(buf.size());
+		int c;
+
+		for (c = 0; c < channels(); c++)
+			if (out[c].size() < n)
+				n = out[c].size();
+		for (c = 0; c < channels(); c++)
+			channel(buf, c, out[c].first(n));
+		return n;
+	}
+
+private:
+	typedef detail::layout<mode_traits<M>::width,
+			       mode_traits<M>::channels> layout;
+	int	n_;
+};
+
+/** @cond */
+namespace detail {
+
+template <class F>
+void dispatch(enum cvora_mode mode, unsigned int chans, F &f)
+{
+	switch (mode) {
+	case cvora_optical_16:
+		f(decoder<cvora_optical_16>(chans));
+		break;
+	case cvora_copper_16:
+		f(decoder<cvora_copper_16>(chans));
+		break;
+	case cvora_optical_2_16:
+		f(decoder<cvora_optical_2_16>(chans));
+		break;
+	case cvora_copper_2_16:
+		f(decoder<cvora_copper_2_16>(chans));
+		break;
+	case cvora_btrain_counter:
+		f(decoder<cvora_btrain_counter>(chans));
+		break;
+	case cvora_serial_32:
+		f(decoder<cvora_serial_32>(chans));
+		break;
+	case cvora_parallel_input:
+		f(decoder<cvora_parallel_input>(chans));
+		break;
+	default:
+		f(decoder<cvora_reserved>(chans));
+		break;
+	}
+}
+
+} /* namespace detail */
+/** @endcond */
+
+/**
+ * Call f(decoder<mode>(chans)) for a mode known only at run time,
+ * f having an operator() template over the decoder type
+ */
+template <class F>
+void dispatch(enum cvora_mode mode, unsigned int chans, F &f)
+{
+	detail::dispatch(mode, chans, f);
+}
+
+template <class F>
+void dispatch(enum cvora_mode mode, unsigned int chans, const F &f)
+{
+	detail::dispatch(mode, chans, f);
+}
+
+/* ==================== */
+
+/**
+ * An open module, or a recording replayed in place of one
+ */
+class Device {
+public:
+	/** open lun, see cvora_init */
+	explicit Device(int lun)
+		: fd_(detail::check(cvora_init(lun), "cvora_init")) {}
+
+	/** replay a recording, see cvora_replay_init */
+	Device(const char *path, int lun, double speed = 1, int flags = 0)
+		: fd_(detail::check(cvora_replay_init(path, lun, speed, flags),
+				    "cvora_replay_init")) {}
+
+	~Device()
+	{
+		if (fd_ >= 0)
+			cvora_close(fd_);
+	}
+
+#if __cplusplus >= 201103L
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+	Device(Device &&d) noexcept : fd_(d.fd_) { d.fd_ = -1; }
+	Device &operator=(Device &&d) noexcept
+	{
+		if (this != &d) {
+			if (fd_ >= 0)
+				cvora_close(fd_);
+			fd_ = d.fd_;
+			d.fd_ = -1;
+		}
+		return *this;
+	}
+#endif
+
+	/** the file descriptor, for the calls not wrapped here */
+	int fd() const { return fd_; }
+
+	/** register or field F */
+	template <class F> typename F::type get() const
+	{
+		unsigned int v;
+
+		detail::check(cvora_read_reg(fd_, F::offset, &v),
+			      "cvora_read_reg");
+		return F::decode(v);
+	}
+
+	/** set register or field F, the rest of the register unchanged */
+	template <class F> void set(typename F::type value)
+	{
+		unsigned int v = 0;
+
+		if (F::mask != ~0U)
+			detail::check(cvora_read_reg(fd_, F::offset, &v),
+				      "cvora_read_reg");
+		detail::check(cvora_write_reg(fd_, F::offset,
+					      F::encode(v, value)),
+			      "cvora_write_reg");
+	}
+
+	enum cvora_mode mode() const
+	{
+		enum cvora_mode m;
+
+		detail::check(cvora_get_mode(fd_, &m), "cvora_get_mode");
+		return m;
+	}
+
+	void set_mode(enum cvora_mode m)
+	{
+		detail::check(cvora_set_mode(fd_, m), "cvora_set_mode");
+	}
+
+	unsigned int channels_mask() const
+	{
+		unsigned int chans;
+
+		detail::check(cvora_get_channels_mask(fd_, &chans),
+			      "cvora_get_channels_mask");
+		return chans;
+	}
+
+	void set_channels_mask(unsigned int chans)
+	{
+		detail::check(cvora_set_channels_mask(fd_, chans),
+			      "cvora_set_channels_mask");
+	}
+
+	/** timeout in microseconds, 0 waits forever */
+	void set_timeout_us(int timeout)
+	{
+		detail::check(cvora_set_timeout_us(fd_, timeout),
+			      "cvora_set_timeout_us");
+	}
+
+	void enable_module()
+	{
+		detail::check(cvora_enable_module(fd_), "cvora_enable_module");
+	}
+
+	void disable_module()
+	{
+		detail::check(cvora_disable_module(fd_),
+			      "cvora_disable_module");
+	}
+
+	void enable_interrupts()
+	{
+		detail::check(cvora_enable_interrupts(fd_),
+			      "cvora_enable_interrupts");
+	}
+
+	void disable_interrupts()
+	{
+		detail::check(cvora_disable_interrupts(fd_),
+			      "cvora_disable_interrupts");
+	}
+
+	void soft_start()
+	{
+		detail::check(cvora_soft_start(fd_), "cvora_soft_start");
+	}
+
+	void soft_stop()
+	{
+		detail::check(cvora_soft_stop(fd_), "cvora_soft_stop");
+	}
+
+	void soft_rearm()
+	{
+		detail::check(cvora_soft_rearm(fd_), "cvora_soft_rearm");
+	}
+
+	/**
+	 * Wait for the next interrupt, timeout in microseconds, 0 forever.
+	 * A timeout throws an error with code ETIME.
+	 */
+	struct cvora_event wait(int timeout = 0)
+	{
+		struct cvora_event ev;
+
+		detail::check(cvora_wait_timeout(fd_, timeout, &ev),
+			      "cvora_wait_timeout");
+		return ev;
+	}
+
+	/** sample bytes in memory */
+	int sample_size() const
+	{
+		int memsz;
+
+		detail::check(cvora_get_sample_size(fd_, &memsz),
+			      "cvora_get_sample_size");
+		return memsz;
+	}
+
+	/**
+	 * Read the samples into buf, returning the words of buf filled,
+	 * the last one partly if the byte count is not a multiple of 4.
+	 * chunk > 0 reads pipelined, see cvora_read_samples_pipelined.
+	 */
+	span<unsigned int> read(span<unsigned int> buf, int chunk = 0)
+	{
+		int actsz;
+
+		if (chunk > 0)
+			detail::check(cvora_read_samples_pipelined(fd_, chunk,
+					(int)buf.size_bytes(), &actsz,
+					buf.data()),
+				      "cvora_read_samples_pipelined");
+		else
+			detail::check(cvora_read_samples(fd_,
+					(int)buf.size_bytes(), &actsz,
+					buf.data()),
+				      "cvora_read_samples");
+		return buf.first((actsz + 3) / 4);
+	}
+
+	/** read the samples of an event, see cvora_read_event_samples */
+	span<unsigned int> read(struct cvora_event &ev,
+				span<unsigned int> buf, int chunk = 0)
+	{
+		int actsz;
+
+		if (chunk > 0)
+			detail::check(cvora_read_event_samples_pipelined(fd_,
+					&ev, chunk, (int)buf.size_bytes(),
+					&actsz, buf.data()),
+				      "cvora_read_event_samples_pipelined");
+		else
+			detail::check(cvora_read_event_samples(fd_, &ev,
+					(int)buf.size_bytes(), &actsz,
+					buf.data()),
+				      "cvora_read_event_samples");
+		return buf.first((actsz + 3) / 4);
+	}
+
+private:
+#if __cplusplus < 201103L
+	Device(const Device &);
+	Device &operator=(const Device &);
+#endif
+
+	int	fd_;
+};
+
+/* ==================== */
+
+#ifdef CVORA_COROUTINES
+/**
+ * Coroutine return type for the coroutines driven by a Reactor: it
+ * starts at once and frees itself at the end. Errors are to be caught
+ * in the coroutine, one escaping it terminates the program.
+ */
+struct task {
+	struct promise_type {
+		task get_return_object() noexcept { return task(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+#endif
+
+/**
+ * Asynchronous waits and readouts, see cvoraasync.h
+ *
+ * Every completion, whatever its form, happens in run(), so futures
+ * are to be waited for from other threads than the one running the
+ * reactor, and coroutines resume in it.
+ */
+class Reactor {
+public:
+	Reactor() : r_(cvora_reactor_create())
+	{
+		if (r_ == NULL)
+			throw error("cvora_reactor_create", errno);
+	}
+
+	~Reactor() { cvora_reactor_destroy(r_); }
+
+	/** the C reactor, for the calls not wrapped here */
+	struct cvora_reactor *get() const { return r_; }
+
+	/** epoll file descriptor, to nest in another event loop */
+	int fd() const { return cvora_reactor_fd(r_); }
+
+	void add(const Device &d)
+	{
+		detail::check(cvora_reactor_add(r_, d.fd()),
+			      "cvora_reactor_add");
+	}
+
+	/** remove d, its pending operations failing with ECANCELED */
+	void remove(const Device &d)
+	{
+		detail::check(cvora_reactor_remove(r_, d.fd()),
+			      "cvora_reactor_remove");
+	}
+
+	/**
+	 * Run the completions due, blocking for timeout milliseconds at
+	 * most, -1 forever. Returns the number run.
+	 */
+	int run(int timeout = -1)
+	{
+		return detail::check(cvora_reactor_run(r_, timeout),
+				     "cvora_reactor_run");
+	}
+
+	/** wait for the next interrupt of d, timeout in microseconds */
+	void wait(const Device &d, int timeout, cvora_wait_fn fn, void *arg)
+	{
+		detail::check(cvora_async_wait(r_, d.fd(), timeout, fn, arg),
+			      "cvora_async_wait");
+	}
+
+	/** read the samples of d, of ev if not NULL, into buf */
+	void read(const Device &d, span<unsigned int> buf,
+		  cvora_read_fn fn, void *arg,
+		  const struct cvora_event *ev = 0, int chunk = 0)
+	{
+		detail::check(cvora_async_read(r_, d.fd(), ev, chunk,
+					       (int)buf.size_bytes(),
+					       buf.data(), fn, arg),
+			      "cvora_async_read");
+	}
+
+#if __cplusplus >= 201103L
+	/** wait, completing a future */
+	std::future<struct cvora_event> wait_future(const Device &d,
+						    int timeout = 0)
+	{
+		std::promise<struct cvora_event> *p =
+			new std::promise<struct cvora_event>;
+		std::future<struct cvora_event> f = p->get_future();
+
+		try {
+			wait(d, timeout, wait_promise, p);
+		} catch (...) {
+			delete p;
+			throw;
+		}
+		return f;
+	}
+
+	/** read, completing a future with the words of buf filled */
+	std::future<span<unsigned int>> read_future(const Device &d,
+			span<unsigned int> buf,
+			const struct cvora_event *ev = 0, int chunk = 0)
+	{
+		read_state *st = new read_state;
+		std::future<span<unsigned int>> f = st->p.get_future();
+
+		st->buf = buf;
+		try {
+			read(d, buf, read_promise, st, ev, chunk);
+		} catch (...) {
+			delete st;
+			throw;
+		}
+		return f;
+	}
+#endif
+
+#ifdef CVORA_COROUTINES
+	/** co_await the next interrupt of a device, giving its event */
+	class wait_awaiter {
+	public:
+		wait_awaiter(struct cvora_reactor *r, int fd, int timeout)
+			: r_(r), fd_(fd), timeout_(timeout), cc_(0) {}
+
+		bool await_ready() const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			h_ = h;
+			detail::check(cvora_async_wait(r_, fd_, timeout_,
+						       done, this),
+				      "cvora_async_wait");
+		}
+
+		struct cvora_event await_resume()
+		{
+			if (cc_)
+				throw error("cvora_async_wait", -cc_);
+			return ev_;
+		}
+
+	private:
+		static void done(int cc, const struct cvora_event *ev,
+				 void *arg)
+		{
+			wait_awaiter *a = static_cast<wait_awaiter *>(arg);
+
+			a->cc_ = cc;
+			if (ev)
+				a->ev_ = *ev;
+			a->h_.resume();
+		}
+
+		struct cvora_reactor	*r_;
+		int			fd_;
+		int			timeout_;
+		int			cc_;
+		struct cvora_event	ev_;
+		std::coroutine_handle<>	h_;
+	};
+
+	/** co_await a readout, giving the words of buf filled */
+	class read_awaiter {
+	public:
+		read_awaiter(struct cvora_reactor *r, int fd,
+			     span<unsigned int> buf,
+			     const struct cvora_event *ev, int chunk)
+			: r_(r), fd_(fd), buf_(buf), ev_(ev), chunk_(chunk),
+			  cc_(0), actsz_(0) {}
+
+		bool await_ready() const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			h_ = h;
+			detail::check(cvora_async_read(r_, fd_, ev_, chunk_,
+						       (int)buf_.size_bytes(),
+						       buf_.data(), done, this),
+				      "cvora_async_read");
+		}
+
+		span<unsigned int> await_resume()
+		{
+			if (cc_)
+				throw error("cvora_async_read", -cc_);
+			return buf_.first((actsz_ + 3) / 4);
+		}
+
+	private:
+		static void done(int cc, int actsz, void *arg)
+		{
+			read_awaiter *a = static_cast<read_awaiter *>(arg);
+
+			a->cc_ = cc;
+			a->actsz_ = actsz;
+			a->h_.resume();
+		}
+
+		struct cvora_reactor		*r_;
+		int				fd_;
+		span<unsigned int>		buf_;
+		const struct cvora_event	*ev_;
+		int				chunk_;
+		int				cc_;
+		int				actsz_;
+		std::coroutine_handle<>		h_;
+	};
+
+	wait_awaiter next_event(const Device &d, int timeout = 0)
+	{
+		return wait_awaiter(r_, d.fd(), timeout);
+	}
+
+	read_awaiter read_samples(const Device &d, span<unsigned int> buf,
+				  const struct cvora_event *ev = 0,
+				  int chunk = 0)
+	{
+		return read_awaiter(r_, d.fd(), buf, ev, chunk);
+	}
+#endif
+
+private:
+	Reactor(const Reactor &);
+	Reactor &operator=(const Reactor &);
+
+#if __cplusplus >= 201103L
+	struct read_state {
+		std::promise<span<unsigned int>>	p;
+		span<unsigned int>			buf;
+	};
+
+	static void wait_promise(int cc, const struct cvora_event *ev,
+				 void *arg)
+	{
+		std::promise<struct cvora_event> *p =
+			static_cast<std::promise<struct cvora_event> *>(arg);
+
+		if (cc)
+			p->set_exception(std::make_exception_ptr(
+				error("cvora_async_wait", -cc)));
+		else
+			p->set_value(*ev);
+		delete p;
+	}
+
+	static void read_promise(int cc, int actsz, void *arg)
+	{
+		read_state *st = static_cast<read_state *>(arg);
+
+		if (cc)
+			st->p.set_exception(std::make_exception_ptr(
+				error("cvora_async_read", -cc)));
+		else
+			st->p.set_value(st->buf.first((actsz + 3) / 4));
+		delete st;
+	}
+#endif
+
+	struct cvora_reactor	*r_;
+};
+
+} /* namespace cvora */
+
+#endif	/* _LIBCVORA_HPP */
@@ -0,0 +1,523 @@
+/**
+ * Python binding of libcvora
+ *
+ * Thin wrappers of the library calls, taking the file descriptor from
+ * init. Sample reads and demultiplexing write into buffers the caller
+ * owns, anything with the writable buffer interface such as a NumPy
+ * array, so a full memory is read without a copy or a Python loop.
+ * The GIL is released while waiting and while reading, so other
+ * Python threads run meanwhile.
+ *
+ * cvora.py builds the NumPy interface on top of this module.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <string.h>
+#include "libcvora.h"
+#include "cvorastats.h"
+
+#if PY_MAJOR_VERSION >= 3
+#define RO_BUFFER	"y*"
+#else
+#define RO_BUFFER	"s*"
+#endif
+
+#define MAX_CHANNELS	32
+
+/*
+ * The library returns < 0 on error with errno set, or the error
+ * itself negated
+ */
+
+static PyObject *error(int cc)
+{
+	errno = cc < -1 ? -cc : errno;
+	return PyErr_SetFromErrno(PyExc_IOError);
+}
+
+static PyObject *none_or_error(int cc)
+{
+	if (cc < 0)
+		return error(cc);
+	Py_RETURN_NONE;
+}
+
+static PyObject *event_dict(struct cvora_event *ev)
+{
+	return Py_BuildValue("{s:i,s:I,s:i,s:I,s:I,s:I,s:I}",
+			     "lun", ev->lun, "mask", ev->mask,
+			     "count", ev->count, "control", ev->control,
+			     "memory_pointer", ev->memory_pointer,
+			     "mode", ev->mode, "frequency", ev->frequency);
+}
+
+/* ==================== */
+
+static PyObject *py_init(PyObject *self, PyObject *args)
+{
+	int lun, fd;
+
+	if (!PyArg_ParseTuple(args, "i", &lun))
+		return NULL;
+	if ((fd = cvora_init(lun)) < 0)
+		return error(fd);
+	return Py_BuildValue("i", fd);
+}
+
+static PyObject *py_replay_init(PyObject *self, PyObject *args)
+{
+	const char *path;
+	double speed = 1;
+	int lun, flags = 0, fd;
+
+	if (!PyArg_ParseTuple(args, "si|di", &path, &lun, &speed, &flags))
+		return NULL;
+	if ((fd = cvora_replay_init(path, lun, speed, flags)) < 0)
+		return error(fd);
+	return Py_BuildValue("i", fd);
+}
+
+static PyObject *py_close(PyObject *self, PyObject *args)
+{
+	int fd;
+
+	if (!PyArg_ParseTuple(args, "i", &fd))
+		return NULL;
+	return none_or_error(cvora_close(fd));
+}
+
+static PyObject *py_wait_event(PyObject *self, PyObject *args)
+{
+	struct cvora_event ev;
+	int fd, timeout = -1, cc;
+
+	if (!PyArg_ParseTuple(args, "i|i", &fd, &timeout))
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	cc = cvora_wait_timeout(fd, timeout, &ev);
+	Py_END_ALLOW_THREADS
+	if (cc < 0)
+		return error(cc);
+	return event_dict(&ev);
+}
+
+static PyObject *py_get_sample_size(PyObject *self, PyObject *args)
+{
+	int fd, memsz, cc;
+
+	if (!PyArg_ParseTuple(args, "i", &fd))
+		return NULL;
+	if ((cc = cvora_get_sample_size(fd, &memsz)) < 0)
+		return error(cc);
+	return Py_BuildValue("i", memsz);
+}
+
+/*
+ * read_samples(fd, buf[, chunk]) fills buf and returns the bytes read,
+ * pipelined in chunks if chunk is given
+ */
+
+static PyObject *py_read_samples(PyObject *self, PyObject *args)
+{
+	Py_buffer buf;
+	int fd, chunk = -1, actsz, cc;
+
+	if (!PyArg_ParseTuple(args, "iw*|i", &fd, &buf, &chunk))
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	if (chunk < 0)
+		cc = cvora_read_samples(fd, buf.len, &actsz, buf.buf);
+	else
+		cc = cvora_read_samples_pipelined(fd, chunk, buf.len,
+						  &actsz, buf.buf);
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&buf);
+	if (cc < 0)
+		return error(cc);
+	return Py_BuildValue("i", actsz);
+}
+
+static PyObject *py_mode_channels(PyObject *self, PyObject *args)
+{
+	unsigned int chans = 0;
+	int mode, width, n;
+
+	if (!PyArg_ParseTuple(args, "i|I", &mode, &chans))
+		return NULL;
+	n = cvora_mode_channels(mode, chans, &width);
+	return Py_BuildValue("(ii)", n, width);
+}
+
+/*
+ * demux(mode, chans, buf, bytes, [out..]) splits bytes of buf into the
+ * out buffers and returns the samples per channel
+ */
+
+static PyObject *py_demux(PyObject *self, PyObject *args)
+{
+	Py_buffer src, dst[MAX_CHANNELS];
+	void *out[MAX_CHANNELS];
+	PyObject *list, *item;
+	unsigned int chans;
+	int mode, bytes, width, n, i, got = 0, maxsamples, nsamples, cc = 0;
+
+	if (!PyArg_ParseTuple(args, "iI" RO_BUFFER "iO", &mode, &chans,
+			      &src, &bytes, &list))
+		return NULL;
+	n = cvora_mode_channels(mode, chans, &width);
+	if (!PySequence_Check(list) || PySequence_Size(list) < n) {
+		PyErr_Format(PyExc_ValueError, "%d channel buffers needed", n);
+		goto out;
+	}
+	if (bytes < 0 || bytes > src.len)
+		bytes = src.len;
+
+	maxsamples = 0x7fffffff;
+	for (got = 0; got < n; got++) {
+		if ((item = PySequence_GetItem(list, got)) == NULL)
+			goto out;
+		cc = PyObject_GetBuffer(item, &dst[got], PyBUF_CONTIG);
+		Py_DECREF(item);
+		if (cc < 0)
+			goto out;
+		out[got] = dst[got].buf;
+		if (dst[got].len / (width / 8) < maxsamples)
+			maxsamples = dst[got].len / (width / 8);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	cc = cvora_demux(mode, chans, src.buf, bytes, out, maxsamples,
+			 &nsamples);
+	Py_END_ALLOW_THREADS
+
+out:
+	for (i = 0; i < got; i++)
+		PyBuffer_Release(&dst[i]);
+	PyBuffer_Release(&src);
+	if (PyErr_Occurred())
+		return NULL;
+	if (cc < 0)
+		return error(cc);
+	return Py_BuildValue("i", nsamples);
+}
+
+/*
+ * Statistics travel as one dict per channel, the fields of struct
+ * cvora_stats
+ */
+
+static PyObject *stats_list(const struct cvora_stats *st, int n)
+{
+	const struct cvora_stats *s;
+	PyObject *list, *item;
+	int c;
+
+	if ((list = PyList_New(n)) == NULL)
+		return NULL;
+	for (c = 0; c < n; c++) {
+		s = &st[c];
+		item = Py_BuildValue("{s:K,s:L,s:L,s:d,s:d,s:d,s:K,s:d,s:d}",
+				     "count", (unsigned PY_LONG_LONG)s->count,
+				     "min", (PY_LONG_LONG)s->min,
+				     "max", (PY_LONG_LONG)s->max,
+				     "mean", s->mean, "rms", s->rms,
+				     "stddev", s->stddev,
+				     "overflows",
+				     (unsigned PY_LONG_LONG)s->overflows,
+				     "sum", s->sum, "sumsq", s->sumsq);
+		if (item == NULL) {
+			Py_DECREF(list);
+			return NULL;
+		}
+		PyList_SET_ITEM(list, c, item);
+	}
+	return list;
+}
+
+static int stats_field(PyObject *dict, const char *key, const char *fmt,
+		       void *value)
+{
+	PyObject *item, *args;
+	int cc;
+
+	if ((item = PyDict_GetItemString(dict, key)) == NULL) {
+		PyErr_Format(PyExc_KeyError, "%s", key);
+		return -1;
+	}
+	if ((args = Py_BuildValue("(O)", item)) == NULL)
+		return -1;
+	cc = PyArg_ParseTuple(args, fmt, value) ? 0 : -1;
+	Py_DECREF(args);
+	return cc;
+}
+
+/*
+ * The sums, counts and extremes, from which the rest follows
+ */
+
+static int stats_from_list(PyObject *list, struct cvora_stats *st, int n)
+{
+	PY_LONG_LONG min, max;
+	unsigned PY_LONG_LONG count, overflows;
+	PyObject *dict;
+	int c, cc;
+
+	if (!PySequence_Check(list) || PySequence_Size(list) != n) {
+		PyErr_Format(PyExc_ValueError, "%d channel dicts needed", n);
+		return -1;
+	}
+	for (c = 0; c < n; c++) {
+		if ((dict = PySequence_GetItem(list, c)) == NULL)
+			return -1;
+		cc = -1;
+		if (!PyDict_Check(dict))
+			PyErr_SetString(PyExc_TypeError, "dict expected");
+		else if (stats_field(dict, "count", "K", &count) == 0 &&
+			 stats_field(dict, "min", "L", &min) == 0 &&
+			 stats_field(dict, "max", "L", &max) == 0 &&
+			 stats_field(dict, "overflows", "K", &overflows) == 0 &&
+			 stats_field(dict, "sum", "d", &st[c].sum) == 0 &&
+			 stats_field(dict, "sumsq", "d", &st[c].sumsq) == 0)
+			cc = 0;
+		Py_DECREF(dict);
+		if (cc < 0)
+			return -1;
+		st[c].count = count;
+		st[c].min = min;
+		st[c].max = max;
+		st[c].overflows = overflows;
+	}
+	return 0;
+}
+
+/*
+ * stats(mode, chans, buf, bytes[, flags, offset]) returns a dict of
+ * statistics per channel
+ */
+
+static PyObject *py_stats(PyObject *self, PyObject *args)
+{
+	struct cvora_stats st[MAX_CHANNELS];
+	Py_buffer src;
+	unsigned int chans;
+	int mode, bytes, flags = 0, offset = 0, width, n, cc;
+
+	if (!PyArg_ParseTuple(args, "iI" RO_BUFFER "i|ii", &mode, &chans,
+			      &src, &bytes, &flags, &offset))
+		return NULL;
+	if (bytes < 0 || bytes > src.len)
+		bytes = src.len;
+	n = cvora_mode_channels(mode, chans, &width);
+	cvora_stats_reset(st, MAX_CHANNELS);
+	Py_BEGIN_ALLOW_THREADS
+	cc = cvora_stats_update(mode, chans, flags, src.buf, bytes, offset,
+				st, MAX_CHANNELS);
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&src);
+	if (cc < 0)
+		return error(cc);
+	return stats_list(st, n);
+}
+
+/*
+ * A stats window is a capsule owning a struct cvora_stats_window, its
+ * channel count kept alongside
+ */
+
+#define WINDOW_NAME	"_cvora.stats_window"
+
+struct window {
+	struct cvora_stats_window	*w;
+	int				nchans;
+};
+
+static void window_free(PyObject *capsule)
+{
+	struct window *win = PyCapsule_GetPointer(capsule, WINDOW_NAME);
+
+	if (win) {
+		cvora_stats_window_destroy(win->w);
+		PyMem_Free(win);
+	}
+}
+
+static struct window *window_get(PyObject *capsule)
+{
+	return PyCapsule_GetPointer(capsule, WINDOW_NAME);
+}
+
+static PyObject *py_stats_window_create(PyObject *self, PyObject *args)
+{
+	struct window *win;
+	PyObject *capsule;
+	int cycles, nchans;
+
+	if (!PyArg_ParseTuple(args, "ii", &cycles, &nchans))
+		return NULL;
+	if (nchans > MAX_CHANNELS) {
+		errno = EINVAL;
+		return error(-1);
+	}
+	if ((win = PyMem_Malloc(sizeof(*win))) == NULL)
+		return PyErr_NoMemory();
+	if ((win->w = cvora_stats_window_create(cycles, nchans)) == NULL) {
+		PyMem_Free(win);
+		return error(-1);
+	}
+	win->nchans = nchans;
+	if ((capsule = PyCapsule_New(win, WINDOW_NAME, window_free)) == NULL) {
+		cvora_stats_window_destroy(win->w);
+		PyMem_Free(win);
+	}
+	return capsule;
+}
+
+static PyObject *py_stats_window_add(PyObject *self, PyObject *args)
+{
+	struct cvora_stats st[MAX_CHANNELS];
+	struct window *win;
+	PyObject *capsule, *list;
+
+	if (!PyArg_ParseTuple(args, "OO", &capsule, &list))
+		return NULL;
+	if ((win = window_get(capsule)) == NULL)
+		return NULL;
+	if (stats_from_list(list, st, win->nchans) < 0)
+		return NULL;
+	return none_or_error(cvora_stats_window_add(win->w, st));
+}
+
+static PyObject *py_stats_window_get(PyObject *self, PyObject *args)
+{
+	struct cvora_stats st[MAX_CHANNELS];
+	struct window *win;
+	PyObject *capsule, *list;
+	int cycles;
+
+	if (!PyArg_ParseTuple(args, "O", &capsule))
+		return NULL;
+	if ((win = window_get(capsule)) == NULL)
+		return NULL;
+	cycles = cvora_stats_window_get(win->w, st);
+	if ((list = stats_list(st, win->nchans)) == NULL)
+		return NULL;
+	return Py_BuildValue("(iN)", cycles, list);
+}
+
+#define GETTER(name, type, fmt) \
+static PyObject *py_##name(PyObject *self, PyObject *args) \
+{ \
+	type value; \
+	int fd, cc; \
+	\
+	if (!PyArg_ParseTuple(args, "i", &fd)) \
+		return NULL; \
+	if ((cc = cvora_##name(fd, &value)) < 0) \
+		return error(cc); \
+	return Py_BuildValue(fmt, value); \
+}
+
+#define SETTER(name, type, fmt) \
+static PyObject *py_##name(PyObject *self, PyObject *args) \
+{ \
+	type value; \
+	int fd; \
+	\
+	if (!PyArg_ParseTuple(args, "i" fmt, &fd, &value)) \
+		return NULL; \
+	return none_or_error(cvora_##name(fd, value)); \
+}
+
+#define ACTION(name) \
+static PyObject *py_##name(PyObject *self, PyObject *args) \
+{ \
+	int fd; \
+	\
+	if (!PyArg_ParseTuple(args, "i", &fd)) \
+		return NULL; \
+	return none_or_error(cvora_##name(fd)); \
+}
+
+GETTER(get_mode, enum cvora_mode, "i")
+SETTER(set_mode, int, "i")
+GETTER(get_channels_mask, unsigned int, "I")
+SETTER(set_channels_mask, unsigned int, "I")
+GETTER(get_clock_frequency, unsigned int, "I")
+GETTER(get_hardware_status, unsigned int, "I")
+GETTER(get_version, int, "i")
+GETTER(get_timeout, int, "i")
+SETTER(set_timeout, int, "i")
+ACTION(enable_module)
+ACTION(disable_module)
+ACTION(enable_interrupts)
+ACTION(disable_interrupts)
+ACTION(soft_start)
+ACTION(soft_stop)
+ACTION(soft_rearm)
+
+#define METHOD(name, doc)	{ #name, py_##name, METH_VARARGS, doc }
+
+static PyMethodDef methods[] = {
+	METHOD(init, "init(lun) -> fd"),
+	METHOD(replay_init, "replay_init(path, lun[, speed, flags]) -> fd"),
+	METHOD(close, "close(fd)"),
+	METHOD(wait_event, "wait_event(fd[, timeout_us]) -> event dict"),
+	METHOD(get_sample_size, "get_sample_size(fd) -> bytes"),
+	METHOD(read_samples, "read_samples(fd, buf[, chunk]) -> bytes"),
+	METHOD(mode_channels, "mode_channels(mode[, chans]) -> (n, width)"),
+	METHOD(demux, "demux(mode, chans, buf, bytes, [out..]) -> samples"),
+	METHOD(stats, "stats(mode, chans, buf, bytes[, flags, offset]) -> "
+		      "[dict..]"),
+	METHOD(stats_window_create,
+	       "stats_window_create(cycles, nchans) -> window"),
+	METHOD(stats_window_add, "stats_window_add(window, [dict..])"),
+	METHOD(stats_window_get,
+	       "stats_window_get(window) -> (cycles, [dict..])"),
+	METHOD(get_mode, "get_mode(fd) -> mode"),
+	METHOD(set_mode, "set_mode(fd, mode)"),
+	METHOD(get_channels_mask, "get_channels_mask(fd) -> mask"),
+	METHOD(set_channels_mask, "set_channels_mask(fd, mask)"),
+	METHOD(get_clock_frequency, "get_clock_frequency(fd) -> freq"),
+	METHOD(get_hardware_status, "get_hardware_status(fd) -> status"),
+	METHOD(get_version, "get_version(fd) -> version"),
+	METHOD(get_timeout, "get_timeout(fd) -> ms"),
+	METHOD(set_timeout, "set_timeout(fd, ms)"),
+	METHOD(enable_module, "enable_module(fd)"),
+	METHOD(disable_module, "disable_module(fd)"),
+	METHOD(enable_interrupts, "enable_interrupts(fd)"),
+	METHOD(disable_interrupts, "disable_interrupts(fd)"),
+	METHOD(soft_start, "soft_start(fd)"),
+	METHOD(soft_stop, "soft_stop(fd)"),
+	METHOD(soft_rearm, "soft_rearm(fd)"),
+	{ NULL, NULL, 0, NULL }
+};
+
+static const char doc[] = "libcvora binding, see cvora.py";
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT, "_cvora", doc, -1, methods,
+};
+
+PyMODINIT_FUNC PyInit__cvora(void)
+{
+	PyObject *m = PyModule_Create(&module);
+
+	if (m) {
+		PyModule_AddIntConstant(m, "REPLAY_LOOP", CVORA_REPLAY_LOOP);
+		PyModule_AddIntConstant(m, "STATS_SIGNED", CVORA_STATS_SIGNED);
+	}
+	return m;
+}
+#else
+PyMODINIT_FUNC init_cvora(void)
+{
+	PyObject *m = Py_InitModule3("_cvora", methods, doc);
+
+	if (m) {
+		PyModule_AddIntConstant(m, "REPLAY_LOOP", CVORA_REPLAY_LOOP);
+		PyModule_AddIntConstant(m, "STATS_SIGNED", CVORA_STATS_SIGNED);
+	}
+}
+#endif
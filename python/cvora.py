@@ -0,0 +1,127 @@
+#    coding: utf8
+"""NumPy access to CVORA modules
+
+    import cvora
+    dev = cvora.Cvora(0)
+    while True:
+        ev = dev.wait()
+        raw = dev.read()                # uint32 samples, byte swapped
+        chans = dev.channels(ev)        # one array per channel, demuxed
+
+read() and channels() fill arrays allocated once and kept by the Cvora
+object, and return views of the part filled, so the next call reuses
+them; copy what must outlive it. Pass out= to use arrays of your own.
+Waiting and reading release the GIL.
+
+16 bit channels come out as uint16, view them as int16 if the inputs
+are signed. Cvora(lun, replay=path) reads a recording instead of the
+module, see cvora_replay_init. stats() gives the figures of each
+channel of the last read(), and StatsWindow rolls them over cycles.
+"""
+
+import numpy
+import _cvora
+
+MEM_SIZE = 0x7FFFC - 0x20
+REPLAY_LOOP = _cvora.REPLAY_LOOP
+STATS_SIGNED = _cvora.STATS_SIGNED
+
+
+class Cvora(object):
+
+    def __init__(self, lun, replay=None, speed=1.0, loop=False):
+        self.lun = lun
+        if replay:
+            self.fd = _cvora.replay_init(replay, lun, speed,
+                                         loop and REPLAY_LOOP or 0)
+        else:
+            self.fd = _cvora.init(lun)
+        self.raw = numpy.empty(MEM_SIZE // 4, dtype=numpy.uint32)
+        self.last = self.raw            # buffer of the last read()
+        self.nbytes = 0
+        self.chans = {}
+
+    def close(self):
+        if self.fd >= 0:
+            _cvora.close(self.fd)
+            self.fd = -1
+
+    def __del__(self):
+        self.close()
+
+    def wait(self, timeout_us=-1):
+        """Wait for the next interrupt, returns the event as a dict"""
+        return _cvora.wait_event(self.fd, timeout_us)
+
+    def read(self, out=None, chunk=-1):
+        """Read the memory into out, pipelined in chunk bytes if given"""
+        if out is None:
+            out = self.raw
+        self.nbytes = _cvora.read_samples(self.fd, out, chunk)
+        self.last = out
+        return out[:self.nbytes // out.itemsize]
+
+    def channels(self, event=None, out=None):
+        """Demux the last read() into one array per channel
+
+        The mode and channel mask come from event, as returned by
+        wait(), or are read from the module.
+        """
+        mode, mask = self._layout(event)
+        n, width = _cvora.mode_channels(mode, mask)
+        if out is None:
+            key = (n, width)
+            if key not in self.chans:
+                per = MEM_SIZE * 8 // width // n
+                dtype = width == 16 and numpy.uint16 or numpy.uint32
+                self.chans[key] = [numpy.empty(per, dtype=dtype)
+                                   for i in range(n)]
+            out = self.chans[key]
+        got = _cvora.demux(mode, mask, self.last, self.nbytes, out)
+        return [c[:got] for c in out]
+
+    def stats(self, event=None, signed=False):
+        """Statistics of each channel of the last read(), as dicts
+
+        Keys are count, min, max, mean, rms, stddev, overflows (samples
+        at either end of the range), sum and sumsq.
+        """
+        mode, mask = self._layout(event)
+        return _cvora.stats(mode, mask, self.last, self.nbytes,
+                            signed and STATS_SIGNED or 0)
+
+    def _layout(self, event):
+        if event is not None:
+            mode = event['mode'] & 0x7
+        else:
+            mode = _cvora.get_mode(self.fd)
+        return mode, _cvora.get_channels_mask(self.fd)
+
+    def __getattr__(self, name):
+        """Other library calls, with the file descriptor filled in"""
+        fn = getattr(_cvora, name)
+        return lambda *args: fn(self.fd, *args)
+
+
+class StatsWindow(object):
+    """Statistics over the last cycles, fed with Cvora.stats()
+
+    The cycles are kept and summed by cvora_stats_window, created on
+    the first add() for the channels it brings.
+    """
+
+    def __init__(self, cycles):
+        self.cycles = cycles
+        self.window = None
+
+    def add(self, stats):
+        if self.window is None:
+            self.window = _cvora.stats_window_create(self.cycles,
+                                                     len(stats))
+        _cvora.stats_window_add(self.window, stats)
+
+    def get(self):
+        """Statistics of the cycles kept, per channel"""
+        if self.window is None:
+            return []
+        return _cvora.stats_window_get(self.window)[1]
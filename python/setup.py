@@ -0,0 +1,23 @@
+#!   /usr/bin/env	python
+#    coding: utf8
+#
+# Build the libcvora binding against the static library one level up:
+#	make libs && cd python && CPU=L865 python setup.py build_ext --inplace
+
+import os
+try:
+    from setuptools import setup, Extension
+except ImportError:
+    from distutils.core import setup, Extension
+
+cpu = os.environ.get('CPU', 'L865')
+top = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+
+setup(name='cvora',
+      version='1.0',
+      description='CVORA user library binding',
+      py_modules=['cvora'],
+      ext_modules=[Extension('_cvora', ['_cvora.c'],
+                             include_dirs=[top],
+                             extra_objects=[os.path.join(top, 'libcvora.%s.a' % cpu)],
+                             libraries=['rt', 'pthread', 'm'])])
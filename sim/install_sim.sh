@@ -0,0 +1,43 @@
+#!/bin/sh
+
+# Install the simulated vmebus and the cvora driver on top of it,
+# one simulated board per lun, for tests without a VME crate.
+#
+# usage: install_sim.sh [number_of_boards [clock_hz]]
+
+DRIVER_NAME="cvora"
+BOARDS=${1:-1}
+CLOCK=${2:-100000}
+
+LUNS=""
+BASES=""
+VECTORS=""
+LEVELS=""
+for LUN in `seq 0 $(($BOARDS - 1))`; do
+    LUNS="$LUNS,$LUN"
+    BASES="$BASES,`printf 0x%X $((0x100000 * ($LUN + 1)))`"
+    VECTORS="$VECTORS,`printf 0x%X $((0xb0 + $LUN))`"
+    LEVELS="$LEVELS,2"
+done
+LUNS=${LUNS#,}
+BASES=${BASES#,}
+VECTORS=${VECTORS#,}
+LEVELS=${LEVELS#,}
+
+echo "Installing simulated vmebus with $BOARDS board(s) at $CLOCK Hz..."
+insmod sim/vmebus_sim.ko base=$BASES clock=$CLOCK || exit 1
+
+INSMOD_ARGS="lun=$LUNS vector=$VECTORS level=$LEVELS am1=0x39 data_width1=32 size1=0x80000 base_address1=$BASES isrc=0"
+echo "installing $DRIVER_NAME by insmod $DRIVER_NAME $INSMOD_ARGS"
+insmod $DRIVER_NAME.ko $INSMOD_ARGS || exit 1
+
+MAJOR=`cat /proc/devices | awk '$2 == "'$DRIVER_NAME'" {print $1}'`
+if [ -z "$MAJOR" ]; then
+	echo "driver $DRIVER_NAME not installed!"
+	exit 1
+fi
+
+for MINOR in `seq 0 $(($BOARDS - 1))`; do
+    rm -f /dev/cvora.$MINOR
+    mknod /dev/cvora.$MINOR c $MAJOR $MINOR
+done
@@ -0,0 +1,531 @@
+
+/**
+ * =================================================
+ * Simulated vmebus backend with a CVORA board model
+ *
+ * Stands in for the vmebus bridge driver on machines without a VME
+ * crate. It exports the entry points the cvora driver uses and backs
+ * every configured board with a model of its registers and sample
+ * memory, so that cvora.ko and libcvora run unchanged against it.
+ *
+ * base, VME base addresses of the simulated boards (A24)
+ * clock, Sampling clock of each board in Hz (first value by default)
+ * tick, Model update period in microseconds
+ *
+ * Example: insmod vmebus_sim.ko base=0x100000,0x200000 clock=100000
+ *          insmod cvora.ko lun=0,1 base_address1=0x100000,0x200000 \
+ *                 am1=0x39 data_width1=32 size1=0x80000 \
+ *                 vector=0xb0,0xb1 level=2,2
+ *
+ * The model handles the control bits (module and interrupt enable,
+ * soft start/stop/rearm, overflow flags, vector), the mode register,
+ * the memory pointer advancing at the configured clock through the
+ * CVORA_MEM_MIN..CVORA_MEM_MAX sample memory and the stop interrupt.
+ * Registers are plain memory, so the model sees driver writes at the
+ * next tick rather than immediately. DMA outside a board raises a
+ * bus error through the registered handlers.
+ *
+ * ======================================================================
+ * Includes
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <asm/uaccess.h>
+#include <asm/byteorder.h>
+#include <asm/system.h>
+
+#include "vmebus.h"
+#include "libcvora.h"
+
+#define TSI148_LCSR_DSTA_DON (1<<25)	/* DMA done */
+
+#define SIM_MAX_BOARDS	32
+#define SIM_WINDOW	0x80000		/* Registers and sample memory */
+#define SIM_VERSION	0x5131		/* Reported firmware version */
+
+#define SOFT_BITS	((1 << CVORA_SOFT_START_BIT) | \
+			 (1 << CVORA_SOFT_STOP_BIT) | \
+			 (1 << CVORA_SOFT_REARM_BIT))
+
+MODULE_AUTHOR("BE/CO/HT CERN");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Simulated vmebus with CVORA board model");
+
+/*
+ * ==============================
+ * Module parameter storage area
+ */
+
+static long base[SIM_MAX_BOARDS] = { 0x100000 };
+static long clock[SIM_MAX_BOARDS] = { 100000 };
+static unsigned int base_num = 1;
+static unsigned int clock_num = 1;
+static long tick = 100;
+
+module_param_array(base, long, &base_num, 0444);
+module_param_array(clock, long, &clock_num, 0444);
+module_param(tick, long, 0444);
+
+MODULE_PARM_DESC(base, "VME base addresses of the simulated boards");
+MODULE_PARM_DESC(clock, "Sampling clocks in Hz");
+MODULE_PARM_DESC(tick, "Model update period in microseconds");
+
+static char *sim_name = "vmebus_sim";
+
+/*
+ * Simulated board:
+ *	mem		registers and sample memory, big endian like VME
+ *	running		acquisition in progress
+ *	acc_ns		time not yet turned into samples
+ *	last		time of the last model update
+ */
+
+struct sim_board {
+	unsigned long	base;
+	unsigned long	clock;
+	char		*mem;
+	int		mapped;
+
+	int		running;
+	u64		acc_ns;
+	ktime_t		last;
+	unsigned int	sample;
+};
+
+static struct sim_board boards[SIM_MAX_BOARDS];
+static int nboards;
+
+/* Interrupt handlers by vector */
+
+struct sim_isr {
+	int	(*handler)(void *);
+	void	*arg;
+};
+
+static struct sim_isr isrs[256];
+
+/* Bus error handlers */
+
+struct sim_berr_handler {
+	struct list_head	list;
+	unsigned long		address;
+	size_t			size;
+	int			am;
+	void			(*func)(struct vme_bus_error *);
+};
+
+static LIST_HEAD(berr_handlers);
+static DEFINE_SPINLOCK(sim_lock);
+static struct hrtimer sim_timer;
+
+/* ==================== */
+
+static unsigned int rd(struct sim_board *b, int offset)
+{
+	return be32_to_cpu(*(volatile __be32 *)&b->mem[offset]);
+}
+
+static void wr(struct sim_board *b, int offset, unsigned int v)
+{
+	*(volatile __be32 *)&b->mem[offset] = cpu_to_be32(v);
+}
+
+/* Atomically clear and set control bits, the driver may write too */
+/* Returns the previous value                                       */
+
+static unsigned int update_control(struct sim_board *b,
+				   unsigned int clr, unsigned int set)
+{
+	u32 *p = (u32 *)&b->mem[CVORA_CONTROL];
+	u32 old, new;
+
+	do {
+		old = *(volatile u32 *)p;
+		new = cpu_to_be32((be32_to_cpu(old) & ~clr) | set);
+	} while (cmpxchg(p, old, new) != old);
+	return be32_to_cpu(old);
+}
+
+static struct sim_board *find_board(unsigned long vmeaddr, unsigned long len)
+{
+	int i;
+
+	for (i = 0; i < nboards; i++) {
+		struct sim_board *b = &boards[i];
+
+		if (vmeaddr >= b->base &&
+		    vmeaddr + len <= b->base + SIM_WINDOW)
+			return b;
+	}
+	return NULL;
+}
+
+/*
+ * =========================================================
+ * Board model
+ * =========================================================
+ */
+
+/*
+ * Synthetic sample word: a ramp in the low half and its complement
+ * in the high half, so that both 16 bit channels of the dual modes
+ * and all 32 serial inputs change from one sample to the next.
+ */
+
+static unsigned int sample_word(struct sim_board *b)
+{
+	unsigned int s = b->sample++;
+
+	return ((~s & 0xffff) << 16) | (s & 0xffff);
+}
+
+static void raise_irq(struct sim_board *b, unsigned int control)
+{
+	int vec = (control & CVORA_VECTOR_MASK) >> CVORA_VECTOR_BIT;
+
+	if (!(control & (1 << CVORA_INT_ENABLE_BIT)) ||
+	    !(control & (1 << CVORA_MODULE_ENABLE_BIT)))
+		return;
+	if (isrs[vec].handler)
+		isrs[vec].handler(isrs[vec].arg);
+}
+
+static void stop_acquisition(struct sim_board *b, unsigned int control)
+{
+	b->running = 0;
+	raise_irq(b, control);
+}
+
+static void advance(struct sim_board *b, ktime_t now)
+{
+	unsigned int control, memp;
+	u64 n, used;
+
+	n = ktime_to_ns(ktime_sub(now, b->last));
+	b->last = now;
+	if (!b->running)
+		return;
+
+	b->acc_ns += n;
+	n = b->acc_ns * b->clock;
+	do_div(n, NSEC_PER_SEC);
+	if (n == 0)
+		return;
+	used = n * NSEC_PER_SEC;
+	do_div(used, b->clock);
+	b->acc_ns -= used;
+
+	memp = rd(b, CVORA_MEMORY_POINTER);
+	while (n--) {
+		if (memp >= CVORA_MEM_MAX) {
+			control = update_control(b, 0, 1 << CVORA_RAM_OVERFLOW);
+			stop_acquisition(b, control);
+			break;
+		}
+		wr(b, memp, sample_word(b));
+		memp += sizeof(unsigned int);
+	}
+	wr(b, CVORA_MEMORY_POINTER, memp);
+}
+
+static void model_board(struct sim_board *b, ktime_t now)
+{
+	unsigned int control;
+
+	control = update_control(b, SOFT_BITS, 0);
+	wr(b, CVORA_FREQUENCY, b->clock);
+	wr(b, CVORA_MODE, rd(b, CVORA_MODE) & CVORA_MODE_MASK);
+
+	if (!(control & (1 << CVORA_MODULE_ENABLE_BIT))) {
+		b->running = 0;
+		b->last = now;
+		return;
+	}
+
+	if (control & (1 << CVORA_SOFT_REARM_BIT)) {
+		b->running = 0;
+		update_control(b, (1 << CVORA_COUNTER_OVERFLOW) |
+				  (1 << CVORA_RAM_OVERFLOW), 0);
+		wr(b, CVORA_MEMORY_POINTER, CVORA_MEM_MIN);
+	}
+	if (control & (1 << CVORA_SOFT_START_BIT)) {
+		b->running = 1;
+		b->acc_ns = 0;
+		b->last = now;
+		wr(b, CVORA_MEMORY_POINTER, CVORA_MEM_MIN);
+	}
+
+	advance(b, now);
+
+	if ((control & (1 << CVORA_SOFT_STOP_BIT)) && b->running)
+		stop_acquisition(b, rd(b, CVORA_CONTROL));
+}
+
+static enum hrtimer_restart sim_tick(struct hrtimer *timer)
+{
+	ktime_t now = hrtimer_cb_get_time(timer);
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	for (i = 0; i < nboards; i++)
+		model_board(&boards[i], now);
+	spin_unlock_irqrestore(&sim_lock, flags);
+
+	hrtimer_forward(timer, now, ktime_set(0, tick * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+/*
+ * =========================================================
+ * vmebus entry points used by the cvora driver
+ * =========================================================
+ */
+
+unsigned long find_controller(unsigned long vmeaddr, unsigned long len,
+			      unsigned long am, unsigned long offset,
+			      unsigned long size, struct pdparam_master *param)
+{
+	struct sim_board *b = find_board(vmeaddr, len);
+
+	if (!b)
+		return -1UL;
+	b->mapped++;
+	return (unsigned long)&b->mem[vmeaddr - b->base];
+}
+EXPORT_SYMBOL_GPL(find_controller);
+
+unsigned long return_controller(unsigned long logaddr, unsigned long len)
+{
+	int i;
+
+	for (i = 0; i < nboards; i++) {
+		struct sim_board *b = &boards[i];
+		unsigned long mem = (unsigned long)b->mem;
+
+		if (logaddr >= mem && logaddr < mem + SIM_WINDOW) {
+			b->mapped--;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+EXPORT_SYMBOL_GPL(return_controller);
+
+int vme_intset(int vec, int (*handler)(void *), void *arg, void *sig)
+{
+	unsigned long flags;
+
+	if (vec < 0 || vec > 255)
+		return -EINVAL;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	if (isrs[vec].handler) {
+		spin_unlock_irqrestore(&sim_lock, flags);
+		return -EBUSY;
+	}
+	isrs[vec].handler = handler;
+	isrs[vec].arg = arg;
+	spin_unlock_irqrestore(&sim_lock, flags);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(vme_intset);
+
+int vme_intclr(int vec, void *sig)
+{
+	unsigned long flags;
+
+	if (vec < 0 || vec > 255)
+		return -EINVAL;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	isrs[vec].handler = NULL;
+	isrs[vec].arg = NULL;
+	spin_unlock_irqrestore(&sim_lock, flags);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(vme_intclr);
+
+struct vme_berr_handler *
+vme_register_berr_handler(struct vme_bus_error *error, size_t size,
+			  vme_berr_handler_t func)
+{
+	struct sim_berr_handler *h;
+	unsigned long flags;
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return ERR_PTR(-ENOMEM);
+	h->address = error->address;
+	h->am = error->am;
+	h->size = size;
+	h->func = func;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	list_add_tail(&h->list, &berr_handlers);
+	spin_unlock_irqrestore(&sim_lock, flags);
+
+	return (struct vme_berr_handler *)h;
+}
+EXPORT_SYMBOL_GPL(vme_register_berr_handler);
+
+void vme_unregister_berr_handler(struct vme_berr_handler *handler)
+{
+	struct sim_berr_handler *h = (struct sim_berr_handler *)handler;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	list_del(&h->list);
+	spin_unlock_irqrestore(&sim_lock, flags);
+	kfree(h);
+}
+EXPORT_SYMBOL_GPL(vme_unregister_berr_handler);
+
+static void bus_error(unsigned long vmeaddr, int am)
+{
+	struct sim_berr_handler *h;
+	struct vme_bus_error berr;
+	unsigned long flags;
+
+	berr.address = vmeaddr;
+	berr.am = am;
+
+	spin_lock_irqsave(&sim_lock, flags);
+	list_for_each_entry(h, &berr_handlers, list) {
+		if (vmeaddr >= h->address && vmeaddr < h->address + h->size)
+			h->func(&berr);
+	}
+	spin_unlock_irqrestore(&sim_lock, flags);
+}
+
+/*
+ * The user and kernel variants only differ in how the host
+ * buffer is accessed
+ */
+
+static int sim_dma(struct vme_dma *desc, int user)
+{
+	struct vme_dma_attr *vme, *host;
+	unsigned long vmeaddr, hostaddr;
+	struct sim_board *b;
+	char *mem;
+	int cc = 0;
+
+	if (desc->dir == VME_DMA_FROM_DEVICE) {
+		vme = &desc->src;
+		host = &desc->dst;
+	} else {
+		vme = &desc->dst;
+		host = &desc->src;
+	}
+	vmeaddr = vme->addrl;
+	hostaddr = host->addrl;
+#if BITS_PER_LONG == 64
+	hostaddr |= (unsigned long)host->addru << 32;
+#endif
+
+	desc->status = 0;
+	b = find_board(vmeaddr, desc->length);
+	if (!b) {
+		bus_error(vmeaddr, vme->am);
+		return -EIO;
+	}
+	mem = &b->mem[vmeaddr - b->base];
+
+	if (desc->dir == VME_DMA_FROM_DEVICE) {
+		if (user)
+			cc = copy_to_user((void *)hostaddr, mem, desc->length);
+		else
+			memcpy((void *)hostaddr, mem, desc->length);
+	} else {
+		if (user)
+			cc = copy_from_user(mem, (void *)hostaddr, desc->length);
+		else
+			memcpy(mem, (void *)hostaddr, desc->length);
+	}
+	if (cc)
+		return -EFAULT;
+
+	desc->status = TSI148_LCSR_DSTA_DON;
+	return 0;
+}
+
+int vme_do_dma(struct vme_dma *desc)
+{
+	return sim_dma(desc, 1);
+}
+EXPORT_SYMBOL_GPL(vme_do_dma);
+
+int vme_do_dma_kernel(struct vme_dma *desc)
+{
+	return sim_dma(desc, 0);
+}
+EXPORT_SYMBOL_GPL(vme_do_dma_kernel);
+
+/*
+ * =====================================================
+ * Install
+ * =====================================================
+ */
+
+static void sim_free_boards(void)
+{
+	int i;
+
+	for (i = 0; i < nboards; i++)
+		vfree(boards[i].mem);
+	nboards = 0;
+}
+
+static int __init sim_install(void)
+{
+	int i;
+
+	if (base_num <= 0 || base_num > SIM_MAX_BOARDS || tick <= 0)
+		return -EINVAL;
+
+	for (i = 0; i < base_num; i++) {
+		struct sim_board *b = &boards[i];
+
+		b->base = base[i];
+		b->clock = (i < clock_num) ? clock[i] : clock[0];
+		if (b->clock <= 0)
+			b->clock = 1;
+		b->mem = vmalloc(SIM_WINDOW);
+		if (!b->mem) {
+			sim_free_boards();
+			return -ENOMEM;
+		}
+		memset(b->mem, 0, SIM_WINDOW);
+		nboards = i + 1;
+
+		wr(b, CVORA_CONTROL, SIM_VERSION << CVORA_VERSION_BIT);
+		wr(b, CVORA_MEMORY_POINTER, CVORA_MEM_MIN);
+		wr(b, CVORA_FREQUENCY, b->clock);
+		b->last = ktime_get();
+
+		printk("%s:Board:0x%lX Clock:%ldHz\n", sim_name, b->base,
+		       b->clock);
+	}
+
+	hrtimer_init(&sim_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sim_timer.function = sim_tick;
+	hrtimer_start(&sim_timer, ktime_set(0, tick * NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
+	return 0;
+}
+
+static void __exit sim_uninstall(void)
+{
+	hrtimer_cancel(&sim_timer);
+	sim_free_boards();
+}
+
+module_init(sim_install);
+module_exit(sim_uninstall);
@@ -0,0 +1,404 @@
+/**
+ * Benchmarks for the cvora driver and library hot paths
+ *
+ * usage: cvorabench [-l lun] [-n iterations] [-f json|csv] [-s] [-o file]
+ *
+ *	-l	logical unit to run on (default 0)
+ *	-n	iterations per measurement (default 1000)
+ *	-f	output format, json (default) or csv
+ *	-s	use the driver synthetic interrupt generator instead of
+ *		soft start/stop to produce interrupts
+ *	-o	also time recording full memories of 32 boards to file
+ *
+ * Runs against a real module or the simulated vmebus in sim/.
+ * Latencies are in microseconds, throughputs in MB/s.
+ */
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "cvora.h"
+#include "libcvora.h"
+#include "cvorarec.h"
+
+#define DEFAULT_ITERATIONS	1000
+#define RECORD_BOARDS		32
+
+static int iterations = DEFAULT_ITERATIONS;
+static int csv;
+static int synthetic;
+static int results;
+
+static double now_us(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(double *v, int n, double p)
+{
+	int i = (int)(p / 100.0 * (n - 1) + 0.5);
+
+	return v[i];
+}
+
+/*
+ * Print one result line. Samples are latencies in microseconds;
+ * if bytes is not zero the throughput for that transfer size is
+ * reported as well.
+ */
+
+static void report(const char *name, int bytes, double *v, int n)
+{
+	double sum = 0;
+	int i;
+
+	if (n == 0)
+		return;
+	qsort(v, n, sizeof(*v), cmp_double);
+	for (i = 0; i < n; i++)
+		sum += v[i];
+
+	if (csv) {
+		if (results++ == 0)
+			printf("name,bytes,n,min,mean,p50,p90,p99,p999,max,mbps\n");
+		printf("%s,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+		       name, bytes, n, v[0], sum / n,
+		       percentile(v, n, 50), percentile(v, n, 90),
+		       percentile(v, n, 99), percentile(v, n, 99.9),
+		       v[n - 1], bytes ? bytes / percentile(v, n, 50) : 0);
+		return;
+	}
+	printf("%s\n    {\"name\": \"%s\", \"bytes\": %d, \"n\": %d, "
+	       "\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+	       "\"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f, \"mbps\": %.3f}",
+	       results++ ? "," : "",
+	       name, bytes, n, v[0], sum / n,
+	       percentile(v, n, 50), percentile(v, n, 90),
+	       percentile(v, n, 99), percentile(v, n, 99.9),
+	       v[n - 1], bytes ? bytes / percentile(v, n, 50) : 0);
+}
+
+/* ==================== */
+
+static void bench_register(int fd, double *v)
+{
+	unsigned int freq;
+	double t;
+	int i, n = 0;
+
+	for (i = 0; i < iterations; i++) {
+		t = now_us(CLOCK_MONOTONIC);
+		if (cvora_get_clock_frequency(fd, &freq) != 0)
+			break;
+		v[n++] = now_us(CLOCK_MONOTONIC) - t;
+	}
+	report("register_read", 0, v, n);
+}
+
+static void bench_set_reg_bit(int fd, double *v)
+{
+	double t;
+	int i, n = 0;
+
+	for (i = 0; i < iterations; i++) {
+		t = now_us(CLOCK_MONOTONIC);
+		if (cvora_enable_module(fd) != 0)
+			break;
+		v[n++] = now_us(CLOCK_MONOTONIC) - t;
+	}
+	report("set_reg_bit", 0, v, n);
+}
+
+static void bench_pio(int fd, double *v, int winum, int dwd)
+{
+	static char buf[vmeioMAX_BUF];
+	struct vmeio_riob_s riob;
+	char name[64];
+	double t;
+	int i, n = 0;
+
+	sprintf(name, "raw_read_win%d_d%d", winum, dwd * 8);
+	memset(&riob, 0, sizeof(riob));
+	riob.winum = winum;
+	riob.offset = CVORA_MEMORY;
+	riob.bsize = sizeof(buf);
+	riob.buffer = buf;
+
+	for (i = 0; i < iterations; i++) {
+		t = now_us(CLOCK_MONOTONIC);
+		if (ioctl(fd, VMEIO_RAW_READ, &riob) != 0)
+			break;
+		v[n++] = now_us(CLOCK_MONOTONIC) - t;
+	}
+	report(name, sizeof(buf), v, n);
+}
+
+static void bench_dma(int fd, double *v, char *buf)
+{
+	struct vmeio_riob_s riob;
+	int size, i, n;
+	char name[64];
+	double t;
+
+	for (size = 4; ; size *= 4) {
+		if (size > CVORA_MEM_SIZE)
+			size = CVORA_MEM_SIZE;
+		sprintf(name, "raw_read_dma_%d", size);
+		memset(&riob, 0, sizeof(riob));
+		riob.winum = 1;
+		riob.offset = CVORA_MEMORY;
+		riob.bsize = size;
+		riob.buffer = buf;
+
+		for (i = 0, n = 0; i < iterations; i++) {
+			t = now_us(CLOCK_MONOTONIC);
+			if (ioctl(fd, VMEIO_RAW_READ_DMA, &riob) != 0)
+				break;
+			v[n++] = now_us(CLOCK_MONOTONIC) - t;
+		}
+		report(name, size, v, n);
+		if (size == CVORA_MEM_SIZE)
+			break;
+	}
+}
+
+/*
+ * Full memory readout including byte swapping, in one transfer and
+ * pipelined in chunks
+ */
+
+static void bench_readout(int fd, double *v, unsigned int *buf)
+{
+	int chunk, size, i, n, cc;
+	char name[64];
+	double t;
+
+	for (chunk = 0; chunk <= 0x40000; chunk = chunk ? chunk * 4 : 0x4000) {
+		if (chunk)
+			sprintf(name, "readout_pipelined_%d", chunk);
+		else
+			strcpy(name, "readout");
+		for (i = 0, n = 0; i < iterations; i++) {
+			t = now_us(CLOCK_MONOTONIC);
+			if (chunk)
+				cc = cvora_read_samples_pipelined(fd, chunk,
+						CVORA_MEM_SIZE, &size, buf);
+			else
+				cc = cvora_read_samples(fd, CVORA_MEM_SIZE,
+							&size, buf);
+			if (cc != 0)
+				break;
+			v[n++] = now_us(CLOCK_MONOTONIC) - t;
+		}
+		report(name, size, v, n);
+	}
+}
+
+/*
+ * Appending one cycle of RECORD_BOARDS full memories, and the
+ * sustained rate including the writer draining to disk
+ */
+
+static void bench_record(const char *path, double *v, unsigned int *buf)
+{
+	struct cvora_rec_info info;
+	struct cvora_recorder *rec;
+	double t, start, mbps;
+	int i, b, n = 0;
+
+	if ((rec = cvora_rec_open(path, 2 * RECORD_BOARDS,
+				  CVORA_REC_BLOCK)) == NULL) {
+		perror("cvorabench: recorder");
+		return;
+	}
+	memset(&info, 0, sizeof(info));
+	start = now_us(CLOCK_MONOTONIC);
+	for (i = 0; i < iterations; i++) {
+		t = now_us(CLOCK_MONOTONIC);
+		for (b = 0; b < RECORD_BOARDS; b++) {
+			info.lun = b;
+			info.count = i;
+			if (cvora_rec_append(rec, &info, buf,
+					     CVORA_MEM_SIZE) != 0)
+				break;
+		}
+		v[n++] = now_us(CLOCK_MONOTONIC) - t;
+	}
+	cvora_rec_close(rec);
+	mbps = (double)n * RECORD_BOARDS * CVORA_MEM_SIZE /
+	       (now_us(CLOCK_MONOTONIC) - start);
+	report("record_cycle", RECORD_BOARDS * CVORA_MEM_SIZE, v, n);
+	v[0] = RECORD_BOARDS * CVORA_MEM_SIZE / mbps;
+	report("record_sustained", RECORD_BOARDS * CVORA_MEM_SIZE, v, 1);
+}
+
+/*
+ * Produce one interrupt, unless the generator is running, and wait
+ * for it without a window in which it could be missed.
+ */
+
+static int trigger_and_wait(int fd, const void *page, struct vmeio_wait_s *w)
+{
+	struct cvora_status st;
+
+	cvora_status_read(page, &st);
+	memset(w, 0, sizeof(*w));
+	w->interrupt_count = st.count;
+	w->timeout = -1;
+
+	if (!synthetic) {
+		if (cvora_soft_start(fd) != 0 || cvora_soft_stop(fd) != 0)
+			return -1;
+	}
+	return ioctl(fd, VMEIO_WAIT, w);
+}
+
+static void bench_irq_latency(int fd, const void *page, double *v)
+{
+	struct vmeio_wait_s w;
+	struct cvora_status st;
+	double t;
+	int i, n = 0;
+
+	for (i = 0; i < iterations; i++) {
+		if (trigger_and_wait(fd, page, &w) != 0)
+			break;
+		t = now_us(CLOCK_REALTIME);
+		cvora_status_read(page, &st);
+		v[n++] = t - (st.isr_sec * 1e6 + st.isr_nsec / 1e3);
+	}
+	report("irq_to_wait_return", 0, v, n);
+}
+
+static void bench_cycle(int fd, const void *page, double *v, unsigned int *buf)
+{
+	struct vmeio_wait_s w;
+	struct cvora_event ev;
+	double t;
+	int i, n = 0, size = 0;
+
+	for (i = 0; i < iterations; i++) {
+		t = now_us(CLOCK_MONOTONIC);
+		if (trigger_and_wait(fd, page, &w) != 0)
+			break;
+		ev.lun = w.event.logical_unit;
+		ev.mask = w.event.interrupt_mask;
+		ev.count = w.event.interrupt_count;
+		ev.control = w.event.control;
+		ev.memory_pointer = w.event.memory_pointer;
+		ev.mode = w.event.mode;
+		ev.frequency = w.event.frequency;
+		if (cvora_read_event_samples(fd, &ev, CVORA_MEM_SIZE,
+					     &size, buf) != 0)
+			break;
+		if (cvora_soft_rearm(fd) != 0)
+			break;
+		v[n++] = now_us(CLOCK_MONOTONIC) - t;
+	}
+	report("full_cycle", size, v, n);
+}
+
+/* ==================== */
+
+int main(int argc, char *argv[])
+{
+	struct vmeio_get_window_s win;
+	const void *page = NULL;
+	char *record = NULL;
+	unsigned int *buf;
+	double *v;
+	int lun = 0;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "l:n:f:so:h")) != -1) {
+		switch (c) {
+		case 'l':
+			lun = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'f':
+			csv = strcmp(optarg, "csv") == 0;
+			break;
+		case 's':
+			synthetic = 1;
+			break;
+		case 'o':
+			record = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-l lun] [-n iterations] "
+				"[-f json|csv] [-s] [-o file]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations <= 0)
+		iterations = DEFAULT_ITERATIONS;
+
+	if ((fd = cvora_init(lun)) < 0)
+		return 1;
+	v = malloc(iterations * sizeof(*v));
+	buf = malloc(CVORA_MEM_SIZE);
+	if (!v || !buf) {
+		fprintf(stderr, "cvorabench: out of memory\n");
+		return 1;
+	}
+	if (ioctl(fd, VMEIO_GET_DEVICE, &win) != 0) {
+		perror("cvorabench: VMEIO_GET_DEVICE");
+		return 1;
+	}
+	if (cvora_status_map(fd, &page) != 0) {
+		perror("cvorabench: status page");
+		return 1;
+	}
+
+	if (!csv)
+		printf("{\"lun\": %d, \"iterations\": %d, \"synthetic\": %d, "
+		       "\"results\": [", lun, iterations, synthetic);
+
+	bench_register(fd, v);
+	bench_set_reg_bit(fd, v);
+	if (!win.nmap) {
+		bench_pio(fd, v, 1, win.dwd1);
+		if (win.vme2)
+			bench_pio(fd, v, 2, win.dwd2);
+	}
+	bench_dma(fd, v, (char *)buf);
+	bench_readout(fd, v, buf);
+
+	if (synthetic) {
+		cvora_sim_load_image(fd, CVORA_MEM_SIZE, buf);
+		cvora_sim_start(fd, 1000, 1, 0, 0);
+	} else {
+		cvora_enable_module(fd);
+		cvora_enable_interrupts(fd);
+	}
+	bench_irq_latency(fd, page, v);
+	bench_cycle(fd, page, v, buf);
+	if (synthetic)
+		cvora_sim_stop(fd);
+	if (record)
+		bench_record(record, v, buf);
+
+	if (!csv)
+		printf("\n]}\n");
+
+	cvora_status_unmap(page);
+	cvora_close(fd);
+	return 0;
+}
@@ -0,0 +1,210 @@
+/**
+ * DMA calibration for the cvora driver
+ *
+ * usage: cvoradmacal [-l lun[,lun..]] [-n iterations] [-f insmod|json] [-q]
+ *
+ *	-l	logical units to calibrate (default 0)
+ *	-n	transfers per configuration (default 20)
+ *	-f	print the best configuration as insmod parameters
+ *		(default) or json
+ *	-q	only print the result, not every configuration tried
+ *
+ * Sweeps the A24 block transfer modes the module decodes, block size,
+ * backoff and chunk size, times raw DMA reads of the whole sample
+ * memory with each and reports the fastest by median throughput.
+ * Configurations the bridge rejects are skipped. The module
+ * parameters are restored when done.
+ */
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "cvora.h"
+#include "libcvora.h"
+
+#define DEFAULT_ITERATIONS	20
+#define MAX_LUNS		16
+
+struct mode {
+	const char	*name;
+	int		am;
+	int		dwd;
+};
+
+/* Block transfer codes of CVORA_AM, A24 user data */
+
+static struct mode modes[] = {
+	{ "A24_BLT",  0x3B, 32 },
+	{ "A24_MBLT", 0x38, 64 },
+};
+
+static int bsizes[] = { 256, 512, 1024, 2048, 4096 };
+static int backoffs[] = { 0, 1, 2, 4 };
+static int chunks[] = { 0, 4096, 16384, 65536 };
+
+#define N(a) (sizeof(a) / sizeof((a)[0]))
+
+static int iterations = DEFAULT_ITERATIONS;
+static int json;
+static int quiet;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Median MB/s of whole memory reads with params, or < 0 if the
+ * driver or the bridge refuse them. The reads are raw DMAs of the
+ * full memory, whatever the memory pointer says.
+ */
+
+static double measure(int fd, struct cvora_dma_params *params,
+		      unsigned int *buf, double *v)
+{
+	struct vmeio_riob_s riob;
+	double t;
+	int i;
+
+	if (cvora_set_dma_params(fd, params) != 0)
+		return -1;
+	memset(&riob, 0, sizeof(riob));
+	riob.winum = 1;
+	riob.offset = CVORA_MEMORY;
+	riob.bsize = CVORA_MEM_SIZE;
+	riob.buffer = buf;
+	if (ioctl(fd, VMEIO_RAW_READ_DMA, &riob) != 0)
+		return -1;		/* warm up, and check it works */
+
+	for (i = 0; i < iterations; i++) {
+		t = now_us();
+		if (ioctl(fd, VMEIO_RAW_READ_DMA, &riob) != 0)
+			return -1;
+		v[i] = now_us() - t;
+	}
+	qsort(v, iterations, sizeof(*v), cmp_double);
+	return CVORA_MEM_SIZE / v[iterations / 2];
+}
+
+static int calibrate(int lun, unsigned int *buf, double *v)
+{
+	struct cvora_dma_params orig, p, best;
+	double mbps, best_mbps = 0, orig_mbps;
+	int fd, m, b, o, c;
+
+	if ((fd = cvora_init(lun)) < 0)
+		return -1;
+	if (cvora_get_dma_params(fd, &orig) != 0) {
+		perror("cvoradmacal: get DMA parameters");
+		cvora_close(fd);
+		return -1;
+	}
+
+	orig_mbps = measure(fd, &orig, buf, v);
+	best = orig;
+	best_mbps = orig_mbps;
+
+	for (m = 0; m < N(modes); m++)
+	for (b = 0; b < N(bsizes); b++)
+	for (o = 0; o < N(backoffs); o++)
+	for (c = 0; c < N(chunks); c++) {
+		memset(&p, 0, sizeof(p));
+		p.am = modes[m].am;
+		p.dwd = modes[m].dwd;
+		p.bsize = bsizes[b];
+		p.backoff = backoffs[o];
+		p.chunk = chunks[c];
+		mbps = measure(fd, &p, buf, v);
+		if (!quiet)
+			fprintf(stderr, "lun:%d %-8s bsize:%4d backoff:%d "
+				"chunk:%5d %8.3f MB/s\n", lun, modes[m].name,
+				p.bsize, p.backoff, p.chunk, mbps);
+		if (mbps > best_mbps) {
+			best = p;
+			best_mbps = mbps;
+		}
+	}
+
+	if (cvora_set_dma_params(fd, &orig) != 0)
+		perror("cvoradmacal: restore DMA parameters");
+	cvora_close(fd);
+
+	if (json)
+		printf("{\"lun\": %d, \"dma_bsize\": %d, \"dma_backoff\": %d, "
+		       "\"dma_am\": %d, \"dma_dwd\": %d, \"dma_chunk\": %d, "
+		       "\"mbps\": %.3f, \"default_mbps\": %.3f}\n",
+		       lun, best.bsize, best.backoff, best.am, best.dwd,
+		       best.chunk, best_mbps, orig_mbps);
+	else
+		printf("# lun %d: %.3f MB/s (was %.3f MB/s)\n"
+		       "dma_bsize=%d dma_backoff=%d dma_am=0x%x dma_dwd=%d "
+		       "dma_chunk=%d\n", lun, best_mbps, orig_mbps,
+		       best.bsize, best.backoff, best.am, best.dwd, best.chunk);
+	return 0;
+}
+
+/* ==================== */
+
+int main(int argc, char *argv[])
+{
+	int luns[MAX_LUNS], nluns = 0;
+	unsigned int *buf;
+	char *s, *tok;
+	double *v;
+	int c, i, cc = 0;
+
+	while ((c = getopt(argc, argv, "l:n:f:qh")) != -1) {
+		switch (c) {
+		case 'l':
+			s = optarg;
+			while ((tok = strtok(s, ",")) && nluns < MAX_LUNS) {
+				luns[nluns++] = atoi(tok);
+				s = NULL;
+			}
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'f':
+			json = strcmp(optarg, "json") == 0;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-l lun[,lun..]] "
+				"[-n iterations] [-f insmod|json] [-q]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (iterations <= 0)
+		iterations = DEFAULT_ITERATIONS;
+	if (nluns == 0)
+		luns[nluns++] = 0;
+
+	v = malloc(iterations * sizeof(*v));
+	buf = malloc(CVORA_MEM_SIZE);
+	if (!v || !buf) {
+		fprintf(stderr, "cvoradmacal: out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < nluns; i++)
+		if (calibrate(luns[i], buf, v) != 0)
+			cc = 1;
+	return cc;
+}
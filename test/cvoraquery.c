@@ -0,0 +1,141 @@
+/**
+ * Query cvora recordings
+ *
+ * usage: cvoraquery [-l lun] [-f from] [-t to] [-s first[,last]]
+ *		     [-j threads] [-o file] [-q] file..
+ *
+ *	-l	logical unit (default any)
+ *	-f	interrupt time from, seconds since the epoch, inclusive
+ *	-t	interrupt time to, exclusive
+ *	-s	record sequence range, inclusive
+ *	-j	files read in parallel (default one thread per file)
+ *	-o	append the samples of the records found to file
+ *	-q	only print the number of records found and the time taken
+ *
+ * Prints one line per record found, lun by lun in time order.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "libcvora.h"
+#include "cvorarec.h"
+
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *out;
+static unsigned int *buf;
+static int quiet;
+
+static void parse_time(const char *s, int64_t *sec, int64_t *nsec)
+{
+	double t = strtod(s, NULL);
+
+	*sec = (int64_t)t;
+	*nsec = (int64_t)((t - *sec) * 1e9);
+}
+
+static int show(const struct cvora_rec_header *hdr, const void *samples,
+		void *arg)
+{
+	int actsz, cc = 0;
+
+	pthread_mutex_lock(&out_lock);
+	if (!quiet)
+		printf("lun:%d seq:%llu isr:%lld.%09lld count:%u mode:%d "
+		       "bytes:%u%s%s\n", hdr->lun,
+		       (unsigned long long)hdr->sequence,
+		       (long long)hdr->isr_sec, (long long)hdr->isr_nsec,
+		       hdr->count, hdr->mode, hdr->bytes,
+		       hdr->flags & CVORA_REC_COUNTER_OVERFLOW ?
+				" counter_overflow" : "",
+		       hdr->flags & CVORA_REC_RAM_OVERFLOW ?
+				" ram_overflow" : "");
+	if (out) {
+		cc = cvora_arc_samples(hdr, samples, CVORA_MEM_SIZE, &actsz,
+				       buf);
+		if (cc == 0 && fwrite(buf, actsz, 1, out) != 1)
+			cc = -errno;
+	}
+	pthread_mutex_unlock(&out_lock);
+	return cc;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cvora_arc_query q;
+	struct timespec t0, t1;
+	unsigned long long first, last;
+	int c, n, threads = 0;
+	char *outname = NULL;
+
+	memset(&q, 0, sizeof(q));
+	q.lun = -1;
+	while ((c = getopt(argc, argv, "l:f:t:s:j:o:qh")) != -1) {
+		switch (c) {
+		case 'l':
+			q.lun = atoi(optarg);
+			break;
+		case 'f':
+			parse_time(optarg, &q.from_sec, &q.from_nsec);
+			break;
+		case 't':
+			parse_time(optarg, &q.to_sec, &q.to_nsec);
+			break;
+		case 's':
+			first = last = 0;
+			sscanf(optarg, "%llu,%llu", &first, &last);
+			q.first_seq = first;
+			q.last_seq = last;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'o':
+			outname = optarg;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc)
+		goto usage;
+
+	if (outname) {
+		if ((out = fopen(outname, "a")) == NULL) {
+			perror(outname);
+			return 1;
+		}
+		if ((buf = malloc(CVORA_MEM_SIZE)) == NULL) {
+			fprintf(stderr, "cvoraquery: out of memory\n");
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	n = cvora_arc_query_files((const char **)&argv[optind], argc - optind,
+				  threads, &q, show, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (out && fclose(out) != 0 && n >= 0)
+		n = -errno;
+	if (n < 0) {
+		fprintf(stderr, "cvoraquery: %s\n", strerror(-n));
+		return 1;
+	}
+	printf("# %d records in %.3f ms\n", n,
+	       (t1.tv_sec - t0.tv_sec) * 1e3 +
+	       (t1.tv_nsec - t0.tv_nsec) / 1e6);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-l lun] [-f from] [-t to] "
+		"[-s first[,last]] [-j threads] [-o file] [-q] file..\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,180 @@
+/**
+ * Sample codec benchmark on cvora recordings
+ *
+ * usage: cvorazip [-l lun] [-n iterations] [-o file] file..
+ *
+ *	-l	only the records of this logical unit (default all)
+ *	-n	times each record is encoded and decoded (default 10)
+ *	-o	also write the records to file as a compressed recording
+ *
+ * Encodes and decodes every record of the recordings, checks the
+ * samples come back unchanged, and prints the compression ratio and
+ * the encode and decode throughput per mode, in MB/s of samples.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "libcvora.h"
+#include "cvorarec.h"
+#include "cvoracodec.h"
+
+#define DEFAULT_ITERATIONS	10
+#define MODES			8
+
+struct mode_stats {
+	unsigned long	records;
+	double		raw;		/* sample bytes */
+	double		encoded;
+	double		encode_us;
+	double		decode_us;
+};
+
+static struct mode_stats stats[MODES];
+static struct cvora_recorder *rec;
+static int iterations = DEFAULT_ITERATIONS;
+static unsigned int *raw, *dec;
+static void *enc;
+
+static const char *mode_names[MODES] = {
+	"reserved", "optical_16", "copper_16", "btrain_counter",
+	"parallel_input", "optical_2_16", "copper_2_16", "serial_32",
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int bench(const struct cvora_rec_header *hdr, const void *samples,
+		 void *arg)
+{
+	struct mode_stats *st = &stats[hdr->mode % MODES];
+	struct cvora_rec_info info;
+	int bytes, esz, dsz, used, i, cc;
+	double t;
+
+	if ((cc = cvora_arc_samples(hdr, samples, CVORA_MEM_SIZE,
+				    &bytes, raw)) != 0)
+		return cc;
+
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		if ((cc = cvora_encode(hdr->mode, hdr->channels, raw, bytes,
+				       enc, CVORA_CODEC_BOUND(CVORA_MEM_SIZE),
+				       &esz)) != 0)
+			return cc;
+	st->encode_us += now_us() - t;
+
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		if ((cc = cvora_decode(enc, esz, &used, dec,
+				       CVORA_MEM_SIZE, &dsz)) != 0)
+			return cc;
+	st->decode_us += now_us() - t;
+
+	if (dsz != bytes || memcmp(raw, dec, bytes) != 0) {
+		fprintf(stderr, "cvorazip: lun %d record %llu does not "
+			"decode to its samples\n", hdr->lun,
+			(unsigned long long)hdr->sequence);
+		return -EIO;
+	}
+	st->records++;
+	st->raw += (double)bytes * iterations;
+	st->encoded += (double)esz * iterations;
+
+	if (rec) {
+		memset(&info, 0, sizeof(info));
+		info.lun = hdr->lun;
+		info.mode = hdr->mode;
+		info.frequency = hdr->frequency;
+		info.channels = hdr->channels;
+		info.control = hdr->control;
+		info.count = hdr->count;
+		info.isr_sec = hdr->isr_sec;
+		info.isr_nsec = hdr->isr_nsec;
+		if ((cc = cvora_rec_append(rec, &info, raw, bytes)) != 0)
+			return cc;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cvora_arc_query q;
+	struct mode_stats *st;
+	char *outname = NULL;
+	int c, m, n, cc = 0;
+
+	memset(&q, 0, sizeof(q));
+	q.lun = -1;
+	while ((c = getopt(argc, argv, "l:n:o:h")) != -1) {
+		switch (c) {
+		case 'l':
+			q.lun = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'o':
+			outname = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc)
+		goto usage;
+	if (iterations <= 0)
+		iterations = DEFAULT_ITERATIONS;
+
+	raw = malloc(CVORA_MEM_SIZE);
+	dec = malloc(CVORA_MEM_SIZE);
+	enc = malloc(CVORA_CODEC_BOUND(CVORA_MEM_SIZE));
+	if (!raw || !dec || !enc) {
+		fprintf(stderr, "cvorazip: out of memory\n");
+		return 1;
+	}
+	if (outname && (rec = cvora_rec_open(outname, 0,
+			CVORA_REC_BLOCK | CVORA_REC_COMPRESS)) == NULL) {
+		perror(outname);
+		return 1;
+	}
+
+	/* One thread, so records are benchmarked and copied in order */
+
+	n = cvora_arc_query_files((const char **)&argv[optind], argc - optind,
+				  1, &q, bench, NULL);
+	if (rec && (cc = cvora_rec_close(rec)) != 0 && n >= 0)
+		n = cc;
+	if (n < 0) {
+		fprintf(stderr, "cvorazip: %s\n", strerror(-n));
+		return 1;
+	}
+
+	printf("{\"records\": %d, \"iterations\": %d, \"modes\": [", n,
+	       iterations);
+	for (m = 0, c = 0; m < MODES; m++) {
+		st = &stats[m];
+		if (!st->records)
+			continue;
+		printf("%s\n    {\"mode\": \"%s\", \"records\": %lu, "
+		       "\"ratio\": %.3f, \"encode_mbps\": %.1f, "
+		       "\"decode_mbps\": %.1f}", c++ ? "," : "",
+		       mode_names[m], st->records, st->raw / st->encoded,
+		       st->raw / st->encode_us, st->raw / st->decode_us);
+	}
+	printf("\n]}\n");
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-l lun] [-n iterations] [-o file] "
+		"file..\n", argv[0]);
+	return 1;
+}